@@ -0,0 +1,1046 @@
+/**
+    @filename bench.c
+    @author Will Greene (wgreene)
+
+    Benchmarks for the byteBuffer and ripeMD components.  Prints throughput
+    figures so changes to the hot paths can be compared before and after,
+    as a table or, with --csv or --json, in a form other tools can read.
+    With --perf, the compression kernels are also run under hardware
+    performance counters.
+  */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "byteBuffer.h"
+#include "ripeMD.h"
+#include "ripeMDLanes.h"
+#include "hashPool.h"
+#include "fileHash.h"
+#include "uringHash.h"
+#include "outputBuffer.h"
+#include "hmac.h"
+#include "pbkdf2.h"
+#include "perfCounters.h"
+
+/** Default size of the generated input file, in MiB. */
+#define DEFAULT_FILE_MIB 64
+
+/** Number of bytes in a MiB. */
+#define MIB ( 1024 * 1024 )
+
+/** Number of times each measurement is repeated; the best run is reported. */
+#define REPETITIONS 3
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+
+/** Whether cycles() can read a cycle counter on this CPU. */
+#define HAVE_CYCLES 1
+#else
+#define HAVE_CYCLES 0
+#endif
+
+/** Ways of printing the results. */
+typedef enum {
+  /** Aligned columns, with a heading for each section. */
+  STYLE_TEXT,
+
+  /** One "section,name,value,unit" line per result. */
+  STYLE_CSV,
+
+  /** A JSON array with one object per result. */
+  STYLE_JSON
+} ReportStyle;
+
+/** How results are printed, chosen on the command line. */
+static ReportStyle style = STYLE_TEXT;
+
+/** Heading of the section the next results belong to. */
+static char section[ 128 ];
+
+/** Number of results printed so far. */
+static size_t results;
+
+/** Whether --perf was given and the hardware counters opened. */
+static int perfOpen;
+
+/** Hardware counters used with --perf. */
+static PerfCounters perf;
+
+/**
+    Starts a new section of results.  The heading is printed on its own
+    line as a table; otherwise it goes with each result.
+
+    @param format printf() format for the heading
+  */
+static void beginSection( const char *format, ... )
+{
+    va_list args;
+    va_start( args, format );
+    vsnprintf( section, sizeof( section ), format, args );
+    va_end( args );
+
+    if ( style == STYLE_TEXT )
+        printf( "%s\n", section );
+}
+
+/**
+    Prints a string as a JSON string literal.
+
+    @param str string to print
+  */
+static void printJsonString( const char *str )
+{
+    putchar( '"' );
+    for ( ; *str; str++ ) {
+        if ( *str == '"' || *str == '\\' )
+            putchar( '\\' );
+        putchar( *str );
+    }
+    putchar( '"' );
+}
+
+/**
+    Prints one result in the current section.
+
+    @param name what was measured
+    @param value the measurement
+    @param unit unit of the value
+  */
+static void report( const char *name, double value, const char *unit )
+{
+    if ( style == STYLE_TEXT )
+        printf( "%-20s %10.2f %s\n", name, value, unit );
+    else if ( style == STYLE_CSV ) {
+        if ( results == 0 )
+            printf( "section,name,value,unit\n" );
+        printf( "\"%s\",\"%s\",%.6g,%s\n", section, name, value, unit );
+    } else {
+        printf( results == 0 ? "[\n  {\"section\": " : ",\n  {\"section\": " );
+        printJsonString( section );
+        printf( ", \"name\": " );
+        printJsonString( name );
+        printf( ", \"value\": %.6g, \"unit\": ", value );
+        printJsonString( unit );
+        printf( "}" );
+    }
+
+    results++;
+}
+
+/**
+    Ends the output, closing the JSON array.
+  */
+static void finishReport( void )
+{
+    if ( style == STYLE_JSON )
+        printf( results == 0 ? "[]\n" : "\n]\n" );
+}
+
+/**
+    Prints what the hardware counters saw while some work ran: cycles and
+    instructions per byte, instructions per cycle, branch miss rate and
+    cache misses per KiB.  Events the counters couldn't see are left out.
+
+    @param name label for the work, such as a kernel name
+    @param reading counts taken around the work
+    @param bytes number of bytes the work processed
+  */
+static void reportPerf( const char *name, const PerfReading *reading, double bytes )
+{
+    char label[ 48 ];
+    double ratio;
+
+    if ( reading->valid[ PERF_CYCLES ] ) {
+        snprintf( label, sizeof( label ), "%s perf cycles", name );
+        report( label, reading->count[ PERF_CYCLES ] / bytes, "cycles/byte" );
+    }
+    if ( reading->valid[ PERF_INSTRUCTIONS ] ) {
+        snprintf( label, sizeof( label ), "%s instructions", name );
+        report( label, reading->count[ PERF_INSTRUCTIONS ] / bytes, "instructions/byte" );
+    }
+    if ( perfRatio( reading, PERF_INSTRUCTIONS, PERF_CYCLES, &ratio ) ) {
+        snprintf( label, sizeof( label ), "%s IPC", name );
+        report( label, ratio, "instructions/cycle" );
+    }
+    if ( perfRatio( reading, PERF_BRANCH_MISSES, PERF_BRANCHES, &ratio ) ) {
+        snprintf( label, sizeof( label ), "%s branch misses", name );
+        report( label, ratio * 100, "%" );
+    }
+    if ( reading->valid[ PERF_CACHE_MISSES ] ) {
+        snprintf( label, sizeof( label ), "%s cache misses", name );
+        report( label, reading->count[ PERF_CACHE_MISSES ] / ( bytes / 1024 ), "misses/KiB" );
+    }
+}
+
+/**
+    Reads the CPU's time stamp counter, which on current x86 processors
+    ticks at a constant rate close to the nominal clock speed.  With turbo
+    or power saving the core's real clock differs, so cycle figures are
+    approximate; they're still steadier than times across machines of one
+    kind.
+
+    @return counter value, or 0 if there isn't one
+  */
+static unsigned long long cycles( void )
+{
+#if HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+    Returns the current value of a monotonic clock, in seconds.
+
+    @return time in seconds
+  */
+static double now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+    The original readFile() implementation, one fgetc()/addByte() per byte.
+    Kept here as the baseline for the bulk-read path.
+
+    @param filename name of file to read from
+    @return Bytebuffer ( with buffer data )
+  */
+static ByteBuffer *readFileBytewise( const char *filename )
+{
+    FILE *fp = fopen( filename, "rb" );
+
+    if ( !fp ) {
+        return NULL;
+    }
+
+    ByteBuffer *buffer = createBuffer();
+
+    int ch = fgetc( fp );
+
+    while ( ch != EOF ) {
+        addByte( buffer, (byte) ch );
+        ch = fgetc( fp );
+    }
+
+    fclose( fp );
+
+    return buffer;
+}
+
+/**
+    Writes a file of the given size filled with pseudo-random bytes.
+
+    @param filename name of the file to create
+    @param size number of bytes to write
+    @return true if the file was written
+  */
+static int makeInput( const char *filename, size_t size )
+{
+    FILE *fp = fopen( filename, "wb" );
+    if ( !fp )
+        return 0;
+
+    unsigned int seed = 1;
+    byte block[ BLOCK_BYTES ];
+    for ( size_t written = 0; written < size; written += sizeof( block ) ) {
+        for ( int i = 0; i < sizeof( block ); i++ ) {
+            seed = seed * 1103515245 + 12345;
+            block[ i ] = seed >> 16;
+        }
+
+        size_t n = size - written < sizeof( block ) ? size - written : sizeof( block );
+        fwrite( block, 1, n, fp );
+    }
+
+    return fclose( fp ) == 0;
+}
+
+/**
+    Times a file reader over several runs and prints its best throughput.
+
+    @param name label to print for the reader
+    @param reader function reading a file into a ByteBuffer
+    @param filename file to read
+    @param size expected size of the file
+  */
+static void benchReader( const char *name, ByteBuffer *(*reader)( const char * ),
+                         const char *filename, size_t size )
+{
+    double best = 0;
+
+    for ( int i = 0; i < REPETITIONS; i++ ) {
+        double start = now();
+        ByteBuffer *buffer = reader( filename );
+        double elapsed = now() - start;
+
+        if ( !buffer || buffer->len != size ) {
+            fprintf( stderr, "%s: short read\n", name );
+            exit( EXIT_FAILURE );
+        }
+        freeBuffer( buffer );
+
+        if ( i == 0 || elapsed < best )
+            best = elapsed;
+    }
+
+    report( name, size / best / MIB, "MB/s" );
+}
+
+/**
+    Times a compression kernel over a buffer of blocks and prints its best
+    throughput, and its cycles per byte if there's a cycle counter.  With
+    --perf, one more run is made under the hardware counters.
+
+    @param name label to print for the kernel
+    @param kernel function hashing a run of blocks
+    @param data blocks to hash
+    @param nblocks number of blocks in data
+  */
+static void benchKernel( const char *name, void (*kernel)( HashState *, const byte *, size_t ),
+                         const byte *data, size_t nblocks )
+{
+    double best = 0;
+    unsigned long long bestCycles = 0;
+    HashState state;
+    initState( &state );
+
+    for ( int i = 0; i < REPETITIONS; i++ ) {
+        unsigned long long startCycles = cycles();
+        double start = now();
+        kernel( &state, data, nblocks );
+        double elapsed = now() - start;
+        unsigned long long used = cycles() - startCycles;
+
+        if ( i == 0 || elapsed < best )
+            best = elapsed;
+        if ( i == 0 || used < bestCycles )
+            bestCycles = used;
+    }
+
+    report( name, nblocks * BLOCK_BYTES / best / MIB, "MB/s" );
+    if ( HAVE_CYCLES ) {
+        char label[ 32 ];
+        snprintf( label, sizeof( label ), "%s cycles", name );
+        report( label, (double) bestCycles / ( nblocks * BLOCK_BYTES ), "cycles/byte" );
+    }
+
+    if ( perfOpen ) {
+        PerfReading reading;
+        startPerfCounters( &perf );
+        kernel( &state, data, nblocks );
+        stopPerfCounters( &perf, &reading );
+        reportPerf( name, &reading, (double) nblocks * BLOCK_BYTES );
+    }
+}
+
+/** Length of each message in the multi-lane benchmark. */
+#define LANE_MESSAGE_BYTES 64
+
+/**
+    Times hashing many independent messages, one at a time with a HashContext
+    and then with each multi-lane engine the CPU supports.  With --perf, each
+    engine is run once more under the hardware counters.
+
+    @param data bytes to carve into messages
+    @param size number of bytes in data
+  */
+static void benchLanes( const byte *data, size_t size )
+{
+    size_t n = size / LANE_MESSAGE_BYTES;
+    const byte **msgs = (const byte **) malloc( n * sizeof( byte * ) );
+    size_t *lens = (size_t *) malloc( n * sizeof( size_t ) );
+    byte *digests = (byte *) malloc( n * DIGEST_BYTES );
+
+    for ( size_t i = 0; i < n; i++ ) {
+        msgs[ i ] = data + i * LANE_MESSAGE_BYTES;
+        lens[ i ] = LANE_MESSAGE_BYTES;
+    }
+
+    beginSection( "%zu messages of %d bytes", n, LANE_MESSAGE_BYTES );
+
+    double start = now();
+    for ( size_t i = 0; i < n; i++ ) {
+        HashContext ctx;
+        initContext( &ctx );
+        updateContext( &ctx, msgs[ i ], lens[ i ] );
+        finishContext( &ctx, digests + i * DIGEST_BYTES );
+    }
+    double elapsed = now() - start;
+    report( "scalar", n / elapsed / 1e6, "Mhash/s" );
+
+    for ( int e = 0; e < numLaneEngines; e++ ) {
+        if ( !laneEngines[ e ].supported() )
+            continue;
+
+        unsigned long long startCycles = cycles();
+        start = now();
+        hashMessagesLanes( &laneEngines[ e ], msgs, lens, n, digests );
+        elapsed = now() - start;
+        unsigned long long used = cycles() - startCycles;
+        report( laneEngines[ e ].name, n / elapsed / 1e6, "Mhash/s" );
+
+        if ( HAVE_CYCLES ) {
+            char label[ 32 ];
+            snprintf( label, sizeof( label ), "%s cycles", laneEngines[ e ].name );
+            report( label, (double) used / ( n * LANE_MESSAGE_BYTES ), "cycles/byte" );
+        }
+
+        if ( perfOpen ) {
+            PerfReading reading;
+            startPerfCounters( &perf );
+            hashMessagesLanes( &laneEngines[ e ], msgs, lens, n, digests );
+            stopPerfCounters( &perf, &reading );
+            reportPerf( laneEngines[ e ].name, &reading, (double) n * LANE_MESSAGE_BYTES );
+        }
+    }
+
+    free( msgs );
+    free( lens );
+    free( digests );
+}
+
+/** Number of messages hashed for each length in the short-message benchmark. */
+#define SHORT_MESSAGES 1000000
+
+/**
+    The ByteBuffer way of hashing one message: copy it into a buffer, pad
+    it, and hash the padded blocks.
+
+    @param msg message bytes
+    @param len number of bytes in msg
+    @param digest storage for the digest
+  */
+static void hashShortBuffer( const byte *msg, size_t len, byte digest[ DIGEST_BYTES ] )
+{
+    ByteBuffer *buffer = createBuffer();
+    addBytes( buffer, msg, len );
+    padBuffer( buffer );
+
+    HashState state;
+    initState( &state );
+    hashBlocks( &state, buffer->data, buffer->len / BLOCK_BYTES );
+    writeDigest( &state, digest );
+    freeBuffer( buffer );
+}
+
+/**
+    Hashes one message with a HashContext.
+
+    @param msg message bytes
+    @param len number of bytes in msg
+    @param digest storage for the digest
+  */
+static void hashShortContext( const byte *msg, size_t len, byte digest[ DIGEST_BYTES ] )
+{
+    HashContext ctx;
+    initContext( &ctx );
+    updateContext( &ctx, msg, len );
+    finishContext( &ctx, digest );
+}
+
+/**
+    Times hashing many short messages one at a time, with each of the ways
+    of hashing a single message, and prints hashes per second.
+
+    @param data bytes to take messages from
+    @param size number of bytes in data
+  */
+static void benchShort( const byte *data, size_t size )
+{
+    static const size_t lengths[] = { 20, 32, 33, 55, 64 };
+    static const struct {
+        const char *name;
+        void (*hash)( const byte *, size_t, byte [ DIGEST_BYTES ] );
+    } methods[] = {
+        { "ByteBuffer", hashShortBuffer },
+        { "HashContext", hashShortContext },
+        { "hashShort", hashShort },
+    };
+
+    beginSection( "short messages, %d per length", SHORT_MESSAGES );
+    for ( int l = 0; l < sizeof( lengths ) / sizeof( lengths[ 0 ] ); l++ ) {
+        size_t count = ( size - lengths[ l ] ) / lengths[ l ];
+        if ( count > SHORT_MESSAGES )
+            count = SHORT_MESSAGES;
+
+        for ( int m = 0; m < sizeof( methods ) / sizeof( methods[ 0 ] ); m++ ) {
+            byte digest[ DIGEST_BYTES ];
+            double start = now();
+            for ( size_t i = 0; i < count; i++ )
+                methods[ m ].hash( data + i * lengths[ l ], lengths[ l ], digest );
+            double elapsed = now() - start;
+
+            char label[ 32 ];
+            snprintf( label, sizeof( label ), "%s/%zu", methods[ m ].name, lengths[ l ] );
+            report( label, count / elapsed / 1e6, "Mhash/s" );
+        }
+    }
+}
+
+/** Number of calls timed for each length in the latency benchmark. */
+#define LATENCY_CALLS 200000
+
+/**
+    Times single calls to hashShort() for message lengths from 0 to 1024
+    bytes, including each length where the padding needs another block, and
+    prints the average time per call, and cycles per call if there's a
+    cycle counter.
+
+    @param data bytes to take messages from
+    @param size number of bytes in data, more than 1024
+  */
+static void benchLatency( const byte *data, size_t size )
+{
+    static const size_t lengths[] = { 0, 1, 16, 32, 55, 56, 64, 119, 120, 128, 256, 512, 1024 };
+    byte digest[ DIGEST_BYTES ];
+    char label[ 32 ];
+
+    beginSection( "hashShort latency, %d calls per length", LATENCY_CALLS );
+    for ( int l = 0; l < sizeof( lengths ) / sizeof( lengths[ 0 ] ); l++ ) {
+        // Each call gets a different message, so nothing is hashed twice.
+        size_t span = size - lengths[ l ];
+        unsigned long long startCycles = cycles();
+        double start = now();
+        for ( size_t i = 0; i < LATENCY_CALLS; i++ )
+            hashShort( data + ( i * BLOCK_BYTES ) % span, lengths[ l ], digest );
+        double elapsed = now() - start;
+        unsigned long long used = cycles() - startCycles;
+
+        snprintf( label, sizeof( label ), "%zu bytes", lengths[ l ] );
+        report( label, elapsed / LATENCY_CALLS * 1e9, "ns/hash" );
+        if ( HAVE_CYCLES ) {
+            snprintf( label, sizeof( label ), "%zu bytes cycles", lengths[ l ] );
+            report( label, (double) used / LATENCY_CALLS, "cycles/hash" );
+        }
+    }
+}
+
+/**
+    Evicts a file from the page cache, so the next read comes from the
+    device.  Only clean pages can be dropped, so the file is synced first.
+
+    @param filename file to evict
+    @return true if the kernel accepted the request
+  */
+static int dropCache( const char *filename )
+{
+    int fd = open( filename, O_RDONLY );
+    if ( fd < 0 )
+        return 0;
+
+    int ok = fsync( fd ) == 0 && posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED ) == 0;
+    close( fd );
+    return ok;
+}
+
+/**
+    Times hashing a whole file end to end with each file hasher, first with
+    the file evicted from the page cache and then with it cached.
+
+    @param filename file to hash
+    @param size size of the file
+  */
+static void benchFiles( const char *filename, size_t size )
+{
+    static const struct {
+        const char *name;
+        FileHasher hasher;
+    } hashers[] = { { "hashFile", hashFile }, { "pipelined", hashFilePipelined } };
+    byte digest[ DIGEST_BYTES ];
+    char label[ 32 ];
+
+    beginSection( "whole file, %zu MiB", size / MIB );
+    for ( int h = 0; h < sizeof( hashers ) / sizeof( hashers[ 0 ] ); h++ ) {
+        for ( int warm = 0; warm < 2; warm++ ) {
+            if ( !warm && !dropCache( filename ) )
+                continue;
+
+            double start = now();
+            if ( hashers[ h ].hasher( filename, digest ) != 0 ) {
+                perror( filename );
+                exit( EXIT_FAILURE );
+            }
+            double elapsed = now() - start;
+
+            snprintf( label, sizeof( label ), "%s %s", hashers[ h ].name, warm ? "warm" : "cold" );
+            report( label, size / elapsed / MIB, "MB/s" );
+        }
+    }
+}
+
+/**
+    Times the fixed-length entry points for 32, 33 and 65-byte messages: one
+    message at a time, then in batches with each multi-lane engine.
+
+    @param data bytes to take messages from
+    @param size number of bytes in data
+  */
+static void benchFixed( const byte *data, size_t size )
+{
+    static const size_t lengths[] = { 32, 33, 65 };
+    void (*single[])( const byte *, byte [ DIGEST_BYTES ] ) = { hash32, hash33, hash65 };
+
+    beginSection( "fixed-length messages, %d per length", SHORT_MESSAGES );
+    for ( int l = 0; l < sizeof( lengths ) / sizeof( lengths[ 0 ] ); l++ ) {
+        size_t count = size / lengths[ l ];
+        if ( count > SHORT_MESSAGES )
+            count = SHORT_MESSAGES;
+        byte *digests = (byte *) malloc( count * DIGEST_BYTES );
+        char label[ 32 ];
+
+        double start = now();
+        for ( size_t i = 0; i < count; i++ )
+            single[ l ]( data + i * lengths[ l ], digests );
+        double elapsed = now() - start;
+        snprintf( label, sizeof( label ), "hash%zu", lengths[ l ] );
+        report( label, count / elapsed / 1e6, "Mhash/s" );
+
+        for ( int e = 0; e < numLaneEngines; e++ ) {
+            if ( !laneEngines[ e ].supported() )
+                continue;
+
+            start = now();
+            hashFixedLanes( &laneEngines[ e ], data, lengths[ l ], count, digests );
+            elapsed = now() - start;
+            snprintf( label, sizeof( label ), "batch%zu/%s", lengths[ l ], laneEngines[ e ].name );
+            report( label, count / elapsed / 1e6, "Mhash/s" );
+        }
+
+        free( digests );
+    }
+}
+
+/** Number of records in the hashMany() benchmark. */
+#define MANY_RECORDS 1000000
+
+/** Records in the hashMany() benchmark are 1 to this many bytes long. */
+#define MANY_MAX_BYTES 200
+
+/**
+    Times hashing an arena of records of mixed lengths: the old way, with a
+    ByteBuffer per record, then one record at a time with hashShort(), then
+    with the lane scheduler in arrival order, and finally with hashMany().
+
+    @param data arena to take records from
+    @param size number of bytes in data
+  */
+static void benchMany( const byte *data, size_t size )
+{
+    size_t n = MANY_RECORDS;
+    size_t *offsets = (size_t *) malloc( n * sizeof( size_t ) );
+    size_t *lens = (size_t *) malloc( n * sizeof( size_t ) );
+    const byte **msgs = (const byte **) malloc( n * sizeof( byte * ) );
+    byte *digests = (byte *) malloc( n * DIGEST_BYTES );
+
+    unsigned int seed = 1;
+    for ( size_t i = 0; i < n; i++ ) {
+        seed = seed * 1103515245 + 12345;
+        lens[ i ] = ( seed >> 16 ) % MANY_MAX_BYTES + 1;
+        offsets[ i ] = ( i * 61 ) % ( size - MANY_MAX_BYTES );
+        msgs[ i ] = data + offsets[ i ];
+    }
+
+    beginSection( "%zu records of 1 to %d bytes", n, MANY_MAX_BYTES );
+
+    double start = now();
+    for ( size_t i = 0; i < n; i++ )
+        hashShortBuffer( msgs[ i ], lens[ i ], digests + i * DIGEST_BYTES );
+    double elapsed = now() - start;
+    report( "ByteBuffer", n / elapsed / 1e6, "Mhash/s" );
+
+    start = now();
+    for ( size_t i = 0; i < n; i++ )
+        hashShort( msgs[ i ], lens[ i ], digests + i * DIGEST_BYTES );
+    elapsed = now() - start;
+    report( "hashShort", n / elapsed / 1e6, "Mhash/s" );
+
+    start = now();
+    hashMessages( msgs, lens, n, digests );
+    elapsed = now() - start;
+    report( "hashMessages", n / elapsed / 1e6, "Mhash/s" );
+
+    start = now();
+    hashMany( data, offsets, lens, n, digests );
+    elapsed = now() - start;
+    report( "hashMany", n / elapsed / 1e6, "Mhash/s" );
+
+    free( offsets );
+    free( lens );
+    free( msgs );
+    free( digests );
+}
+
+/** Length of each message in the HMAC benchmark. */
+#define HMAC_MESSAGE_BYTES 64
+
+/**
+    Times HMACs of short messages under one key: preparing the key for
+    every message, as a naive HMAC does, then reusing a prepared key one
+    message at a time and through the lanes.
+
+    @param data bytes to take messages from
+    @param size number of bytes in data
+  */
+static void benchHmac( const byte *data, size_t size )
+{
+    size_t n = size / HMAC_MESSAGE_BYTES < SHORT_MESSAGES ? size / HMAC_MESSAGE_BYTES : SHORT_MESSAGES;
+    const byte **msgs = (const byte **) malloc( n * sizeof( byte * ) );
+    size_t *lens = (size_t *) malloc( n * sizeof( size_t ) );
+    byte *macs = (byte *) malloc( n * DIGEST_BYTES );
+    for ( size_t i = 0; i < n; i++ ) {
+        msgs[ i ] = data + i * HMAC_MESSAGE_BYTES;
+        lens[ i ] = HMAC_MESSAGE_BYTES;
+    }
+
+    static const byte secret[] = "bench key";
+    HmacKey key;
+    beginSection( "HMAC, %zu messages of %d bytes", n, HMAC_MESSAGE_BYTES );
+
+    double start = now();
+    for ( size_t i = 0; i < n; i++ ) {
+        hmacInit( &key, secret, sizeof( secret ) );
+        hmacMessage( &key, msgs[ i ], lens[ i ], macs + i * DIGEST_BYTES );
+    }
+    double elapsed = now() - start;
+    report( "key per message", n / elapsed / 1e6, "Mmac/s" );
+
+    start = now();
+    for ( size_t i = 0; i < n; i++ )
+        hmacMessage( &key, msgs[ i ], lens[ i ], macs + i * DIGEST_BYTES );
+    elapsed = now() - start;
+    report( "hmacMessage", n / elapsed / 1e6, "Mmac/s" );
+
+    start = now();
+    hmacBatch( &key, msgs, lens, n, macs );
+    elapsed = now() - start;
+    report( "hmacBatch", n / elapsed / 1e6, "Mmac/s" );
+
+    free( msgs );
+    free( lens );
+    free( macs );
+}
+
+/** Iteration count in the PBKDF2 benchmark. */
+#define PBKDF2_ITERATIONS 20000
+
+/** Number of passwords derived together in the PBKDF2 batch benchmark. */
+#define PBKDF2_PASSWORDS 64
+
+/**
+    Prints a PBKDF2 result as iterations per second: one iteration is one
+    HMAC for one 20-byte block of output.
+
+    @param label what was timed
+    @param blocks number of 20-byte blocks derived
+    @param elapsed seconds taken
+  */
+static void reportIterations( const char *label, size_t blocks, double elapsed )
+{
+    report( label, (double) blocks * PBKDF2_ITERATIONS / elapsed / 1e6, "Miter/s" );
+}
+
+/**
+    Times PBKDF2-HMAC-RIPEMD160: the iterations done with hmacMessage() as a
+    baseline, one block and a block per lane with each engine, then a batch
+    of passwords.
+  */
+static void benchPbkdf2( void )
+{
+    static const byte salt[] = "bench salt";
+    static const byte password[] = "bench password";
+    byte out[ MAX_LANES * DIGEST_BYTES ];
+    char label[ 32 ];
+
+    beginSection( "PBKDF2, %d iterations", PBKDF2_ITERATIONS );
+
+    HmacKey key;
+    hmacInit( &key, password, sizeof( password ) );
+    double start = now();
+    hmacMessage( &key, salt, sizeof( salt ), out );
+    for ( int i = 1; i < PBKDF2_ITERATIONS; i++ )
+        hmacMessage( &key, out, DIGEST_BYTES, out );
+    reportIterations( "hmacMessage", 1, now() - start );
+
+    for ( int e = 0; e < numLaneEngines; e++ ) {
+        const LaneEngine *engine = &laneEngines[ e ];
+        if ( !engine->supported() )
+            continue;
+
+        start = now();
+        pbkdf2Lanes( engine, password, sizeof( password ), salt, sizeof( salt ), PBKDF2_ITERATIONS,
+                     out, DIGEST_BYTES );
+        snprintf( label, sizeof( label ), "1 block/%s", engine->name );
+        reportIterations( label, 1, now() - start );
+
+        start = now();
+        pbkdf2Lanes( engine, password, sizeof( password ), salt, sizeof( salt ), PBKDF2_ITERATIONS,
+                     out, engine->lanes * DIGEST_BYTES );
+        snprintf( label, sizeof( label ), "%d blocks/%s", engine->lanes, engine->name );
+        reportIterations( label, engine->lanes, now() - start );
+    }
+
+    const byte *passwords[ PBKDF2_PASSWORDS ];
+    size_t lens[ PBKDF2_PASSWORDS ];
+    byte *keys = (byte *) malloc( PBKDF2_PASSWORDS * DIGEST_BYTES );
+    for ( int i = 0; i < PBKDF2_PASSWORDS; i++ ) {
+        passwords[ i ] = password + i % 4;
+        lens[ i ] = sizeof( password ) - i % 4;
+    }
+
+    start = now();
+    pbkdf2Batch( passwords, lens, PBKDF2_PASSWORDS, salt, sizeof( salt ), PBKDF2_ITERATIONS, keys,
+                 DIGEST_BYTES );
+    snprintf( label, sizeof( label ), "%d passwords", PBKDF2_PASSWORDS );
+    reportIterations( label, PBKDF2_PASSWORDS, now() - start );
+    free( keys );
+}
+
+/** Number of digests written in the output benchmark. */
+#define OUTPUT_DIGESTS 1000000
+
+/**
+    Times writing digests to /dev/null, one printf() per byte as printHash()
+    used to, then through an OutputBuffer in each format.
+
+    @param data bytes to use as digests
+    @param size number of bytes in data
+  */
+static void benchOutput( const byte *data, size_t size )
+{
+    size_t n = size / DIGEST_BYTES < OUTPUT_DIGESTS ? size / DIGEST_BYTES : OUTPUT_DIGESTS;
+    FILE *fp = fopen( "/dev/null", "w" );
+    int fd = open( "/dev/null", O_WRONLY );
+    if ( !fp || fd < 0 ) {
+        perror( "/dev/null" );
+        exit( EXIT_FAILURE );
+    }
+
+    beginSection( "writing %zu digests", n );
+
+    double start = now();
+    for ( size_t i = 0; i < n; i++ ) {
+        for ( int j = 0; j < DIGEST_BYTES; j++ )
+            fprintf( fp, "%02x", data[ i * DIGEST_BYTES + j ] );
+        fprintf( fp, "\n" );
+    }
+    fflush( fp );
+    double elapsed = now() - start;
+    report( "printf", n / elapsed / 1e6, "Mdigest/s" );
+
+    static const struct {
+        const char *name;
+        DigestFormat format;
+    } formats[] = { { "hex", FORMAT_HEX }, { "raw", FORMAT_RAW }, { "base64", FORMAT_BASE64 } };
+
+    for ( int f = 0; f < sizeof( formats ) / sizeof( formats[ 0 ] ); f++ ) {
+        OutputBuffer *out = createOutput( fd );
+        start = now();
+        for ( size_t i = 0; i < n; i++ ) {
+            putDigest( out, formats[ f ].format, data + i * DIGEST_BYTES );
+            putBytes( out, "\n", 1 );
+        }
+        freeOutput( out );
+        elapsed = now() - start;
+        report( formats[ f ].name, n / elapsed / 1e6, "Mdigest/s" );
+    }
+
+    fclose( fp );
+    close( fd );
+}
+
+/** Room for each file name in the I/O benchmark. */
+#define PATH_BYTES 256
+
+/** Default number of small files in the I/O benchmark. */
+#define DEFAULT_SMALL_FILES 100000
+
+/** Size of each small file in the I/O benchmark. */
+#define SMALL_FILE_BYTES 4096
+
+/** Number of large files in the I/O benchmark. */
+#define LARGE_FILES 4
+
+/** Size of each large file in the I/O benchmark, in MiB. */
+#define LARGE_FILE_MIB 64
+
+/**
+    Callback for the file backends; the benchmark doesn't need the digests.
+
+    @param job the finished job
+    @param arg unused
+  */
+static void ignoreJob( FileJob *job, void *arg )
+{
+}
+
+/**
+    Times hashing a set of files with the blocking backend and, if the kernel
+    supports it, the io_uring backend, and prints files/s and MB/s for each.
+
+    @param label description of the file set
+    @param jobs one job per file
+    @param n number of files
+    @param bytes total size of the files
+  */
+static void benchBackends( const char *label, FileJob *jobs, size_t n, double bytes )
+{
+    int threads = defaultThreads();
+    beginSection( "%s, %zu files, %d threads", label, n, threads );
+
+    for ( int uring = 0; uring < 2; uring++ ) {
+        if ( uring && !uringAvailable() ) {
+            if ( style == STYLE_TEXT )
+                printf( "%-20s %10s\n", "io_uring", "unavailable" );
+            continue;
+        }
+
+        double start = now();
+        if ( uring )
+            hashFilesUring( jobs, n, threads, ignoreJob, NULL );
+        else
+            hashFiles( jobs, n, threads, NULL, ignoreJob, NULL );
+        double elapsed = now() - start;
+
+        report( uring ? "io_uring" : "blocking", n / elapsed, "files/s" );
+        report( uring ? "io_uring" : "blocking", bytes / elapsed / MIB, "MB/s" );
+    }
+}
+
+/**
+    Compares the blocking and io_uring file backends on many small files and
+    on a few large ones.  The files are just written, so they're mostly in the
+    page cache; point TMPDIR at a cold device to measure real I/O.
+
+    @param smallFiles number of small files to create
+    @return exit status
+  */
+static int benchIo( size_t smallFiles )
+{
+    const char *tmp = getenv( "TMPDIR" );
+    char dir[ PATH_BYTES - 32 ];
+    snprintf( dir, sizeof( dir ), "%s/ripemd-bench-XXXXXX", tmp ? tmp : "/tmp" );
+    if ( !mkdtemp( dir ) ) {
+        perror( dir );
+        return EXIT_FAILURE;
+    }
+
+    size_t n = smallFiles + LARGE_FILES;
+    FileJob *jobs = (FileJob *) calloc( n, sizeof( FileJob ) );
+    char *paths = (char *) malloc( n * PATH_BYTES );
+
+    for ( size_t i = 0; i < n; i++ ) {
+        char *path = paths + i * PATH_BYTES;
+        snprintf( path, PATH_BYTES, "%s/%zu", dir, i );
+        jobs[ i ].path = path;
+
+        size_t size = i < smallFiles ? SMALL_FILE_BYTES : (size_t) LARGE_FILE_MIB * MIB;
+        if ( !makeInput( path, size ) ) {
+            perror( path );
+            return EXIT_FAILURE;
+        }
+    }
+
+    benchBackends( "small files", jobs, smallFiles, (double) smallFiles * SMALL_FILE_BYTES );
+    benchBackends( "large files", jobs + smallFiles, LARGE_FILES,
+                   (double) LARGE_FILES * LARGE_FILE_MIB * MIB );
+
+    for ( size_t i = 0; i < n; i++ )
+        unlink( jobs[ i ].path );
+    rmdir( dir );
+    free( paths );
+    free( jobs );
+    return EXIT_SUCCESS;
+}
+
+/**
+    Starting point.  Generates an input file, then reports how fast it can be
+    read into a ByteBuffer and how fast it can be hashed.  "bench io [N]"
+    instead compares the file backends on N small files and a few large ones.
+    With --csv or --json first, the results are printed in that form, and
+    with --perf the hashing kernels are also measured with hardware
+    performance counters, where the system provides them.
+
+    @param argc number of arguments
+    @param argv output style and --perf, then optional size of the input file in MiB,
+                or io
+    @return exit status
+  */
+int main( int argc, char *argv[] )
+{
+    int arg = 1;
+    int wantPerf = 0;
+    for ( ; arg < argc && strncmp( argv[ arg ], "--", 2 ) == 0; arg++ ) {
+        if ( strcmp( argv[ arg ], "--csv" ) == 0 )
+            style = STYLE_CSV;
+        else if ( strcmp( argv[ arg ], "--json" ) == 0 )
+            style = STYLE_JSON;
+        else if ( strcmp( argv[ arg ], "--perf" ) == 0 )
+            wantPerf = 1;
+        else {
+            fprintf( stderr, "usage: bench [--csv | --json] [--perf] [MiB | io [N]]\n" );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( wantPerf ) {
+        perfOpen = openPerfCounters( &perf ) == 0;
+        if ( !perfOpen )
+            fprintf( stderr, "bench: perf counters unavailable: %s\n", strerror( errno ) );
+    }
+
+    if ( arg < argc && strcmp( argv[ arg ], "io" ) == 0 ) {
+        int status = benchIo( arg + 1 < argc ? atoi( argv[ arg + 1 ] ) : DEFAULT_SMALL_FILES );
+        finishReport();
+        return status;
+    }
+
+    size_t size = (size_t) ( arg < argc ? atoi( argv[ arg ] ) : DEFAULT_FILE_MIB ) * MIB;
+
+    char filename[] = "/tmp/ripemd-bench-XXXXXX";
+    int fd = mkstemp( filename );
+    if ( fd < 0 || !makeInput( filename, size ) ) {
+        perror( filename );
+        return EXIT_FAILURE;
+    }
+    close( fd );
+
+    beginSection( "readFile, %zu MiB input", size / MIB );
+    benchReader( "fgetc/addByte", readFileBytewise, filename, size );
+    benchReader( "fread/addBytes", readFile, filename, size );
+    benchFiles( filename, size );
+
+    ByteBuffer *buffer = readFile( filename );
+    beginSection( "hashBlocks, %zu MiB input", size / MIB );
+    for ( int k = 0; k < numBlockKernels; k++ )
+        if ( blockKernels[ k ].supported() )
+            benchKernel( blockKernels[ k ].name, blockKernels[ k ].blocks, buffer->data,
+                         buffer->len / BLOCK_BYTES );
+    benchLanes( buffer->data, buffer->len );
+    benchShort( buffer->data, buffer->len );
+    benchLatency( buffer->data, buffer->len );
+    benchFixed( buffer->data, buffer->len );
+    benchMany( buffer->data, buffer->len );
+    benchHmac( buffer->data, buffer->len );
+    benchPbkdf2();
+    benchOutput( buffer->data, buffer->len );
+    freeBuffer( buffer );
+
+    unlink( filename );
+    if ( perfOpen )
+        closePerfCounters( &perf );
+    finishReport();
+    return EXIT_SUCCESS;
+}
@@ -4,7 +4,20 @@
     
     Contains functions that read into, create, add bytes to, and free the buffer.
 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
 #include "byteBuffer.h"
+#include "stats.h"
+
+/** Size of the side buffer used once the main buffer is full. */
+#define READ_BLOCK_BYTES 65536
+
+/** Room left after a file's bytes for padBuffer() to add its padding
+    (at most two 64-byte blocks) without growing the buffer. */
+#define PADDING_ROOM 128
 
 
 /**
@@ -19,6 +32,7 @@ ByteBuffer *createBuffer()
     buffer->data = (byte *) malloc( sizeof( byte ) * INITIAL_BUFFER_CAPACITY );
     buffer->len = 0;
     buffer->cap = INITIAL_BUFFER_CAPACITY;
+    STATS_RAISE( COUNT_PEAK_CAPACITY, buffer->cap );
     
     return buffer;
 }
@@ -34,12 +48,49 @@ void addByte( ByteBuffer *buffer, byte b )
     if ( buffer->len >= buffer->cap ) {
         buffer->cap *= 2;
         buffer->data = realloc( buffer->data, sizeof( byte ) * buffer->cap );
+        STATS_ADD( COUNT_REALLOCS, 1 );
+        STATS_RAISE( COUNT_PEAK_CAPACITY, buffer->cap );
     }
     
     buffer->data[ buffer->len ] = b;
     buffer->len++;
 }
 
+/**
+    Makes sure the buffer has room for at least n more bytes, doubling its
+    capacity as many times as needed with a single realloc.
+    
+    @param buffer ByteBuffer
+    @param n number of additional bytes needed
+  */
+static void reserveBytes( ByteBuffer *buffer, size_t n )
+{
+    if ( buffer->len + n <= buffer->cap )
+        return;
+    
+    while ( buffer->len + n > buffer->cap )
+        buffer->cap *= 2;
+    
+    buffer->data = realloc( buffer->data, sizeof( byte ) * buffer->cap );
+    STATS_ADD( COUNT_REALLOCS, 1 );
+    STATS_RAISE( COUNT_PEAK_CAPACITY, buffer->cap );
+}
+
+/**
+    Adds n bytes to the end of the buffer, growing it at most once.
+    
+    @param buffer ByteBuffer
+    @param data bytes to add to buffer
+    @param n number of bytes to add
+  */
+void addBytes( ByteBuffer *buffer, const byte *data, size_t n )
+{
+    reserveBytes( buffer, n );
+    
+    memcpy( buffer->data + buffer->len, data, n );
+    buffer->len += n;
+}
+
 /**
     Frees all buffer memory.
   */
@@ -51,29 +102,65 @@ void freeBuffer( ByteBuffer *buffer )
 
 /**
     Creates a ByteBuffer and reads the contents of the given file into the buffer.
+    For regular files, the buffer is sized once from the file size, with room for
+    the padding, and filled with large fread() calls straight into the buffer, so
+    no per-byte work is done.
     
     @param filename name of file to read from
-    @return Bytebuffer ( with buffer data )
+    @return Bytebuffer ( with buffer data ), or NULL if the file can't be opened
+            or a read fails
   */
 ByteBuffer *readFile( const char *filename )
 {
-    ByteBuffer *buffer = createBuffer();
-    
     FILE *fp = fopen( filename, "rb" );
     
     if ( !fp ) {
         return NULL;
     }
     
-    int ch = fgetc( fp );
+    ByteBuffer *buffer = createBuffer();
     
-    while ( ch != EOF ) {
-        byte b = (byte) ch;
-        addByte( buffer, b );
-        ch = fgetc( fp );
+    // Size the buffer up front when we know how big the file is.
+    struct stat st;
+    if ( fstat( fileno( fp ), &st ) == 0 && S_ISREG( st.st_mode ) &&
+         (size_t) st.st_size + PADDING_ROOM > buffer->cap ) {
+        buffer->cap = st.st_size + PADDING_ROOM;
+        buffer->data = realloc( buffer->data, sizeof( byte ) * buffer->cap );
+        STATS_ADD( COUNT_REALLOCS, 1 );
+        STATS_RAISE( COUNT_PEAK_CAPACITY, buffer->cap );
     }
     
+    for ( ;; ) {
+        size_t n;
+        STATS_START( timer );
+        
+        if ( buffer->len < buffer->cap ) {
+            // Read directly into the unused tail of the buffer.
+            n = fread( buffer->data + buffer->len, 1, buffer->cap - buffer->len, fp );
+            buffer->len += n;
+        } else {
+            // The buffer is full (a pipe, or a file that grew).  Read the next
+            // block on the side, so a file ending exactly here doesn't grow it.
+            byte block[ READ_BLOCK_BYTES ];
+            n = fread( block, 1, sizeof( block ), fp );
+            addBytes( buffer, block, n );
+        }
+        STATS_STOP( timer, STAGE_READ );
+        STATS_ADD( COUNT_BYTES_READ, n );
+        
+        if ( n == 0 )
+            break;
+    }
+    
+    // A short read is the end of the file or an error; only the first is done.
+    int failed = ferror( fp );
+    int err = errno;
     fclose( fp );
+    if ( failed ) {
+        freeBuffer( buffer );
+        errno = err;
+        return NULL;
+    }
     
     return buffer;
 }
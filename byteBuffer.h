@@ -28,10 +28,10 @@ typedef struct {
   byte *data;
 
   /** Number of currently used bytes in the data array. */
-  unsigned int len;
+  size_t len;
 
   /** Capacity of the data array (it's typically over-allocated. */
-  unsigned int cap;
+  size_t cap;
 } ByteBuffer;
 
 #endif
@@ -51,6 +51,15 @@ ByteBuffer *createBuffer();
   */
 void addByte( ByteBuffer *buffer, byte b );
 
+/**
+    Adds n bytes to the end of the buffer, growing it at most once.
+    
+    @param buffer ByteBuffer
+    @param data bytes to add to buffer
+    @param n number of bytes to add
+  */
+void addBytes( ByteBuffer *buffer, const byte *data, size_t n );
+
 /**
     Frees all buffer memory.
   */
@@ -60,6 +69,7 @@ void freeBuffer( ByteBuffer *buffer );
     Creates a ByteBuffer and reads the contents of the given file into the buffer.
     
     @param filename name of file to read from
-    @return Bytebuffer ( with buffer data )
+    @return Bytebuffer ( with buffer data ), or NULL if the file can't be opened
+            or a read fails
   */
 ByteBuffer *readFile( const char *filename );
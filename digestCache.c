@@ -0,0 +1,387 @@
+/** 
+    @filename digestCache.c
+    @author Will Greene (wgreene)
+    
+    Contains a persistent cache of file digests, kept in a memory-mapped file
+    holding an open-addressed hash table keyed by device and inode.
+*/
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "digestCache.h"
+
+/**
+    Returns the number of bytes in a cache file with the given number of slots.
+    
+    @param capacity number of slots
+    @return file size
+  */
+static size_t cacheBytes( unsigned long long capacity )
+{
+    return sizeof( CacheHeader ) + capacity * sizeof( CacheSlot );
+}
+
+/**
+    Maps the cache file with the given number of slots, replacing any
+    existing mapping.
+    
+    @param cache DigestCache address
+    @param capacity number of slots in the file
+    @return 0 on success, -1 with errno set on failure
+  */
+static int mapCache( DigestCache *cache, unsigned long long capacity )
+{
+    if ( cache->header )
+        munmap( cache->header, cacheBytes( cache->capacity ) );
+    
+    void *map = mmap( NULL, cacheBytes( capacity ), PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0 );
+    if ( map == MAP_FAILED ) {
+        cache->header = NULL;
+        return -1;
+    }
+    
+    cache->header = (CacheHeader *) map;
+    cache->capacity = capacity;
+    return 0;
+}
+
+/**
+    Returns the slots following the header.
+    
+    @param cache DigestCache address
+    @return first slot
+  */
+static CacheSlot *cacheSlots( DigestCache *cache )
+{
+    return (CacheSlot *) ( cache->header + 1 );
+}
+
+/**
+    Catches up with another process that grew the table since we mapped it.
+    The header is always at the start of the file, so it can be read through
+    the old, smaller mapping.  Must be called with the file locked.
+    
+    @param cache DigestCache address
+    @return 0 on success, -1 with errno set on failure
+  */
+static int syncMapping( DigestCache *cache )
+{
+    unsigned long long capacity = cache->header->capacity;
+    return capacity == cache->capacity ? 0 : mapCache( cache, capacity );
+}
+
+/**
+    Scrambles a file's device and inode into a starting slot.
+    
+    @param key file to place
+    @param capacity number of slots, a power of two
+    @return slot index
+  */
+static unsigned long long slotFor( const CacheKey *key, unsigned long long capacity )
+{
+    unsigned long long h = key->ino * 0x9E3779B97F4A7C15ULL ^ key->dev;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    return h & ( capacity - 1 );
+}
+
+/**
+    Finds the slot for a file: the one holding an entry for its device and
+    inode, or the empty slot where one would go.  There are no deletions, so
+    the probe can stop at the first empty slot.
+    
+    @param cache DigestCache address
+    @param key file to find
+    @return the slot
+  */
+static CacheSlot *findSlot( DigestCache *cache, const CacheKey *key )
+{
+    CacheSlot *slots = cacheSlots( cache );
+    unsigned long long mask = cache->capacity - 1;
+    
+    for ( unsigned long long i = slotFor( key, cache->capacity ); ; i = ( i + 1 ) & mask ) {
+        CacheSlot *slot = &slots[ i ];
+        if ( !slot->used || ( slot->key.dev == key->dev && slot->key.ino == key->ino ) )
+            return slot;
+    }
+}
+
+/**
+    Writes an empty table with the given number of slots into the file,
+    growing the file if needed.  The file is never shrunk, since other
+    processes may have it mapped.  Must be called with the file locked
+    exclusively.
+    
+    @param cache DigestCache address
+    @param capacity number of slots
+    @return 0 on success, -1 with errno set on failure
+  */
+static int formatCache( DigestCache *cache, unsigned long long capacity )
+{
+    struct stat st;
+    if ( fstat( cache->fd, &st ) != 0 )
+        return -1;
+    if ( st.st_size < cacheBytes( capacity ) && ftruncate( cache->fd, cacheBytes( capacity ) ) != 0 )
+        return -1;
+    if ( mapCache( cache, capacity ) != 0 )
+        return -1;
+    
+    memset( cacheSlots( cache ), 0, capacity * sizeof( CacheSlot ) );
+    CacheHeader *header = cache->header;
+    memcpy( header->magic, CACHE_MAGIC, sizeof( header->magic ) );
+    header->version = CACHE_VERSION;
+    header->slotBytes = sizeof( CacheSlot );
+    header->count = 0;
+    header->hits = 0;
+    header->misses = 0;
+    
+    // Other processes notice the new layout by the change in capacity, so
+    // it's set last.
+    __atomic_store_n( &header->capacity, capacity, __ATOMIC_RELEASE );
+    return 0;
+}
+
+/**
+    Doubles the number of slots, moving every entry to its new place.  Must be
+    called with the file locked exclusively.
+    
+    @param cache DigestCache address
+    @return 0 on success, -1 with errno set on failure
+  */
+static int growCache( DigestCache *cache )
+{
+    unsigned long long capacity = cache->capacity;
+    CacheSlot *old = (CacheSlot *) malloc( capacity * sizeof( CacheSlot ) );
+    if ( !old )
+        return -1;
+    memcpy( old, cacheSlots( cache ), capacity * sizeof( CacheSlot ) );
+    
+    unsigned long long hits = cache->header->hits;
+    unsigned long long misses = cache->header->misses;
+    int status = formatCache( cache, capacity * 2 );
+    
+    if ( status == 0 ) {
+        for ( unsigned long long i = 0; i < capacity; i++ ) {
+            if ( old[ i ].used ) {
+                *findSlot( cache, &old[ i ].key ) = old[ i ];
+                cache->header->count++;
+            }
+        }
+        cache->header->hits = hits;
+        cache->header->misses = misses;
+    }
+    
+    free( old );
+    return status;
+}
+
+/**
+    Opens a cache file, creating it if it doesn't exist.  A file that isn't
+    a cache of this version is replaced with an empty cache.
+    
+    @param path name of the cache file
+    @param rebuild if true, all the entries are thrown away
+    @return the open cache, or NULL with errno set on failure
+  */
+DigestCache *openCache( const char *path, int rebuild )
+{
+    DigestCache *cache = (DigestCache *) calloc( 1, sizeof( DigestCache ) );
+    if ( !cache )
+        return NULL;
+    
+    cache->fd = open( path, O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if ( cache->fd < 0 ) {
+        free( cache );
+        return NULL;
+    }
+    pthread_mutex_init( &cache->lock, NULL );
+    
+    flock( cache->fd, LOCK_EX );
+    
+    // Check the header before trusting anything else in the file.
+    CacheHeader header;
+    struct stat st;
+    int valid = !rebuild && fstat( cache->fd, &st ) == 0 &&
+        pread( cache->fd, &header, sizeof( header ), 0 ) == sizeof( header ) &&
+        memcmp( header.magic, CACHE_MAGIC, sizeof( header.magic ) ) == 0 &&
+        header.version == CACHE_VERSION && header.slotBytes == sizeof( CacheSlot ) &&
+        header.capacity >= CACHE_INITIAL_SLOTS && ( header.capacity & ( header.capacity - 1 ) ) == 0 &&
+        st.st_size >= cacheBytes( header.capacity );
+    
+    int status;
+    if ( valid )
+        status = mapCache( cache, header.capacity );
+    else
+        status = formatCache( cache, CACHE_INITIAL_SLOTS );
+    
+    int err = errno;
+    flock( cache->fd, LOCK_UN );
+    
+    if ( status != 0 ) {
+        closeCache( cache );
+        errno = err;
+        return NULL;
+    }
+    
+    return cache;
+}
+
+/**
+    Closes a cache opened with openCache().
+    
+    @param cache cache to close
+  */
+void closeCache( DigestCache *cache )
+{
+    if ( cache->header )
+        munmap( cache->header, cacheBytes( cache->capacity ) );
+    close( cache->fd );
+    pthread_mutex_destroy( &cache->lock );
+    free( cache );
+}
+
+/**
+    Finds the key of the current version of a file.
+    
+    @param path name of the file
+    @param key set to the file's key
+    @return 1 for a regular file, 0 for anything else, or -1 with errno set
+            if the file can't be examined
+  */
+int cacheKeyOf( const char *path, CacheKey *key )
+{
+    struct stat st;
+    if ( stat( path, &st ) != 0 )
+        return -1;
+    
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtimeNs = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return S_ISREG( st.st_mode ) ? 1 : 0;
+}
+
+/**
+    Looks up the digest for a version of a file.
+    
+    @param cache cache to search
+    @param key which file and version
+    @param digest set to the cached digest on a hit
+    @return true on a hit
+  */
+int cacheLookup( DigestCache *cache, const CacheKey *key, byte digest[ DIGEST_BYTES ] )
+{
+    int hit = 0;
+    
+    pthread_mutex_lock( &cache->lock );
+    flock( cache->fd, LOCK_SH );
+    
+    if ( syncMapping( cache ) == 0 ) {
+        CacheSlot *slot = findSlot( cache, key );
+        hit = slot->used && memcmp( &slot->key, key, sizeof( CacheKey ) ) == 0;
+        if ( hit )
+            memcpy( digest, slot->digest, DIGEST_BYTES );
+        
+        // Other readers may be counting at the same time.
+        __atomic_fetch_add( hit ? &cache->header->hits : &cache->header->misses, 1, __ATOMIC_RELAXED );
+    }
+    
+    flock( cache->fd, LOCK_UN );
+    if ( hit )
+        cache->hits++;
+    else
+        cache->misses++;
+    pthread_mutex_unlock( &cache->lock );
+    
+    return hit;
+}
+
+/**
+    Records the digest for a version of a file, replacing any entry for an
+    older version of the same file.
+    
+    @param cache cache to update
+    @param key which file and version
+    @param digest digest of that version
+  */
+void cacheStore( DigestCache *cache, const CacheKey *key, const byte digest[ DIGEST_BYTES ] )
+{
+    pthread_mutex_lock( &cache->lock );
+    flock( cache->fd, LOCK_EX );
+    
+    if ( syncMapping( cache ) == 0 ) {
+        CacheSlot *slot = findSlot( cache, key );
+        int added = !slot->used;
+        
+        if ( added && ( cache->header->count + 1 ) * 100 > cache->capacity * CACHE_MAX_LOAD_PERCENT ) {
+            added = growCache( cache ) == 0;
+            slot = added ? findSlot( cache, key ) : NULL;
+        }
+        
+        if ( slot ) {
+            // If we die partway through, the slot is left empty rather than
+            // holding a digest that doesn't go with its key.
+            __atomic_store_n( &slot->used, 0, __ATOMIC_RELEASE );
+            slot->key = *key;
+            memcpy( slot->digest, digest, DIGEST_BYTES );
+            __atomic_store_n( &slot->used, 1, __ATOMIC_RELEASE );
+            
+            cache->header->count += added;
+            cache->stores++;
+        }
+    }
+    
+    flock( cache->fd, LOCK_UN );
+    pthread_mutex_unlock( &cache->lock );
+}
+
+/**
+    Computes the digest of a file through the cache: an unchanged file's digest
+    comes straight from the cache without reading it, and anything else is
+    hashed with the given function and, if it didn't change while being
+    hashed, added to the cache.
+    
+    @param cache cache to use
+    @param hasher function used on a miss, such as hashFile()
+    @param filename name of the file
+    @param digest storage for the digest
+    @return 0 on success, -1 with errno set on failure
+  */
+int hashFileCached( DigestCache *cache, FileHasher hasher, const char *filename,
+                    byte digest[ DIGEST_BYTES ] )
+{
+    CacheKey before, after;
+    
+    // Only regular files are cached; anything else, including files that
+    // can't be examined, goes straight to the hasher.
+    if ( cacheKeyOf( filename, &before ) != 1 )
+        return hasher( filename, digest );
+    
+    if ( cacheLookup( cache, &before, digest ) )
+        return 0;
+    
+    if ( hasher( filename, digest ) != 0 )
+        return -1;
+    
+    // A file that changed while it was hashed, or that was modified so
+    // recently it could still change without its timestamp moving, isn't
+    // worth remembering.
+    struct timespec now;
+    clock_gettime( CLOCK_REALTIME, &now );
+    long long nowNs = (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+    
+    if ( cacheKeyOf( filename, &after ) == 1 && memcmp( &before, &after, sizeof( CacheKey ) ) == 0 &&
+         after.mtimeNs < nowNs - CACHE_RACY_NS )
+        cacheStore( cache, &after, digest );
+    
+    return 0;
+}
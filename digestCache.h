@@ -0,0 +1,172 @@
+/** 
+    @filename digestCache.h
+    @author Will Greene (wgreene)
+    
+    Header file for digestCache.c
+*/
+#ifndef _DIGEST_CACHE_H_
+#define _DIGEST_CACHE_H_
+
+#include <pthread.h>
+#include "fileHash.h"
+
+/** Environment variable naming the cache file to use by default. */
+#define CACHE_ENV_VAR "RIPEMD_CACHE"
+
+/** First eight bytes of every cache file. */
+#define CACHE_MAGIC "RMD160DC"
+
+/** Layout version of the cache file. */
+#define CACHE_VERSION 1
+
+/** Number of slots in a new cache. */
+#define CACHE_INITIAL_SLOTS 4096
+
+/** The table doubles when more than this percentage of its slots are used. */
+#define CACHE_MAX_LOAD_PERCENT 70
+
+/** Files modified less than this long ago (in nanoseconds) aren't cached, in
+    case they're still being written within the same timestamp tick. */
+#define CACHE_RACY_NS 1000000000LL
+
+/** What identifies one version of a file. */
+typedef struct {
+  /** Device the file is on. */
+  unsigned long long dev;
+  
+  /** Inode number. */
+  unsigned long long ino;
+  
+  /** Size in bytes. */
+  unsigned long long size;
+  
+  /** Modification time, in nanoseconds since the epoch. */
+  long long mtimeNs;
+} CacheKey;
+
+/** Start of a cache file, followed by the slots. */
+typedef struct {
+  /** CACHE_MAGIC, not null terminated. */
+  char magic[ 8 ];
+  
+  /** CACHE_VERSION. */
+  unsigned int version;
+  
+  /** Size of each slot, to catch files from incompatible builds. */
+  unsigned int slotBytes;
+  
+  /** Number of slots, a power of two. */
+  unsigned long long capacity;
+  
+  /** Number of slots in use. */
+  unsigned long long count;
+  
+  /** Lookups that found their file, over the life of the cache. */
+  unsigned long long hits;
+  
+  /** Lookups that didn't, over the life of the cache. */
+  unsigned long long misses;
+} CacheHeader;
+
+/** One slot of the open-addressed table. */
+typedef struct {
+  /** Version of the file this digest is for. */
+  CacheKey key;
+  
+  /** Digest of that version of the file. */
+  byte digest[ DIGEST_BYTES ];
+  
+  /** Nonzero once the slot holds an entry. */
+  unsigned int used;
+} CacheSlot;
+
+/** An open cache file, mapped into memory.  Several threads and processes
+    can use the same cache file at once: operations are serialized within a
+    process by a mutex and between processes by flock() on the file. */
+typedef struct {
+  /** The open cache file. */
+  int fd;
+  
+  /** Serializes use of the cache within this process. */
+  pthread_mutex_t lock;
+  
+  /** Start of the mapping. */
+  CacheHeader *header;
+  
+  /** Number of slots in the mapping; another process may have grown the
+      file since it was mapped. */
+  unsigned long long capacity;
+  
+  /** Lookups by this process that found their file. */
+  unsigned long long hits;
+  
+  /** Lookups by this process that didn't. */
+  unsigned long long misses;
+  
+  /** Digests this process added or replaced. */
+  unsigned long long stores;
+} DigestCache;
+
+/**
+    Opens a cache file, creating it if it doesn't exist.  A file that isn't
+    a cache of this version is replaced with an empty cache.
+    
+    @param path name of the cache file
+    @param rebuild if true, all the entries are thrown away
+    @return the open cache, or NULL with errno set on failure
+  */
+DigestCache *openCache( const char *path, int rebuild );
+
+/**
+    Closes a cache opened with openCache().
+    
+    @param cache cache to close
+  */
+void closeCache( DigestCache *cache );
+
+/**
+    Finds the key of the current version of a file.
+    
+    @param path name of the file
+    @param key set to the file's key
+    @return 1 for a regular file, 0 for anything else, or -1 with errno set
+            if the file can't be examined
+  */
+int cacheKeyOf( const char *path, CacheKey *key );
+
+/**
+    Looks up the digest for a version of a file.
+    
+    @param cache cache to search
+    @param key which file and version
+    @param digest set to the cached digest on a hit
+    @return true on a hit
+  */
+int cacheLookup( DigestCache *cache, const CacheKey *key, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Records the digest for a version of a file, replacing any entry for an
+    older version of the same file.
+    
+    @param cache cache to update
+    @param key which file and version
+    @param digest digest of that version
+  */
+void cacheStore( DigestCache *cache, const CacheKey *key, const byte digest[ DIGEST_BYTES ] );
+
+/**
+    Computes the digest of a file through the cache: an unchanged file's digest
+    comes straight from the cache without reading it, and anything else is
+    hashed with the given function and, if it didn't change while being
+    hashed, added to the cache.
+    
+    @param cache cache to use
+    @param hasher function used on a miss, such as hashFile()
+    @param filename name of the file
+    @param digest storage for the digest
+    @return 0 on success, -1 with errno set on failure
+  */
+int hashFileCached( DigestCache *cache, FileHasher hasher, const char *filename,
+                    byte digest[ DIGEST_BYTES ] );
+
+#endif
@@ -0,0 +1,115 @@
+/** 
+    @filename digestFormat.c
+    @author Will Greene (wgreene)
+    
+    Contains functions that write digests out as hex, raw bytes or base64,
+    into the caller's memory.
+*/
+#include <string.h>
+#include "digestFormat.h"
+
+/** Two hex digits for every byte value, so each byte is a single lookup. */
+static const char hexPairs[ 2 * 256 + 1 ] =
+    "000102030405060708090a0b0c0d0e0f"
+    "101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f"
+    "303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f"
+    "505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f"
+    "707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f"
+    "909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+    "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+    "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/** Digits of standard base64. */
+static const char base64Digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+    Looks up a format by name: hex, raw or base64.
+    
+    @param name name of the format
+    @param format set to the format if the name is known
+    @return 0 on success, -1 if there's no such format
+  */
+int parseFormat( const char *name, DigestFormat *format )
+{
+    if ( strcmp( name, "hex" ) == 0 )
+        *format = FORMAT_HEX;
+    else if ( strcmp( name, "raw" ) == 0 )
+        *format = FORMAT_RAW;
+    else if ( strcmp( name, "base64" ) == 0 )
+        *format = FORMAT_BASE64;
+    else
+        return -1;
+    
+    return 0;
+}
+
+/**
+    Writes a digest as 40 lowercase hex digits, with no terminator.
+    
+    @param digest digest to write
+    @param out storage for HEX_DIGEST_CHARS characters
+  */
+void formatHex( const byte digest[ DIGEST_BYTES ], char *out )
+{
+    for ( int i = 0; i < DIGEST_BYTES; i++ )
+        memcpy( out + 2 * i, hexPairs + 2 * digest[ i ], 2 );
+}
+
+/**
+    Writes a digest in standard base64 with padding, with no terminator.
+    
+    @param digest digest to write
+    @param out storage for BASE64_DIGEST_CHARS characters
+  */
+void formatBase64( const byte digest[ DIGEST_BYTES ], char *out )
+{
+    int i = 0;
+    
+    // Each 3 bytes become 4 digits.
+    for ( ; i + 3 <= DIGEST_BYTES; i += 3 ) {
+        unsigned long group = (unsigned long) digest[ i ] << 16 | digest[ i + 1 ] << 8 | digest[ i + 2 ];
+        *out++ = base64Digits[ group >> 18 ];
+        *out++ = base64Digits[ ( group >> 12 ) & 0x3F ];
+        *out++ = base64Digits[ ( group >> 6 ) & 0x3F ];
+        *out++ = base64Digits[ group & 0x3F ];
+    }
+    
+    // 20 bytes leave 2 over, which make 3 digits and one pad character.
+    unsigned long group = (unsigned long) digest[ i ] << 16 | digest[ i + 1 ] << 8;
+    *out++ = base64Digits[ group >> 18 ];
+    *out++ = base64Digits[ ( group >> 12 ) & 0x3F ];
+    *out++ = base64Digits[ ( group >> 6 ) & 0x3F ];
+    *out = '=';
+}
+
+/**
+    Writes a digest in the given format, with no terminator.
+    
+    @param format how to write it
+    @param digest digest to write
+    @param out storage for up to MAX_FORMATTED_DIGEST bytes
+    @return number of bytes written
+  */
+size_t formatDigest( DigestFormat format, const byte digest[ DIGEST_BYTES ], char *out )
+{
+    switch ( format ) {
+    case FORMAT_RAW:
+        memcpy( out, digest, DIGEST_BYTES );
+        return DIGEST_BYTES;
+    case FORMAT_BASE64:
+        formatBase64( digest, out );
+        return BASE64_DIGEST_CHARS;
+    default:
+        formatHex( digest, out );
+        return HEX_DIGEST_CHARS;
+    }
+}
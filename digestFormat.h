@@ -0,0 +1,68 @@
+/** 
+    @filename digestFormat.h
+    @author Will Greene (wgreene)
+    
+    Header file for digestFormat.c
+*/
+#ifndef _DIGEST_FORMAT_H_
+#define _DIGEST_FORMAT_H_
+
+#include "ripeMD.h"
+
+/** Number of characters in a digest written in hex. */
+#define HEX_DIGEST_CHARS ( 2 * DIGEST_BYTES )
+
+/** Number of characters in a digest written in base64, with padding. */
+#define BASE64_DIGEST_CHARS ( ( DIGEST_BYTES + 2 ) / 3 * 4 )
+
+/** Most characters any format uses for one digest. */
+#define MAX_FORMATTED_DIGEST HEX_DIGEST_CHARS
+
+/** Ways of writing out a digest. */
+typedef enum {
+  /** 40 lowercase hex digits. */
+  FORMAT_HEX,
+  
+  /** The 20 digest bytes as they are. */
+  FORMAT_RAW,
+  
+  /** 28 characters of standard base64, with padding. */
+  FORMAT_BASE64
+} DigestFormat;
+
+/**
+    Looks up a format by name: hex, raw or base64.
+    
+    @param name name of the format
+    @param format set to the format if the name is known
+    @return 0 on success, -1 if there's no such format
+  */
+int parseFormat( const char *name, DigestFormat *format );
+
+/**
+    Writes a digest as 40 lowercase hex digits, with no terminator.
+    
+    @param digest digest to write
+    @param out storage for HEX_DIGEST_CHARS characters
+  */
+void formatHex( const byte digest[ DIGEST_BYTES ], char *out );
+
+/**
+    Writes a digest in standard base64 with padding, with no terminator.
+    
+    @param digest digest to write
+    @param out storage for BASE64_DIGEST_CHARS characters
+  */
+void formatBase64( const byte digest[ DIGEST_BYTES ], char *out );
+
+/**
+    Writes a digest in the given format, with no terminator.
+    
+    @param format how to write it
+    @param digest digest to write
+    @param out storage for up to MAX_FORMATTED_DIGEST bytes
+    @return number of bytes written
+  */
+size_t formatDigest( DigestFormat format, const byte digest[ DIGEST_BYTES ], char *out );
+
+#endif
@@ -0,0 +1,282 @@
+/** 
+    @filename fileHash.c
+    @author Will Greene (wgreene)
+    
+    Contains functions that compute the RIPEMD-160 hash of a whole file.
+*/
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fileHash.h"
+#include "stats.h"
+
+/**
+    Computes the digest of everything readable from the given file descriptor,
+    using a HashContext and a fixed-size read buffer.  Works on pipes and
+    special files as well as regular files.
+    
+    @param fd open file descriptor to read until end of file
+    @param digest storage for the resulting digest
+    @return 0 on success, -1 with errno set on a read error
+  */
+int hashStream( int fd, byte digest[ DIGEST_BYTES ] )
+{
+    byte *chunk = (byte *) malloc( STREAM_CHUNK_BYTES );
+    if ( !chunk )
+        return -1;
+    
+    HashContext ctx;
+    initContext( &ctx );
+    
+    for ( ;; ) {
+        STATS_START( timer );
+        ssize_t len = read( fd, chunk, STREAM_CHUNK_BYTES );
+        STATS_STOP( timer, STAGE_READ );
+        
+        if ( len < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            
+            free( chunk );
+            return -1;
+        }
+        
+        if ( len == 0 )
+            break;
+        
+        STATS_ADD( COUNT_BYTES_READ, len );
+        STATS_START( hashTimer );
+        updateContext( &ctx, chunk, len );
+        STATS_STOP( hashTimer, STAGE_COMPRESS );
+    }
+    
+    STATS_START( padTimer );
+    finishContext( &ctx, digest );
+    STATS_STOP( padTimer, STAGE_PAD );
+    free( chunk );
+    return 0;
+}
+
+/**
+    Hashes a regular file by mapping it into memory.  Whole blocks are hashed
+    directly out of the mapped pages.
+    
+    @param fd open file descriptor for the file
+    @param size size of the file in bytes
+    @param digest storage for the resulting digest
+    @return 0 on success, -1 if the file couldn't be mapped
+  */
+static int hashMapped( int fd, size_t size, byte digest[ DIGEST_BYTES ] )
+{
+    void *map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( map == MAP_FAILED )
+        return -1;
+    
+    // We touch every page exactly once, front to back.  The page faults that
+    // do the reading happen inside the compression function, so that's where
+    // --stats charges their time.
+    madvise( map, size, MADV_SEQUENTIAL );
+    STATS_ADD( COUNT_BYTES_READ, size );
+    
+    HashContext ctx;
+    initContext( &ctx );
+    STATS_START( hashTimer );
+    updateContext( &ctx, (const byte *) map, size );
+    STATS_STOP( hashTimer, STAGE_COMPRESS );
+    STATS_START( padTimer );
+    finishContext( &ctx, digest );
+    STATS_STOP( padTimer, STAGE_PAD );
+    
+    munmap( map, size );
+    return 0;
+}
+
+/**
+    Computes the digest of the named file.  Large regular files are mapped into
+    memory and hashed in place, with no copying except for the final partial
+    block; anything else falls back to hashStream().
+    
+    @param filename name of file to hash
+    @param digest storage for the resulting digest
+    @return 0 on success, -1 with errno set if the file can't be opened or read
+  */
+int hashFile( const char *filename, byte digest[ DIGEST_BYTES ] )
+{
+    int fd = open( filename, O_RDONLY );
+    if ( fd < 0 )
+        return -1;
+    
+    struct stat st;
+    int status = -1;
+    
+    if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size >= MMAP_THRESHOLD_BYTES
+         && (unsigned long long) st.st_size <= (size_t) -1 )
+        status = hashMapped( fd, st.st_size, digest );
+    
+    // Pipes, special files, small files, or a failed mapping.
+    if ( status != 0 )
+        status = hashStream( fd, digest );
+    
+    int err = errno;
+    close( fd );
+    errno = err;
+    
+    return status;
+}
+
+/** Number of times to spin on the ring before giving up the CPU. */
+#define RING_SPINS 1000
+
+/** Single-producer, single-consumer ring of buffers between the reader
+    thread and the hashing thread.  Each side only writes its own counter;
+    the counters only ever increase, and buffer i lives in slot
+    i % PIPELINE_BUFFERS. */
+typedef struct {
+  /** File being read. */
+  int fd;
+  
+  /** The buffers. */
+  byte *buffers[ PIPELINE_BUFFERS ];
+  
+  /** Number of bytes in each filled buffer.  A buffer that isn't full is the
+      last one. */
+  size_t lengths[ PIPELINE_BUFFERS ];
+  
+  /** Number of buffers the reader has filled (written by the reader). */
+  size_t filled;
+  
+  /** Number of buffers the hasher has finished with (written by the hasher). */
+  size_t consumed;
+  
+  /** errno value if reading failed, set before the end marker is published. */
+  int error;
+} Ring;
+
+/**
+    Waits until the other side of the ring moves its counter past the given
+    value.  Spins for a while first, since the wait is usually short, then
+    yields the CPU between checks.
+    
+    @param counter the other side's counter
+    @param value value to wait for the counter to exceed
+  */
+static void waitPast( size_t *counter, size_t value )
+{
+    for ( int spins = 0; __atomic_load_n( counter, __ATOMIC_ACQUIRE ) <= value; spins++ )
+        if ( spins >= RING_SPINS )
+            sched_yield();
+}
+
+/**
+    Reader thread: fills each free buffer in turn with a full buffer's worth
+    of the file, then publishes it.  Stops after publishing a buffer that
+    isn't full, at the end of the file or on an error.
+    
+    @param arg the Ring
+    @return NULL
+  */
+static void *ringReader( void *arg )
+{
+    Ring *ring = (Ring *) arg;
+    
+    for ( size_t i = 0; ; i++ ) {
+        // Wait for the hasher to be done with this slot's last use.
+        if ( i >= PIPELINE_BUFFERS )
+            waitPast( &ring->consumed, i - PIPELINE_BUFFERS );
+        
+        byte *buffer = ring->buffers[ i % PIPELINE_BUFFERS ];
+        size_t len = 0;
+        
+        while ( len < PIPELINE_BUFFER_BYTES ) {
+            STATS_START( timer );
+            ssize_t n = read( ring->fd, buffer + len, PIPELINE_BUFFER_BYTES - len );
+            STATS_STOP( timer, STAGE_READ );
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n < 0 ) {
+                ring->error = errno;
+                len = 0;
+                break;
+            }
+            if ( n == 0 )
+                break;
+            len += n;
+        }
+        
+        STATS_ADD( COUNT_BYTES_READ, len );
+        ring->lengths[ i % PIPELINE_BUFFERS ] = len;
+        __atomic_store_n( &ring->filled, i + 1, __ATOMIC_RELEASE );
+        
+        if ( len < PIPELINE_BUFFER_BYTES )
+            return NULL;
+    }
+}
+
+/**
+    Computes the digest of the named file with reading and hashing overlapped.
+    A reader thread fills a small ring of large, page-aligned buffers while
+    the calling thread hashes the ones already filled, so a file that isn't
+    in the page cache takes about as long as the slower of the disk and the
+    CPU, rather than the sum of the two.
+    
+    @param filename name of file to hash
+    @param digest storage for the resulting digest
+    @return 0 on success, -1 with errno set if the file can't be opened or read
+  */
+int hashFilePipelined( const char *filename, byte digest[ DIGEST_BYTES ] )
+{
+    Ring ring = { open( filename, O_RDONLY ) };
+    if ( ring.fd < 0 )
+        return -1;
+    
+    posix_fadvise( ring.fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+    
+    int status = 0;
+    for ( int i = 0; i < PIPELINE_BUFFERS; i++ )
+        if ( posix_memalign( (void **) &ring.buffers[ i ], PIPELINE_ALIGNMENT, PIPELINE_BUFFER_BYTES ) != 0 )
+            ring.buffers[ i ] = NULL, status = ENOMEM;
+    
+    pthread_t reader;
+    if ( status == 0 )
+        status = pthread_create( &reader, NULL, ringReader, &ring );
+    
+    if ( status == 0 ) {
+        HashContext ctx;
+        initContext( &ctx );
+        
+        for ( size_t i = 0; ; i++ ) {
+            waitPast( &ring.filled, i );
+            
+            size_t len = ring.lengths[ i % PIPELINE_BUFFERS ];
+            STATS_START( timer );
+            updateContext( &ctx, ring.buffers[ i % PIPELINE_BUFFERS ], len );
+            STATS_STOP( timer, STAGE_COMPRESS );
+            __atomic_store_n( &ring.consumed, i + 1, __ATOMIC_RELEASE );
+            
+            if ( len < PIPELINE_BUFFER_BYTES )
+                break;
+        }
+        
+        pthread_join( reader, NULL );
+        status = ring.error;
+        if ( status == 0 ) {
+            STATS_START( timer );
+            finishContext( &ctx, digest );
+            STATS_STOP( timer, STAGE_PAD );
+        }
+    }
+    
+    for ( int i = 0; i < PIPELINE_BUFFERS; i++ )
+        free( ring.buffers[ i ] );
+    close( ring.fd );
+    
+    errno = status;
+    return status ? -1 : 0;
+}
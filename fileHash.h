@@ -0,0 +1,66 @@
+/** 
+    @filename fileHash.h
+    @author Will Greene (wgreene)
+    
+    Header file for fileHash.c
+*/
+#ifndef _FILE_HASH_H_
+#define _FILE_HASH_H_
+
+#include "ripeMD.h"
+
+/** Regular files at least this big are memory-mapped instead of read. */
+#define MMAP_THRESHOLD_BYTES 65536
+
+/** Number of bytes read from a file descriptor at a time when streaming. */
+#define STREAM_CHUNK_BYTES 65536
+
+/** Number of buffers in the ring between the reader and hasher threads. */
+#define PIPELINE_BUFFERS 4
+
+/** Size of each buffer in the pipeline ring. */
+#define PIPELINE_BUFFER_BYTES ( 1024 * 1024 )
+
+/** Alignment of the pipeline buffers, a page. */
+#define PIPELINE_ALIGNMENT 4096
+
+/** A function that computes the digest of a named file, like hashFile().
+    Returns 0 on success, or -1 with errno set. */
+typedef int (*FileHasher)( const char *filename, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Computes the digest of everything readable from the given file descriptor,
+    using a HashContext and a fixed-size read buffer.  Works on pipes and
+    special files as well as regular files.
+    
+    @param fd open file descriptor to read until end of file
+    @param digest storage for the resulting digest
+    @return 0 on success, -1 with errno set on a read error
+  */
+int hashStream( int fd, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Computes the digest of the named file.  Large regular files are mapped into
+    memory and hashed in place, with no copying except for the final partial
+    block; anything else falls back to hashStream().
+    
+    @param filename name of file to hash
+    @param digest storage for the resulting digest
+    @return 0 on success, -1 with errno set if the file can't be opened or read
+  */
+int hashFile( const char *filename, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Computes the digest of the named file with reading and hashing overlapped.
+    A reader thread fills a small ring of large, page-aligned buffers while
+    the calling thread hashes the ones already filled, so a file that isn't
+    in the page cache takes about as long as the slower of the disk and the
+    CPU, rather than the sum of the two.
+    
+    @param filename name of file to hash
+    @param digest storage for the resulting digest
+    @return 0 on success, -1 with errno set if the file can't be opened or read
+  */
+int hashFilePipelined( const char *filename, byte digest[ DIGEST_BYTES ] );
+
+#endif
@@ -2,24 +2,480 @@
     @filename hash.c
     @author Will Greene (wgreene)
     
-    Computes the RIPEMD-160 hash for a given input file.
+    Computes the RIPEMD-160 hash for one or more input files.
   */
 #include "byteBuffer.h"
 #include "ripeMD.h"
+#include "fileHash.h"
+#include "ripeMDLanes.h"
+#include "hashPool.h"
+#include "treeHash.h"
+#include "uringHash.h"
+#include "recordHash.h"
+#include "outputBuffer.h"
+#include "digestFormat.h"
+#include "verify.h"
+#include "digestCache.h"
+#include "midstate.h"
+#include "stats.h"
+#include "perfCounters.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 
 /** number of executable arguments */
 #define EXECUTABLE_ARG 1
 
-/** number of required additional arguments */
+/** minimum number of required additional arguments */
 #define REQUIRED_ADDITIONAL_ARGS 1
 
 /** exit failure */
 #define FAIL exit( EXIT_FAILURE );
 
 /**
-    Starting point. Reads file data into a buffer, then creates 64-byte blocks of 
-    data to run through the RIPEMD algorithm. The end state of each block is used as the 
-    beginning state of the next block. The final state is printed.
+    Prints a usage message and exits.
+  */
+static void usage()
+{
+    fprintf( stderr, "usage: hash [-c manifest] [-j N] [--kernel NAME] [--pipeline | --uring | --append] [--tree [--chunk-size N] [--fanout N]] [--lines | --nul] [--format hex|raw|base64] [--cache FILE | --no-cache] [--rebuild-cache] [--cache-stats] [--stats] [--perf] <input-file>...\n"
+             "  -c manifest      check the files in a manifest of \"<digest>  <path>\" lines (- for stdin);\n"
+             "                   the exit status adds 1 for mismatches, 2 for missing or unreadable\n"
+             "                   files, 4 for malformed lines and 8 for an unreadable manifest\n"
+             "  -j N             hash on N worker threads (default: one per CPU)\n"
+             "  --kernel NAME    use the named compression kernel or multi-lane engine\n"
+             "  --pipeline       read each file on its own thread, overlapping disk and CPU time\n"
+             "  --uring          keep reads for many files in flight through io_uring\n"
+             "  --append         treat files as append-only, resuming from <file>.rmdstate\n"
+             "  --tree           print tree hashes, labeled with the chunk size and fanout\n"
+             "  --chunk-size N   bytes per tree leaf, with an optional K, M or G suffix\n"
+             "  --fanout N       most children per tree node\n"
+             "  --lines, --nul   hash each line or NUL-terminated record separately\n"
+             "  --format FORMAT  write digests in hex, raw or base64\n"
+             "  --cache FILE     remember file digests in FILE (default: $RIPEMD_CACHE)\n"
+             "  --no-cache       don't use a digest cache\n"
+             "  --rebuild-cache  empty the cache before using it\n"
+             "  --cache-stats    print the cache's hits and misses on stderr\n"
+             "  --stats          print time spent in each stage, and counts, on stderr\n"
+             "  --perf           print hardware counter figures for the hashing on stderr\n" );
+    FAIL;
+}
+
+/**
+    Forces the named compression kernel or multi-lane engine, instead of the
+    one picked automatically for this CPU.
+    
+    @param name kernel name, as listed in blockKernels or laneEngines
+  */
+static void forceKernel( const char *name )
+{
+    int found = selectBlockKernel( name ) == 0;
+    found = selectLaneEngine( name ) == 0 || found;
+    
+    if ( !found ) {
+        fprintf( stderr, "hash: unknown or unsupported kernel: %s\n", name );
+        FAIL;
+    }
+}
+
+/** Settings from the command line. */
+typedef struct {
+  /** Number of worker threads. */
+  int threads;
+  
+  /** Function used to hash each file. */
+  FileHasher hasher;
+  
+  /** Whether to read files through io_uring. */
+  int uring;
+  
+  /** Whether to compute tree hashes instead of plain digests. */
+  int tree;
+  
+  /** Bytes per leaf in tree mode. */
+  size_t chunkBytes;
+  
+  /** Children per parent in tree mode. */
+  int fanout;
+  
+  /** Whether to hash each record of the input instead of whole files. */
+  int records;
+  
+  /** Byte that ends each record in record mode. */
+  byte delim;
+  
+  /** How to write each digest. */
+  DigestFormat format;
+  
+  /** Manifest to check files against, or NULL. */
+  const char *manifest;
+  
+  /** Digest cache file, or NULL to hash every file. */
+  const char *cachePath;
+  
+  /** Whether to empty the cache before using it. */
+  int rebuildCache;
+  
+  /** Whether to print the cache's hit and miss counts. */
+  int cacheStats;
+  
+  /** Whether to print stage timings and counters. */
+  int stats;
+  
+  /** Whether to measure hashing with hardware performance counters. */
+  int perf;
+  
+  /** Index in argv of the first file name. */
+  int firstFile;
+} Options;
+
+/**
+    Parses a byte count, with an optional K, M or G suffix for KiB, MiB or GiB.
+    Exits with a usage message if it's not a positive number.
+    
+    @param str string to parse
+    @return the number of bytes
+  */
+static size_t parseSize( const char *str )
+{
+    char *end;
+    unsigned long long value = strtoull( str, &end, 10 );
+    
+    if ( *end == 'K' || *end == 'k' )
+        value <<= 10, end++;
+    else if ( *end == 'M' || *end == 'm' )
+        value <<= 20, end++;
+    else if ( *end == 'G' || *end == 'g' )
+        value <<= 30, end++;
+    
+    if ( *end || value == 0 || value > (size_t) -1 )
+        usage();
+    
+    return value;
+}
+
+/**
+    Parses the options in front of the file names.  Exits with a usage message
+    if they're not valid.
+    
+    @param argc number of arguments
+    @param argv array of pointers to command line arguments
+    @return the settings
+  */
+static Options parseOptions( int argc, char *argv[] )
+{
+    Options opts = { defaultThreads(), hashFile, 0, 0, DEFAULT_TREE_CHUNK_BYTES, DEFAULT_TREE_FANOUT, 0, '\n', FORMAT_HEX, NULL,
+                     getenv( CACHE_ENV_VAR ), 0, 0, 0, 0 };
+    int arg = EXECUTABLE_ARG;
+    
+    while ( arg < argc && argv[ arg ][ 0 ] == '-' && argv[ arg ][ 1 ] ) {
+        const char *opt = argv[ arg++ ];
+        const char *value = arg < argc ? argv[ arg ] : NULL;
+        
+        if ( strcmp( opt, "--tree" ) == 0 ) {
+            opts.tree = 1;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--pipeline" ) == 0 ) {
+            opts.hasher = hashFilePipelined;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--append" ) == 0 ) {
+            opts.hasher = hashFileAppending;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--uring" ) == 0 ) {
+            opts.uring = 1;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--no-cache" ) == 0 ) {
+            opts.cachePath = NULL;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--rebuild-cache" ) == 0 ) {
+            opts.rebuildCache = 1;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--cache-stats" ) == 0 ) {
+            opts.cacheStats = 1;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--stats" ) == 0 ) {
+            opts.stats = 1;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--perf" ) == 0 ) {
+            opts.perf = 1;
+            continue;
+        }
+        
+        if ( strcmp( opt, "--lines" ) == 0 || strcmp( opt, "--nul" ) == 0 ) {
+            opts.records = 1;
+            opts.delim = opt[ 2 ] == 'l' ? '\n' : '\0';
+            continue;
+        }
+        
+        // everything else takes a value
+        if ( !value )
+            usage();
+        arg++;
+        
+        if ( strcmp( opt, "--kernel" ) == 0 )
+            forceKernel( value );
+        else if ( strcmp( opt, "-c" ) == 0 )
+            opts.manifest = value;
+        else if ( strcmp( opt, "--cache" ) == 0 )
+            opts.cachePath = value;
+        else if ( strcmp( opt, "-j" ) == 0 ) {
+            opts.threads = atoi( value );
+            if ( opts.threads < 1 )
+                usage();
+        } else if ( strcmp( opt, "--format" ) == 0 ) {
+            if ( parseFormat( value, &opts.format ) != 0 )
+                usage();
+        } else if ( strcmp( opt, "--chunk-size" ) == 0 )
+            opts.chunkBytes = parseSize( value );
+        else if ( strcmp( opt, "--fanout" ) == 0 ) {
+            opts.fanout = atoi( value );
+            if ( opts.fanout < 2 )
+                usage();
+        } else
+            usage();
+    }
+    
+    // parameter error checking; record mode can read standard input instead,
+    // and checking mode gets its files from the manifest
+    if ( argc - arg < REQUIRED_ADDITIONAL_ARGS && !opts.records && !opts.manifest )
+        usage();
+    
+    opts.firstFile = arg;
+    return opts;
+}
+
+/** Digest cache shared by all the workers, or NULL. */
+static DigestCache *cache;
+
+/** Function the cache falls back to for files it doesn't have. */
+static FileHasher missHasher;
+
+/**
+    Hashes a file through the digest cache.  A FileHasher, so it can be
+    handed to the worker pool.
+    
+    @param filename name of the file
+    @param digest storage for the digest
+    @return 0 on success, -1 with errno set on failure
+  */
+static int hashThroughCache( const char *filename, byte digest[ DIGEST_BYTES ] )
+{
+    return hashFileCached( cache, missHasher, filename, digest );
+}
+
+/**
+    Opens the digest cache, if there is one, and switches the file hasher over
+    to go through it.  A cache that can't be opened is reported and skipped;
+    it only saves time.
+    
+    @param opts settings from the command line
+  */
+static void startCache( Options *opts )
+{
+    if ( !opts->cachePath )
+        return;
+    
+    cache = openCache( opts->cachePath, opts->rebuildCache );
+    if ( !cache ) {
+        fprintf( stderr, "hash: %s: %s\n", opts->cachePath, strerror( errno ) );
+        return;
+    }
+    
+    missHasher = opts->hasher;
+    opts->hasher = hashThroughCache;
+}
+
+/**
+    Closes the digest cache, first printing how much it helped if asked.
+    
+    @param opts settings from the command line
+  */
+static void finishCache( Options *opts )
+{
+    if ( !cache )
+        return;
+    
+    if ( opts->cacheStats )
+        fprintf( stderr, "cache: %llu hits, %llu misses, %llu stored\n", cache->hits, cache->misses,
+                 cache->stores );
+    closeCache( cache );
+    cache = NULL;
+}
+
+/** What reportJob() needs to know, and what it finds out. */
+typedef struct {
+  /** Where the digests go. */
+  OutputBuffer *out;
+  
+  /** How to write each digest. */
+  DigestFormat format;
+  
+  /** Whether to print the file name after each digest. */
+  int showNames;
+  
+  /** Printed in front of each digest, to say how it was computed. */
+  char label[ 64 ];
+  
+  /** Exit status, set to failure if any file can't be hashed. */
+  int status;
+} Report;
+
+/**
+    Reports one finished file.  With a single input file, just the digest is
+    printed; with several, each line is the digest and the file name, like
+    sha1sum.  Raw digests are written with nothing around them.
+    
+    @param job the finished job
+    @param arg the Report
+  */
+static void reportJob( FileJob *job, void *arg )
+{
+    Report *report = (Report *) arg;
+    
+    if ( job->error ) {
+        // Keep the error message in order with the digests before it.
+        flushOutput( report->out );
+        fprintf( stderr, "%s: %s\n", job->path, strerror( job->error ) );
+        report->status = EXIT_FAILURE;
+        return;
+    }
+    
+    // Raw digests are just the bytes, back to back.
+    if ( report->format == FORMAT_RAW ) {
+        putDigest( report->out, FORMAT_RAW, job->digest );
+        return;
+    }
+    
+    putBytes( report->out, report->label, strlen( report->label ) );
+    putDigest( report->out, report->format, job->digest );
+    
+    if ( report->showNames ) {
+        putBytes( report->out, "  ", 2 );
+        putBytes( report->out, job->path, strlen( job->path ) );
+    }
+    putBytes( report->out, "\n", 1 );
+}
+
+/**
+    Adds a batch of record digests to the output, one per line, or back to
+    back if they're raw.
+    
+    @param digests packed digests
+    @param n number of digests
+    @param arg the Report
+  */
+static void emitRecords( const byte *digests, size_t n, void *arg )
+{
+    Report *report = (Report *) arg;
+    
+    for ( size_t i = 0; i < n; i++ ) {
+        putDigest( report->out, report->format, digests + i * DIGEST_BYTES );
+        if ( report->format != FORMAT_RAW )
+            putBytes( report->out, "\n", 1 );
+    }
+}
+
+/**
+    Record mode: prints the digest of every record in each input file, or in
+    standard input if there are no files (or a file is named -), one per line
+    in input order.
+    
+    @param opts settings from the command line
+    @param argc number of arguments
+    @param argv array of pointers to command line arguments
+    @param report where the digests go
+  */
+static void hashRecordFiles( Options *opts, int argc, char *argv[], Report *report )
+{
+    int count = argc - opts->firstFile;
+    
+    for ( int i = 0; i < ( count ? count : 1 ); i++ ) {
+        const char *path = count ? argv[ opts->firstFile + i ] : "-";
+        int fd = strcmp( path, "-" ) == 0 ? STDIN_FILENO : open( path, O_RDONLY );
+        
+        if ( fd < 0 || hashRecords( fd, opts->delim, opts->threads, emitRecords, report ) != 0 ) {
+            flushOutput( report->out );
+            fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+            report->status = EXIT_FAILURE;
+        }
+        
+        if ( fd > STDIN_FILENO )
+            close( fd );
+    }
+}
+
+/**
+    Checking mode: verifies the files listed in the manifest, reporting each
+    failure as it's found and a summary on stderr if anything went wrong.
+    
+    @param opts settings from the command line
+    @param report where failures go
+  */
+static void checkManifest( Options *opts, Report *report )
+{
+    VerifyCounts counts;
+    
+    if ( verifyManifest( opts->manifest, opts->threads, opts->hasher, report->out, &counts ) != 0 ) {
+        fprintf( stderr, "%s: %s\n", opts->manifest, strerror( errno ) );
+        report->status = VERIFY_NO_MANIFEST;
+        return;
+    }
+    
+    report->status = verifyStatus( &counts );
+    if ( report->status )
+        fprintf( stderr, "hash: %zu OK, %zu FAILED, %zu MISSING, %zu UNREADABLE, %zu improperly formatted\n",
+                 counts.ok, counts.failed, counts.missing, counts.unreadable, counts.malformed );
+}
+
+/**
+    Returns the number of input bytes actually read and hashed, for working
+    out per-byte figures.  Files answered from the digest cache and the part
+    of a file an --append sidecar already covers aren't counted.
+    
+    @return bytes hashed, or 0 if this build doesn't count them
+  */
+static double hashedBytes( void )
+{
+#ifndef NO_STATS
+    return statCount( COUNT_BYTES_READ );
+#else
+    return 0;
+#endif
+}
+
+/**
+    Names the code doing the hashing: the multi-lane engine in record mode,
+    where each record is a separate message, and the block kernel otherwise.
+    
+    @param opts settings from the command line
+    @return name of the kernel or engine
+  */
+static const char *kernelName( const Options *opts )
+{
+    return opts->records ? activeLaneEngine()->name : activeBlockKernel()->name;
+}
+
+/**
+    Starting point. Hashes each file named on the command line, or each of its
+    records, tree leaves or manifest entries as the options say, on a pool of
+    worker threads, and prints the digests in the order the files were given.
+    The options are listed by usage().
     
     @param argc number of arguments
     @param *argv[] array of pointers to command line arguments
@@ -27,39 +483,84 @@
   */
 int main( int argc, char *argv[] )
 {
-    // parameter error checking
-    if ( argc != EXECUTABLE_ARG + REQUIRED_ADDITIONAL_ARGS ) {
-        fprintf( stderr, "usage: hash <input-file>\n" );
-        FAIL;
-    }
+    Options opts = parseOptions( argc, argv );
     
-    char *filename = argv[ 1 ];
-    ByteBuffer *buffer = readFile( filename );
+    // --perf needs the byte count.
+#ifndef NO_STATS
+    if ( opts.stats || opts.perf )
+        startStats();
+#else
+    if ( opts.stats )
+        fprintf( stderr, "hash: built without --stats support\n" );
+#endif
     
-    if ( !buffer ) {
-        perror( filename );
+    Report report = { createOutput( STDOUT_FILENO ), opts.format, argc - opts.firstFile > 1, "",
+                      EXIT_SUCCESS };
+    if ( !report.out ) {
+        perror( "hash" );
         FAIL;
     }
     
-    padBuffer( buffer );
+    // Tree digests aren't plain file digests, and the io_uring path hashes
+    // files in batches rather than through a FileHasher, so only the
+    // ordinary modes use the cache.
+    if ( !opts.records && !opts.tree && !opts.uring )
+        startCache( &opts );
+    
+    PerfCounters perf;
+    int perfOpen = opts.perf && openPerfCounters( &perf ) == 0;
+    if ( opts.perf && !perfOpen )
+        fprintf( stderr, "hash: perf counters unavailable: %s\n", strerror( errno ) );
+    if ( perfOpen )
+        startPerfCounters( &perf );
+    
+    if ( opts.manifest )
+        checkManifest( &opts, &report );
+    else if ( opts.records )
+        hashRecordFiles( &opts, argc, argv, &report );
+    else {
+        size_t n = argc - opts.firstFile;
+        FileJob *jobs = (FileJob *) calloc( n, sizeof( FileJob ) );
+        for ( size_t i = 0; i < n; i++ )
+            jobs[ i ].path = argv[ opts.firstFile + i ];
         
-    HashState *hash = ( HashState * ) malloc( sizeof( HashState ) );
-    initState( hash );
+        if ( opts.tree ) {
+            snprintf( report.label, sizeof( report.label ), "tree-%zu-%d:", opts.chunkBytes, opts.fanout );
+            
+            for ( size_t i = 0; i < n; i++ ) {
+                int status = treeHashFile( jobs[ i ].path, opts.chunkBytes, opts.fanout, opts.threads,
+                                           jobs[ i ].digest );
+                jobs[ i ].error = status == 0 ? 0 : errno;
+                reportJob( &jobs[ i ], &report );
+            }
+        } else if ( opts.uring )
+            hashFilesUring( jobs, n, opts.threads, reportJob, &report );
+        else
+            hashFiles( jobs, n, opts.threads, opts.hasher, reportJob, &report );
+        
+        free( jobs );
+    }
     
-    int numBlocks = buffer->len / BLOCK_BYTES;
-    byte block[ BLOCK_BYTES ] = {};
+    PerfReading reading;
+    if ( perfOpen ) {
+        stopPerfCounters( &perf, &reading );
+        closePerfCounters( &perf );
+    }
     
-    for ( int i = 0; i < numBlocks; i++ ) {
+    finishCache( &opts );
     
-        for ( int j = 0; j < BLOCK_BYTES; j++ )
-            block[ j ] = buffer->data[ i * BLOCK_BYTES + j ];
-            
-        hashBlock( hash, block );
+    if ( freeOutput( report.out ) != 0 ) {
+        fprintf( stderr, "hash: %s\n", strerror( errno ) );
+        report.status = EXIT_FAILURE;
     }
-        
-    printHash( hash );
     
-    free( hash );
-    freeBuffer( buffer );
-    return EXIT_SUCCESS;
+#ifndef NO_STATS
+    if ( opts.stats )
+        printStats( stderr );
+#endif
+    
+    if ( perfOpen )
+        printPerfReading( stderr, kernelName( &opts ), &reading, hashedBytes() );
+    
+    return report.status;
 }
@@ -0,0 +1,258 @@
+/** 
+    @filename hashPool.c
+    @author Will Greene (wgreene)
+    
+    Contains a pool of worker threads for hashing a list of files in parallel.
+*/
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "hashPool.h"
+#include "fileHash.h"
+
+/** State shared by the calling thread and the workers. */
+typedef struct {
+  /** The list of jobs. */
+  FileJob *jobs;
+  
+  /** Number of jobs in the list. */
+  size_t n;
+  
+  /** Number of worker threads. */
+  int threads;
+  
+  /** Function that hashes each file, if batch is NULL. */
+  FileHasher hasher;
+  
+  /** Function that hashes a whole batch of files at once, or NULL. */
+  BatchHasher batch;
+  
+  /** Index of the first job nobody has claimed yet. */
+  size_t next;
+  
+  /** Protects the done flags. */
+  pthread_mutex_t lock;
+  
+  /** Signaled when a batch of jobs is finished. */
+  pthread_cond_t finished;
+} Pool;
+
+/**
+    Returns the number of worker threads to use when none is requested: the
+    number of online CPUs.
+    
+    @return default thread count
+  */
+int defaultThreads( void )
+{
+    long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    return cpus > 0 ? cpus : 1;
+}
+
+/**
+    Hashes one job's file, recording the digest or the error.
+    
+    @param job job to run
+    @param hasher function that hashes the file
+  */
+static void runJob( FileJob *job, FileHasher hasher )
+{
+    job->error = hasher( job->path, job->digest ) == 0 ? 0 : errno;
+}
+
+/**
+    Runs a batch of jobs, with the pool's batch function if it has one, or
+    one at a time with its file hasher.
+    
+    @param pool shared pool state
+    @param start index of the first job in the batch
+    @param count number of jobs in the batch
+  */
+static void runBatch( Pool *pool, size_t start, size_t count )
+{
+    if ( pool->batch )
+        pool->batch( pool->jobs + start, count );
+    else
+        for ( size_t i = start; i < start + count; i++ )
+            runJob( &pool->jobs[ i ], pool->hasher );
+}
+
+/**
+    Claims the next batch of jobs.  Batches are about a quarter of each worker's
+    share of what's left, between 1 and MAX_JOBS_PER_CLAIM jobs.
+    
+    @param pool shared pool state
+    @param start set to the index of the first job in the batch
+    @return number of jobs claimed, zero when there's nothing left
+  */
+static size_t claimJobs( Pool *pool, size_t *start )
+{
+    size_t next = __atomic_load_n( &pool->next, __ATOMIC_RELAXED );
+    
+    for ( ;; ) {
+        if ( next >= pool->n )
+            return 0;
+        
+        size_t count = ( pool->n - next ) / ( 4 * pool->threads );
+        if ( count < 1 )
+            count = 1;
+        if ( count > MAX_JOBS_PER_CLAIM )
+            count = MAX_JOBS_PER_CLAIM;
+        
+        if ( __atomic_compare_exchange_n( &pool->next, &next, next + count, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED ) ) {
+            *start = next;
+            return count;
+        }
+    }
+}
+
+/**
+    Worker thread: claims and runs batches of jobs until there are none left,
+    publishing each finished batch with a single wakeup.
+    
+    @param arg the Pool
+    @return NULL
+  */
+static void *worker( void *arg )
+{
+    Pool *pool = (Pool *) arg;
+    size_t start, count;
+    
+    while ( ( count = claimJobs( pool, &start ) ) > 0 ) {
+        runBatch( pool, start, count );
+        
+        pthread_mutex_lock( &pool->lock );
+        for ( size_t i = start; i < start + count; i++ )
+            pool->jobs[ i ].done = 1;
+        pthread_cond_signal( &pool->finished );
+        pthread_mutex_unlock( &pool->lock );
+    }
+    
+    return NULL;
+}
+
+/**
+    Runs all the pool's jobs on the calling thread, a batch at a time,
+    reporting each to done in list order.
+    
+    @param pool pool state, with the jobs and hash functions set
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+static void runInline( Pool *pool, JobDone done, void *arg )
+{
+    FileJob *jobs = pool->jobs;
+    size_t n = pool->n;
+    
+    for ( size_t start = 0; start < n; start += MAX_JOBS_PER_CLAIM ) {
+        size_t count = n - start < MAX_JOBS_PER_CLAIM ? n - start : MAX_JOBS_PER_CLAIM;
+        runBatch( pool, start, count );
+        for ( size_t i = start; i < start + count; i++ ) {
+            jobs[ i ].done = 1;
+            done( &jobs[ i ], arg );
+        }
+    }
+}
+
+/**
+    Runs all the pool's jobs, on worker threads if there's more than one,
+    reporting each to done in list order.  If no worker thread can be
+    started, the jobs run on the calling thread instead.
+    
+    @param pool pool state, with the jobs, thread count and hash functions set
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+static void runPool( Pool *pool, JobDone done, void *arg )
+{
+    FileJob *jobs = pool->jobs;
+    size_t n = pool->n;
+    
+    if ( pool->threads > n )
+        pool->threads = n;
+    
+    if ( pool->threads <= 1 ) {
+        runInline( pool, done, arg );
+        return;
+    }
+    
+    pthread_mutex_init( &pool->lock, NULL );
+    pthread_cond_init( &pool->finished, NULL );
+    
+    for ( size_t i = 0; i < n; i++ )
+        jobs[ i ].done = 0;
+    
+    pthread_t *workers = (pthread_t *) malloc( pool->threads * sizeof( pthread_t ) );
+    int started = 0;
+    while ( workers && started < pool->threads &&
+            pthread_create( &workers[ started ], NULL, worker, pool ) == 0 )
+        started++;
+    
+    if ( started == 0 ) {
+        free( workers );
+        pthread_cond_destroy( &pool->finished );
+        pthread_mutex_destroy( &pool->lock );
+        runInline( pool, done, arg );
+        return;
+    }
+    
+    // Report results in order, waiting whenever the next one isn't ready.
+    for ( size_t i = 0; i < n; i++ ) {
+        pthread_mutex_lock( &pool->lock );
+        while ( !jobs[ i ].done )
+            pthread_cond_wait( &pool->finished, &pool->lock );
+        pthread_mutex_unlock( &pool->lock );
+        
+        done( &jobs[ i ], arg );
+    }
+    
+    for ( int i = 0; i < started; i++ )
+        pthread_join( workers[ i ], NULL );
+    free( workers );
+    
+    pthread_cond_destroy( &pool->finished );
+    pthread_mutex_destroy( &pool->lock );
+}
+
+/**
+    Hashes every file in the jobs list on a pool of worker threads.  Workers
+    claim jobs in batches, so lots of small files don't cost a thread handoff
+    each.  The done function is called on the calling thread for each job, in
+    list order, as soon as that job and all the ones before it are finished,
+    so results can be reported while later files are still being hashed.
+    
+    @param jobs list of files to hash
+    @param n number of jobs
+    @param threads number of worker threads; with 1, everything runs on the
+                   calling thread
+    @param hasher function that hashes each file, or NULL for hashFile()
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+void hashFiles( FileJob jobs[], size_t n, int threads, FileHasher hasher, JobDone done, void *arg )
+{
+    Pool pool = { jobs, n, threads, hasher ? hasher : hashFile, NULL, 0 };
+    runPool( &pool, done, arg );
+}
+
+/**
+    Same as hashFiles(), but each worker hands its whole claimed batch to a
+    batch function, which can work on all the files in it at once.
+    
+    @param jobs list of files to hash
+    @param n number of jobs
+    @param threads number of worker threads
+    @param batch function that hashes a batch of jobs, setting each one's
+                 digest or error
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+void hashFileBatches( FileJob jobs[], size_t n, int threads, BatchHasher batch, JobDone done, void *arg )
+{
+    Pool pool = { jobs, n, threads, NULL, batch, 0 };
+    runPool( &pool, done, arg );
+}
@@ -0,0 +1,77 @@
+/** 
+    @filename hashPool.h
+    @author Will Greene (wgreene)
+    
+    Header file for hashPool.c
+*/
+#ifndef _HASH_POOL_H_
+#define _HASH_POOL_H_
+
+#include "fileHash.h"
+
+/** Most jobs a worker claims at once.  Claims shrink toward one job as the
+    list runs out, so big files near the end still spread across workers. */
+#define MAX_JOBS_PER_CLAIM 64
+
+/** One file to hash, and the result. */
+typedef struct {
+  /** Name of the file to hash. */
+  const char *path;
+  
+  /** Digest of the file, valid if error is zero. */
+  byte digest[ DIGEST_BYTES ];
+  
+  /** errno value if the file couldn't be hashed, or zero. */
+  int error;
+  
+  /** Set once the job is finished (internal to hashPool.c). */
+  int done;
+} FileJob;
+
+/** Function called for each finished job.  See hashFiles(). */
+typedef void (*JobDone)( FileJob *job, void *arg );
+
+/** Function that hashes a batch of jobs, setting each one's digest or error.
+    See hashFileBatches(). */
+typedef void (*BatchHasher)( FileJob jobs[], size_t count );
+
+/**
+    Returns the number of worker threads to use when none is requested: the
+    number of online CPUs.
+    
+    @return default thread count
+  */
+int defaultThreads( void );
+
+/**
+    Hashes every file in the jobs list on a pool of worker threads.  Workers
+    claim jobs in batches, so lots of small files don't cost a thread handoff
+    each.  The done function is called on the calling thread for each job, in
+    list order, as soon as that job and all the ones before it are finished,
+    so results can be reported while later files are still being hashed.
+    
+    @param jobs list of files to hash
+    @param n number of jobs
+    @param threads number of worker threads; with 1, everything runs on the
+                   calling thread
+    @param hasher function that hashes each file, or NULL for hashFile()
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+void hashFiles( FileJob jobs[], size_t n, int threads, FileHasher hasher, JobDone done, void *arg );
+
+/**
+    Same as hashFiles(), but each worker hands its whole claimed batch to a
+    batch function, which can work on all the files in it at once.
+    
+    @param jobs list of files to hash
+    @param n number of jobs
+    @param threads number of worker threads
+    @param batch function that hashes a batch of jobs, setting each one's
+                 digest or error
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+void hashFileBatches( FileJob jobs[], size_t n, int threads, BatchHasher batch, JobDone done, void *arg );
+
+#endif
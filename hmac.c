@@ -0,0 +1,107 @@
+/** 
+    @filename hmac.c
+    @author Will Greene (wgreene)
+    
+    Contains functions that compute HMAC-RIPEMD160 message authentication
+    codes, as defined in RFC 2104 and RFC 2286.
+*/
+#include <string.h>
+#include "hmac.h"
+#include "ripeMDLanes.h"
+
+/**
+    Computes the state after hashing one block made of the key XORed with a
+    pad byte.
+    
+    @param state HashState address, set to the result
+    @param block the key, zero-padded to a block
+    @param pad HMAC_IPAD or HMAC_OPAD
+  */
+static void hashKeyBlock( HashState *state, const byte block[ BLOCK_BYTES ], byte pad )
+{
+    byte padded[ BLOCK_BYTES ];
+    for ( int i = 0; i < BLOCK_BYTES; i++ )
+        padded[ i ] = block[ i ] ^ pad;
+    
+    initState( state );
+    hashBlock( state, padded );
+}
+
+/**
+    Prepares a key for HMAC-RIPEMD160.  Keys longer than a block are hashed
+    first, as RFC 2104 requires.
+    
+    @param key HmacKey address
+    @param secret key bytes
+    @param len number of bytes in secret
+  */
+void hmacInit( HmacKey *key, const byte *secret, size_t len )
+{
+    byte block[ BLOCK_BYTES ] = { 0 };
+    
+    if ( len > BLOCK_BYTES )
+        hashShort( secret, len, block );
+    else
+        memcpy( block, secret, len );
+    
+    hashKeyBlock( &key->inner, block, HMAC_IPAD );
+    hashKeyBlock( &key->outer, block, HMAC_OPAD );
+}
+
+/**
+    Computes the HMAC of one message.  Costs the message's own blocks and the
+    one-block outer hash; the key blocks were done by hmacInit().
+    
+    @param key key prepared by hmacInit()
+    @param msg message bytes
+    @param len number of bytes in msg
+    @param mac storage for the resulting 20-byte MAC
+  */
+void hmacMessage( const HmacKey *key, const byte *msg, size_t len, byte mac[ DIGEST_BYTES ] )
+{
+    HashState state = key->inner;
+    size_t nblocks = len / BLOCK_BYTES;
+    if ( nblocks )
+        hashBlocks( &state, msg, nblocks );
+    
+    // Both hashes count the key block in the message length.
+    byte tail[ 2 * BLOCK_BYTES ];
+    int blocks = padFinalBlocks( tail, msg + nblocks * BLOCK_BYTES, len % BLOCK_BYTES,
+                                 BLOCK_BYTES + len );
+    hashBlocks( &state, tail, blocks );
+    
+    byte inner[ DIGEST_BYTES ];
+    writeDigest( &state, inner );
+    
+    state = key->outer;
+    padFinalBlocks( tail, inner, DIGEST_BYTES, BLOCK_BYTES + DIGEST_BYTES );
+    hashBlock( &state, tail );
+    writeDigest( &state, mac );
+}
+
+/**
+    Computes the HMACs of n messages under the same key with the engine
+    chosen by activeLaneEngine(): the inner hashes go through the lane
+    scheduler, then the outer hashes, all one block long, run in lockstep.
+    
+    @param key key prepared by hmacInit()
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param macs storage for n packed MACs of DIGEST_BYTES each
+  */
+void hmacBatch( const HmacKey *key, const byte *const msgs[], const size_t lens[], size_t n,
+                byte *macs )
+{
+    const LaneEngine *engine = activeLaneEngine();
+    byte inner[ HMAC_BATCH_MESSAGES * DIGEST_BYTES ];
+    
+    for ( size_t first = 0; first < n; first += HMAC_BATCH_MESSAGES ) {
+        size_t count = n - first < HMAC_BATCH_MESSAGES ? n - first : HMAC_BATCH_MESSAGES;
+        
+        continueMessagesLanes( engine, &key->inner, BLOCK_BYTES, msgs + first, lens + first, count,
+                               inner );
+        continueFixedLanes( engine, &key->outer, BLOCK_BYTES, inner, DIGEST_BYTES, count,
+                            macs + first * DIGEST_BYTES );
+    }
+}
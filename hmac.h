@@ -0,0 +1,68 @@
+/** 
+    @filename hmac.h
+    @author Will Greene (wgreene)
+    
+    Header file for hmac.c
+*/
+#ifndef _HMAC_H_
+#define _HMAC_H_
+
+#include "ripeMD.h"
+
+/** Byte XORed into the key for the inner hash. */
+#define HMAC_IPAD 0x36
+
+/** Byte XORed into the key for the outer hash. */
+#define HMAC_OPAD 0x5C
+
+/** Number of messages hmacBatch() runs through the lanes at a time. */
+#define HMAC_BATCH_MESSAGES 256
+
+/** A key prepared for HMAC-RIPEMD160.  The key only ever appears in the
+    first block of the inner and outer hashes, so the state after each of
+    those blocks is computed once, by hmacInit(), and every message starts
+    from there. */
+typedef struct {
+  /** State after hashing the key XORed with the ipad bytes. */
+  HashState inner;
+  
+  /** State after hashing the key XORed with the opad bytes. */
+  HashState outer;
+} HmacKey;
+
+/**
+    Prepares a key for HMAC-RIPEMD160.  Keys longer than a block are hashed
+    first, as RFC 2104 requires.
+    
+    @param key HmacKey address
+    @param secret key bytes
+    @param len number of bytes in secret
+  */
+void hmacInit( HmacKey *key, const byte *secret, size_t len );
+
+/**
+    Computes the HMAC of one message.  Costs the message's own blocks and the
+    one-block outer hash; the key blocks were done by hmacInit().
+    
+    @param key key prepared by hmacInit()
+    @param msg message bytes
+    @param len number of bytes in msg
+    @param mac storage for the resulting 20-byte MAC
+  */
+void hmacMessage( const HmacKey *key, const byte *msg, size_t len, byte mac[ DIGEST_BYTES ] );
+
+/**
+    Computes the HMACs of n messages under the same key with the engine
+    chosen by activeLaneEngine(): the inner hashes go through the lane
+    scheduler, then the outer hashes, all one block long, run in lockstep.
+    
+    @param key key prepared by hmacInit()
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param macs storage for n packed MACs of DIGEST_BYTES each
+  */
+void hmacBatch( const HmacKey *key, const byte *const msgs[], const size_t lens[], size_t n,
+                byte *macs );
+
+#endif
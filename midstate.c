@@ -0,0 +1,416 @@
+/** 
+    @filename midstate.c
+    @author Will Greene (wgreene)
+    
+    Contains functions that save and restore a hash in progress, so it can be
+    resumed later or extended with more of the message.
+*/
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "midstate.h"
+#include "fileHash.h"
+#include "stats.h"
+
+/** Offset of A through E in an exported midstate. */
+#define STATE_OFFSET 8
+
+/** Offset of the message length in an exported midstate. */
+#define LENGTH_OFFSET ( STATE_OFFSET + DIGEST_BYTES )
+
+/** Offset of the partial block's length in an exported midstate. */
+#define PARTIAL_LEN_OFFSET ( LENGTH_OFFSET + 8 )
+
+/** Offset of the partial block in an exported midstate. */
+#define PARTIAL_OFFSET ( PARTIAL_LEN_OFFSET + 4 )
+
+/**
+    Stores an integer in the given number of bytes, least significant first.
+    
+    @param out where the bytes go
+    @param value value to store
+    @param n number of bytes
+  */
+static void putLittle( byte *out, unsigned long long value, int n )
+{
+    for ( int i = 0; i < n; i++ )
+        out[ i ] = value >> ( 8 * i );
+}
+
+/**
+    Reads an integer stored by putLittle().
+    
+    @param in the stored bytes
+    @param n number of bytes
+    @return the value
+  */
+static unsigned long long getLittle( const byte *in, int n )
+{
+    unsigned long long value = 0;
+    for ( int i = n - 1; i >= 0; i-- )
+        value = value << 8 | in[ i ];
+    return value;
+}
+
+/**
+    Writes a context out in a portable form: every field little endian,
+    whatever the host, so a midstate can be moved between machines.
+    
+    @param ctx HashContext address
+    @param out storage for the exported midstate
+  */
+void exportMidstate( const HashContext *ctx, byte out[ MIDSTATE_BYTES ] )
+{
+    memset( out, 0, MIDSTATE_BYTES );
+    memcpy( out, MIDSTATE_MAGIC, 4 );
+    putLittle( out + 4, MIDSTATE_VERSION, 4 );
+    
+    // Same byte order as the digest that finishContext() would write.
+    writeDigest( &ctx->state, out + STATE_OFFSET );
+    
+    putLittle( out + LENGTH_OFFSET, ctx->length, 8 );
+    putLittle( out + PARTIAL_LEN_OFFSET, ctx->partialLen, 4 );
+    memcpy( out + PARTIAL_OFFSET, ctx->partial, ctx->partialLen );
+}
+
+/**
+    Restores a context written by exportMidstate(), after checking that it's
+    a midstate of this version and that its fields agree with each other.
+    
+    @param ctx HashContext address, left alone on failure
+    @param in the exported midstate
+    @return 0 on success, -1 with errno set to EINVAL if it isn't valid
+  */
+int importMidstate( HashContext *ctx, const byte in[ MIDSTATE_BYTES ] )
+{
+    unsigned long long length = getLittle( in + LENGTH_OFFSET, 8 );
+    unsigned int partialLen = getLittle( in + PARTIAL_LEN_OFFSET, 4 );
+    
+    // Whole blocks are always hashed right away, so the partial block is
+    // exactly what's left over after them.
+    if ( memcmp( in, MIDSTATE_MAGIC, 4 ) != 0 || getLittle( in + 4, 4 ) != MIDSTATE_VERSION ||
+         partialLen != length % BLOCK_BYTES ) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    const byte *state = in + STATE_OFFSET;
+    ctx->state.A = getLittle( state, 4 );
+    ctx->state.B = getLittle( state + 4, 4 );
+    ctx->state.C = getLittle( state + 8, 4 );
+    ctx->state.D = getLittle( state + 12, 4 );
+    ctx->state.E = getLittle( state + 16, 4 );
+    ctx->length = length;
+    ctx->partialLen = partialLen;
+    memcpy( ctx->partial, in + PARTIAL_OFFSET, partialLen );
+    return 0;
+}
+
+/**
+    Replaces the named file with the given bytes, atomically, so a crash
+    leaves either the old contents or the new ones.
+    
+    @param path name of the file
+    @param data bytes to write
+    @param len number of bytes
+    @return 0 on success, -1 with errno set on failure
+  */
+static int replaceFile( const char *path, const byte *data, size_t len )
+{
+    // Written beside the real file, so the rename can't cross file systems.
+    size_t pathLen = strlen( path );
+    char *temp = (char *) malloc( pathLen + 5 );
+    if ( !temp )
+        return -1;
+    memcpy( temp, path, pathLen );
+    memcpy( temp + pathLen, ".tmp", 5 );
+    
+    int fd = open( temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    int status = -1;
+    
+    if ( fd >= 0 ) {
+        if ( write( fd, data, len ) == (ssize_t) len && fsync( fd ) == 0 )
+            status = 0;
+        if ( close( fd ) != 0 )
+            status = -1;
+        if ( status == 0 )
+            status = rename( temp, path );
+        
+        if ( status != 0 ) {
+            int err = errno;
+            unlink( temp );
+            errno = err;
+        }
+    }
+    
+    free( temp );
+    return status;
+}
+
+/**
+    Reads exactly len bytes from the start of the named file.
+    
+    @param path name of the file
+    @param data storage for the bytes
+    @param len number of bytes the file must hold
+    @return 0 on success, -1 with errno set on failure, EINVAL if the file
+            is a different size
+  */
+static int readWhole( const char *path, byte *data, size_t len )
+{
+    int fd = open( path, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+        return -1;
+    
+    // One byte more than expected, to notice a file that's too long.
+    byte extra;
+    ssize_t got = read( fd, data, len );
+    ssize_t more = got == (ssize_t) len ? read( fd, &extra, 1 ) : 0;
+    int err = errno;
+    close( fd );
+    
+    if ( got < 0 || more < 0 ) {
+        errno = err;
+        return -1;
+    }
+    
+    if ( got != (ssize_t) len || more != 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+    Exports a context into the named file.  The file is replaced atomically,
+    so a crash leaves either the old midstate or the new one.
+    
+    @param path name of the file
+    @param ctx HashContext address
+    @return 0 on success, -1 with errno set on failure
+  */
+int saveMidstate( const char *path, const HashContext *ctx )
+{
+    byte data[ MIDSTATE_BYTES ];
+    exportMidstate( ctx, data );
+    return replaceFile( path, data, MIDSTATE_BYTES );
+}
+
+/**
+    Restores a context from a file written by saveMidstate().
+    
+    @param path name of the file
+    @param ctx HashContext address, left alone on failure
+    @return 0 on success, -1 with errno set on failure, EINVAL if the file
+            isn't a valid midstate
+  */
+int loadMidstate( const char *path, HashContext *ctx )
+{
+    byte data[ MIDSTATE_BYTES ];
+    if ( readWhole( path, data, MIDSTATE_BYTES ) != 0 )
+        return -1;
+    
+    return importMidstate( ctx, data );
+}
+
+/**
+    Computes the fingerprint a sidecar keeps of the prefix it describes: the
+    digest of its last SIDECAR_TAIL_BYTES bytes, or all of it if it's shorter.
+    
+    @param fd open file descriptor for the file
+    @param length length of the prefix
+    @param digest storage for the fingerprint
+    @return 0 on success, -1 if the bytes can't be read
+  */
+static int tailFingerprint( int fd, unsigned long long length, byte digest[ DIGEST_BYTES ] )
+{
+    byte tail[ SIDECAR_TAIL_BYTES ];
+    size_t len = length < SIDECAR_TAIL_BYTES ? length : SIDECAR_TAIL_BYTES;
+    
+    for ( size_t got = 0; got < len; ) {
+        ssize_t n = pread( fd, tail + got, len - got, length - len + got );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return -1;
+        got += n;
+    }
+    
+    hashShort( tail, len, digest );
+    return 0;
+}
+
+/**
+    Writes the sidecar for a file: the context, then the file's identity and
+    the fingerprint of the bytes hashed so far.
+    
+    @param path name of the sidecar
+    @param fd open file descriptor for the file
+    @param st the file's status
+    @param ctx context covering a prefix of the file
+    @return 0 on success, -1 with errno set on failure
+  */
+static int saveSidecar( const char *path, int fd, const struct stat *st, const HashContext *ctx )
+{
+    byte data[ SIDECAR_BYTES ];
+    exportMidstate( ctx, data );
+    
+    byte *info = data + MIDSTATE_BYTES;
+    putLittle( info, SIDECAR_VERSION, 4 );
+    putLittle( info + 4, st->st_dev, 8 );
+    putLittle( info + 12, st->st_ino, 8 );
+    if ( tailFingerprint( fd, ctx->length, info + 20 ) != 0 )
+        return -1;
+    
+    return replaceFile( path, data, SIDECAR_BYTES );
+}
+
+/**
+    Restores the context from a file's sidecar, if the sidecar was saved
+    for this same file and the prefix it describes is still there: the
+    device and inode match, the file is at least as long, and the end of the
+    prefix has the fingerprint the sidecar recorded.  Bytes before that
+    aren't checked; that would mean reading them, which is what the sidecar
+    is there to avoid.
+    
+    @param path name of the sidecar
+    @param fd open file descriptor for the file
+    @param st the file's status
+    @param ctx HashContext address, left alone on failure
+    @return true if the context was restored and can be resumed
+  */
+static int loadSidecar( const char *path, int fd, const struct stat *st, HashContext *ctx )
+{
+    byte data[ SIDECAR_BYTES ];
+    HashContext saved;
+    if ( readWhole( path, data, SIDECAR_BYTES ) != 0 || importMidstate( &saved, data ) != 0 )
+        return 0;
+    
+    // A rotated or replaced log is a different inode, even at the same path.
+    const byte *info = data + MIDSTATE_BYTES;
+    if ( getLittle( info, 4 ) != SIDECAR_VERSION ||
+         getLittle( info + 4, 8 ) != (unsigned long long) st->st_dev ||
+         getLittle( info + 12, 8 ) != (unsigned long long) st->st_ino ||
+         saved.length > (unsigned long long) st->st_size )
+        return 0;
+    
+    // One rewritten in place should at least differ near the end of the prefix.
+    byte fingerprint[ DIGEST_BYTES ];
+    if ( tailFingerprint( fd, saved.length, fingerprint ) != 0 ||
+         memcmp( fingerprint, info + 20, DIGEST_BYTES ) != 0 )
+        return 0;
+    
+    *ctx = saved;
+    return 1;
+}
+
+/**
+    Reports a sidecar that couldn't be written.  The digest doesn't depend on
+    it, so this is only a warning; the next run just reads more of the file.
+    
+    @param sidecar name of the sidecar
+    @param status what saveSidecar() returned
+    @return true if the sidecar was saved
+  */
+static int checkSave( const char *sidecar, int status )
+{
+    if ( status != 0 )
+        fprintf( stderr, "%s: can't save midstate: %s\n", sidecar, strerror( errno ) );
+    return status == 0;
+}
+
+/**
+    Computes the digest of an append-only file, keeping a sidecar midstate
+    next to it (its name plus MIDSTATE_SUFFIX).  If the sidecar was saved for
+    this file (same device and inode) and the end of the prefix it describes
+    still matches, only the bytes after that prefix are read; otherwise the
+    file is hashed from the start.  The sidecar is brought up to date as the
+    file is read, so an interrupted run picks up close to where it stopped.
+    If it can't be written, that's reported on stderr and the digest is
+    still computed.  A FileHasher.
+    
+    @param filename name of the file
+    @param digest storage for the digest
+    @return 0 on success, -1 with errno set if the file can't be read
+  */
+int hashFileAppending( const char *filename, byte digest[ DIGEST_BYTES ] )
+{
+    int fd = open( filename, O_RDONLY );
+    if ( fd < 0 )
+        return -1;
+    
+    // Only a regular file can be picked up where it was left.
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) ) {
+        int status = hashStream( fd, digest );
+        int err = errno;
+        close( fd );
+        errno = err;
+        return status;
+    }
+    
+    size_t nameLen = strlen( filename );
+    char *sidecar = (char *) malloc( nameLen + sizeof( MIDSTATE_SUFFIX ) );
+    byte *chunk = (byte *) malloc( STREAM_CHUNK_BYTES );
+    if ( !sidecar || !chunk ) {
+        free( sidecar );
+        free( chunk );
+        close( fd );
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy( sidecar, filename, nameLen );
+    memcpy( sidecar + nameLen, MIDSTATE_SUFFIX, sizeof( MIDSTATE_SUFFIX ) );
+    
+    HashContext ctx;
+    if ( !loadSidecar( sidecar, fd, &st, &ctx ) )
+        initContext( &ctx );
+    
+    // Cleared once the sidecar can't be written, so that's only reported once.
+    int saving = 1;
+    
+    int status = lseek( fd, ctx.length, SEEK_SET ) < 0 ? -1 : 0;
+    unsigned long long checkpoint = ctx.length + MIDSTATE_CHECKPOINT_BYTES;
+    
+    while ( status == 0 ) {
+        ssize_t len = read( fd, chunk, STREAM_CHUNK_BYTES );
+        
+        if ( len < 0 ) {
+            if ( errno != EINTR )
+                status = -1;
+            continue;
+        }
+        
+        if ( len == 0 )
+            break;
+        
+        STATS_ADD( COUNT_BYTES_READ, len );
+        updateContext( &ctx, chunk, len );
+        
+        if ( saving && ctx.length >= checkpoint ) {
+            saving = checkSave( sidecar, saveSidecar( sidecar, fd, &st, &ctx ) );
+            checkpoint = ctx.length + MIDSTATE_CHECKPOINT_BYTES;
+        }
+    }
+    
+    // The sidecar gets the state before padding, ready for the next append.
+    if ( status == 0 && saving )
+        checkSave( sidecar, saveSidecar( sidecar, fd, &st, &ctx ) );
+    if ( status == 0 )
+        finishContext( &ctx, digest );
+    
+    int err = errno;
+    free( sidecar );
+    free( chunk );
+    close( fd );
+    errno = err;
+    
+    return status;
+}
@@ -0,0 +1,94 @@
+/** 
+    @filename midstate.h
+    @author Will Greene (wgreene)
+    
+    Header file for midstate.c
+*/
+#ifndef _MIDSTATE_H_
+#define _MIDSTATE_H_
+
+#include "ripeMD.h"
+
+/** First four bytes of every exported midstate. */
+#define MIDSTATE_MAGIC "RMDS"
+
+/** Layout version of an exported midstate. */
+#define MIDSTATE_VERSION 1
+
+/** Size of an exported midstate: magic, version, A through E, the message
+    length, the partial block's length and the partial block. */
+#define MIDSTATE_BYTES ( 4 + 4 + DIGEST_BYTES + 8 + 4 + BLOCK_BYTES )
+
+/** Added to a file's name to get the name of its sidecar midstate. */
+#define MIDSTATE_SUFFIX ".rmdstate"
+
+/** Layout version of a sidecar.  Version 1 sidecars were a bare midstate. */
+#define SIDECAR_VERSION 2
+
+/** Most bytes at the end of the hashed prefix that a sidecar fingerprints. */
+#define SIDECAR_TAIL_BYTES 4096
+
+/** Size of a sidecar: a midstate, then the sidecar version, the file's
+    device and inode numbers, and a digest of the end of the hashed prefix. */
+#define SIDECAR_BYTES ( MIDSTATE_BYTES + 4 + 8 + 8 + DIGEST_BYTES )
+
+/** While hashing a file, its sidecar is rewritten after every this many
+    bytes, so an interrupted run loses at most this much work. */
+#define MIDSTATE_CHECKPOINT_BYTES ( 256ULL * 1024 * 1024 )
+
+/**
+    Writes a context out in a portable form: every field little endian,
+    whatever the host, so a midstate can be moved between machines.
+    
+    @param ctx HashContext address
+    @param out storage for the exported midstate
+  */
+void exportMidstate( const HashContext *ctx, byte out[ MIDSTATE_BYTES ] );
+
+/**
+    Restores a context written by exportMidstate(), after checking that it's
+    a midstate of this version and that its fields agree with each other.
+    
+    @param ctx HashContext address, left alone on failure
+    @param in the exported midstate
+    @return 0 on success, -1 with errno set to EINVAL if it isn't valid
+  */
+int importMidstate( HashContext *ctx, const byte in[ MIDSTATE_BYTES ] );
+
+/**
+    Exports a context into the named file.  The file is replaced atomically,
+    so a crash leaves either the old midstate or the new one.
+    
+    @param path name of the file
+    @param ctx HashContext address
+    @return 0 on success, -1 with errno set on failure
+  */
+int saveMidstate( const char *path, const HashContext *ctx );
+
+/**
+    Restores a context from a file written by saveMidstate().
+    
+    @param path name of the file
+    @param ctx HashContext address, left alone on failure
+    @return 0 on success, -1 with errno set on failure, EINVAL if the file
+            isn't a valid midstate
+  */
+int loadMidstate( const char *path, HashContext *ctx );
+
+/**
+    Computes the digest of an append-only file, keeping a sidecar midstate
+    next to it (its name plus MIDSTATE_SUFFIX).  If the sidecar was saved for
+    this file (same device and inode) and the end of the prefix it describes
+    still matches, only the bytes after that prefix are read; otherwise the
+    file is hashed from the start.  The sidecar is brought up to date as the
+    file is read, so an interrupted run picks up close to where it stopped.
+    If it can't be written, that's reported on stderr and the digest is
+    still computed.  A FileHasher.
+    
+    @param filename name of the file
+    @param digest storage for the digest
+    @return 0 on success, -1 with errno set if the file can't be read
+  */
+int hashFileAppending( const char *filename, byte digest[ DIGEST_BYTES ] );
+
+#endif
@@ -0,0 +1,132 @@
+/** 
+    @filename outputBuffer.c
+    @author Will Greene (wgreene)
+    
+    Contains a buffered writer for large amounts of output, written out with
+    write() instead of stdio.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "outputBuffer.h"
+#include "stats.h"
+
+/**
+    Creates an empty output buffer writing to the given file descriptor.
+    
+    @param fd where the output goes
+    @return new OutputBuffer, or NULL if there's no memory for it
+  */
+OutputBuffer *createOutput( int fd )
+{
+    OutputBuffer *out = (OutputBuffer *) malloc( sizeof( OutputBuffer ) );
+    
+    if ( out ) {
+        out->fd = fd;
+        out->len = 0;
+        out->error = 0;
+    }
+    
+    return out;
+}
+
+/**
+    Writes n bytes to the output's file descriptor, retrying short writes.
+    Once a write has failed, nothing more is written.
+    
+    @param out OutputBuffer address
+    @param data bytes to write
+    @param n number of bytes to write
+  */
+static void writeAll( OutputBuffer *out, const byte *data, size_t n )
+{
+    STATS_START( timer );
+    while ( n > 0 && !out->error ) {
+        ssize_t done = write( out->fd, data, n );
+        if ( done < 0 && errno == EINTR )
+            continue;
+        if ( done < 0 ) {
+            out->error = errno;
+            break;
+        }
+        
+        data += done;
+        n -= done;
+    }
+    STATS_STOP( timer, STAGE_OUTPUT );
+}
+
+/**
+    Writes out everything in the buffer.
+    
+    @param out OutputBuffer address
+    @return 0 on success, or -1 with errno set if any write has failed
+  */
+int flushOutput( OutputBuffer *out )
+{
+    writeAll( out, out->data, out->len );
+    out->len = 0;
+    
+    if ( out->error ) {
+        errno = out->error;
+        return -1;
+    }
+    
+    return 0;
+}
+
+/**
+    Adds n bytes to the output, writing out the buffer first if they don't fit.
+    
+    @param out OutputBuffer address
+    @param data bytes to add
+    @param n number of bytes to add
+  */
+void putBytes( OutputBuffer *out, const void *data, size_t n )
+{
+    if ( out->len + n > OUTPUT_BUFFER_BYTES ) {
+        flushOutput( out );
+        
+        // Too big to be worth copying; send it straight out.
+        if ( n > OUTPUT_BUFFER_BYTES ) {
+            writeAll( out, (const byte *) data, n );
+            return;
+        }
+    }
+    
+    memcpy( out->data + out->len, data, n );
+    out->len += n;
+}
+
+/**
+    Adds a digest to the output, formatted straight into the buffer.
+    
+    @param out OutputBuffer address
+    @param format how to write the digest
+    @param digest digest to add
+  */
+void putDigest( OutputBuffer *out, DigestFormat format, const byte digest[ DIGEST_BYTES ] )
+{
+    if ( out->len + MAX_FORMATTED_DIGEST > OUTPUT_BUFFER_BYTES )
+        flushOutput( out );
+    
+    out->len += formatDigest( format, digest, (char *) out->data + out->len );
+}
+
+/**
+    Writes out what's left in the buffer and frees it.
+    
+    @param out OutputBuffer address
+    @return 0 on success, or -1 with errno set if any write has failed
+  */
+int freeOutput( OutputBuffer *out )
+{
+    int status = flushOutput( out );
+    int err = errno;
+    
+    free( out );
+    errno = err;
+    return status;
+}
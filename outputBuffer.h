@@ -0,0 +1,75 @@
+/** 
+    @filename outputBuffer.h
+    @author Will Greene (wgreene)
+    
+    Header file for outputBuffer.c
+*/
+#ifndef _OUTPUT_BUFFER_H_
+#define _OUTPUT_BUFFER_H_
+
+#include "ripeMD.h"
+#include "digestFormat.h"
+
+/** Number of bytes collected before they're written out. */
+#define OUTPUT_BUFFER_BYTES ( 1024 * 1024 )
+
+/** Output collected in memory and written to a file descriptor in large
+    pieces, so printing millions of digests doesn't cost a system call or a
+    trip through stdio for each one. */
+typedef struct {
+  /** File descriptor the output goes to. */
+  int fd;
+  
+  /** Number of bytes waiting in data. */
+  size_t len;
+  
+  /** errno from the first failed write, or 0. */
+  int error;
+  
+  /** Bytes not yet written. */
+  byte data[ OUTPUT_BUFFER_BYTES ];
+} OutputBuffer;
+
+/**
+    Creates an empty output buffer writing to the given file descriptor.
+    
+    @param fd where the output goes
+    @return new OutputBuffer, or NULL if there's no memory for it
+  */
+OutputBuffer *createOutput( int fd );
+
+/**
+    Adds n bytes to the output, writing out the buffer first if they don't fit.
+    
+    @param out OutputBuffer address
+    @param data bytes to add
+    @param n number of bytes to add
+  */
+void putBytes( OutputBuffer *out, const void *data, size_t n );
+
+/**
+    Adds a digest to the output, formatted straight into the buffer.
+    
+    @param out OutputBuffer address
+    @param format how to write the digest
+    @param digest digest to add
+  */
+void putDigest( OutputBuffer *out, DigestFormat format, const byte digest[ DIGEST_BYTES ] );
+
+/**
+    Writes out everything in the buffer.
+    
+    @param out OutputBuffer address
+    @return 0 on success, or -1 with errno set if any write has failed
+  */
+int flushOutput( OutputBuffer *out );
+
+/**
+    Writes out what's left in the buffer and frees it.
+    
+    @param out OutputBuffer address
+    @return 0 on success, or -1 with errno set if any write has failed
+  */
+int freeOutput( OutputBuffer *out );
+
+#endif
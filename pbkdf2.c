@@ -0,0 +1,310 @@
+/** 
+    @filename pbkdf2.c
+    @author Will Greene (wgreene)
+    
+    Contains functions that derive keys with PBKDF2-HMAC-RIPEMD160.  After
+    the first, every iteration is an HMAC of a 20-byte message: one block
+    for the inner hash and one for the outer, both laid out the same way.
+    So each iteration is exactly two compressions, run for a full set of
+    lanes at a time.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "pbkdf2.h"
+#include "hmac.h"
+#include "stats.h"
+
+/** Number of bytes in the block index appended to the salt. */
+#define INDEX_BYTES 4
+
+/** One block of derived key: a password's prepared key and where its block
+    goes. */
+typedef struct {
+  /** Password, prepared as an HMAC key. */
+  const HmacKey *key;
+  
+  /** Block number, counting from 1. */
+  unsigned long index;
+  
+  /** Where this block of the derived key goes. */
+  byte *out;
+  
+  /** Number of bytes of the block wanted, up to DIGEST_BYTES. */
+  size_t outBytes;
+} KeyBlock;
+
+/**
+    The block every iteration hashes, for both the inner and the outer
+    hash: 20 bytes of message, then the padding for an 84-byte message (the
+    key block plus a digest).  Only the first 20 bytes ever change.
+    
+    @param block block to fill in
+  */
+static void layoutIterationBlock( byte block[ BLOCK_BYTES ] )
+{
+    memset( block, 0, BLOCK_BYTES );
+    block[ DIGEST_BYTES ] = LAST_BYTE_IN_LAST_BLOCK;
+    
+    unsigned long long bits = ( BLOCK_BYTES + DIGEST_BYTES ) * 8ULL;
+    for ( int i = 0; i < LENGTH_BYTES; i++ )
+        block[ BLOCK_BYTES - LENGTH_BYTES + i ] = bits >> ( 8 * i );
+}
+
+/**
+    Computes the first iteration for a block: the HMAC of the salt followed
+    by the block number, big endian.  This is the only message of variable
+    length, so it's done one block at a time with a HashContext.
+    
+    @param key password, prepared as an HMAC key
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param index block number
+    @param u storage for the first iteration's result
+  */
+static void firstIteration( const HmacKey *key, const byte *salt, size_t saltLen,
+                            unsigned long index, byte u[ DIGEST_BYTES ] )
+{
+    byte counter[ INDEX_BYTES ] = { index >> 24, index >> 16, index >> 8, index };
+    
+    HashContext ctx;
+    ctx.state = key->inner;
+    ctx.partialLen = 0;
+    ctx.length = BLOCK_BYTES;
+    updateContext( &ctx, salt, saltLen );
+    updateContext( &ctx, counter, INDEX_BYTES );
+    finishContext( &ctx, u );
+    
+    ctx.state = key->outer;
+    ctx.length = BLOCK_BYTES;
+    updateContext( &ctx, u, DIGEST_BYTES );
+    finishContext( &ctx, u );
+}
+
+/**
+    Runs one compression in every lane, then writes each lane's result
+    over the message bytes of its block, ready for the next hash.
+    
+    @param engine multi-lane engine to use
+    @param start chaining values to start from
+    @param blocks each lane's block
+    @param count number of lanes in use
+  */
+static void compressIteration( const LaneEngine *engine, const LaneState *start,
+                               byte blocks[][ BLOCK_BYTES ], int count )
+{
+    LaneState state = *start;
+    const byte *ptrs[ MAX_LANES ];
+    for ( int lane = 0; lane < engine->lanes; lane++ )
+        ptrs[ lane ] = blocks[ lane ];
+    
+    engine->compress( &state, ptrs );
+    STATS_ADD( COUNT_BLOCKS, count );
+    
+    for ( int lane = 0; lane < engine->lanes; lane++ ) {
+        HashState result;
+        getLane( &state, lane, &result );
+        writeDigest( &result, blocks[ lane ] );
+    }
+}
+
+/**
+    Computes one derived key block on its own, with the single-message
+    kernel.  Faster than filling the lanes with copies when there's nothing
+    to run beside it.
+    
+    @param job the block to compute
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count
+  */
+static void deriveBlock( const KeyBlock *job, const byte *salt, size_t saltLen,
+                         unsigned long iterations )
+{
+    byte block[ BLOCK_BYTES ], sum[ DIGEST_BYTES ];
+    layoutIterationBlock( block );
+    firstIteration( job->key, salt, saltLen, job->index, sum );
+    memcpy( block, sum, DIGEST_BYTES );
+    
+    for ( unsigned long i = 1; i < iterations; i++ ) {
+        HashState state = job->key->inner;
+        hashBlocks( &state, block, 1 );
+        writeDigest( &state, block );
+        
+        state = job->key->outer;
+        hashBlocks( &state, block, 1 );
+        writeDigest( &state, block );
+        
+        for ( int b = 0; b < DIGEST_BYTES; b++ )
+            sum[ b ] ^= block[ b ];
+    }
+    
+    memcpy( job->out, sum, job->outBytes );
+}
+
+/**
+    Computes a list of derived key blocks, a full set of lanes at a time.
+    Lanes past the end of the list repeat the first block of the group,
+    unless it's the only one.
+    
+    @param engine multi-lane engine to use
+    @param jobs the blocks to compute
+    @param n number of blocks
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count
+  */
+static void deriveBlocks( const LaneEngine *engine, const KeyBlock *jobs, size_t n,
+                          const byte *salt, size_t saltLen, unsigned long iterations )
+{
+    byte blocks[ MAX_LANES ][ BLOCK_BYTES ];
+    byte sums[ MAX_LANES ][ DIGEST_BYTES ];
+    LaneState inner, outer;
+    
+    for ( int lane = 0; lane < engine->lanes; lane++ )
+        layoutIterationBlock( blocks[ lane ] );
+    
+    for ( size_t first = 0; first < n; first += engine->lanes ) {
+        int count = n - first < engine->lanes ? n - first : engine->lanes;
+        
+        if ( count == 1 ) {
+            deriveBlock( &jobs[ first ], salt, saltLen, iterations );
+            break;
+        }
+        
+        for ( int lane = 0; lane < engine->lanes; lane++ ) {
+            const KeyBlock *job = &jobs[ first + ( lane < count ? lane : 0 ) ];
+            setLane( &inner, lane, &job->key->inner );
+            setLane( &outer, lane, &job->key->outer );
+            
+            if ( lane < count )
+                firstIteration( job->key, salt, saltLen, job->index, sums[ lane ] );
+            else
+                memcpy( sums[ lane ], sums[ 0 ], DIGEST_BYTES );
+            memcpy( blocks[ lane ], sums[ lane ], DIGEST_BYTES );
+        }
+        
+        for ( unsigned long i = 1; i < iterations; i++ ) {
+            compressIteration( engine, &inner, blocks, count );
+            compressIteration( engine, &outer, blocks, count );
+            
+            for ( int lane = 0; lane < count; lane++ )
+                for ( int b = 0; b < DIGEST_BYTES; b++ )
+                    sums[ lane ][ b ] ^= blocks[ lane ][ b ];
+        }
+        
+        for ( int lane = 0; lane < count; lane++ )
+            memcpy( jobs[ first + lane ].out, sums[ lane ], jobs[ first + lane ].outBytes );
+    }
+}
+
+/**
+    Lists the blocks of one derived key.
+    
+    @param key password, prepared as an HMAC key
+    @param out storage for the derived key
+    @param outLen number of bytes to derive
+    @param jobs storage for the list, one entry per 20 bytes of output
+    @return number of entries
+  */
+static size_t listBlocks( const HmacKey *key, byte *out, size_t outLen, KeyBlock *jobs )
+{
+    size_t n = 0;
+    for ( size_t done = 0; done < outLen; done += DIGEST_BYTES, n++ ) {
+        jobs[ n ].key = key;
+        jobs[ n ].index = n + 1;
+        jobs[ n ].out = out + done;
+        jobs[ n ].outBytes = outLen - done < DIGEST_BYTES ? outLen - done : DIGEST_BYTES;
+    }
+    return n;
+}
+
+/**
+    Derives a key with PBKDF2-HMAC-RIPEMD160 (RFC 8018), using the given
+    engine.  The output's 20-byte blocks are independent, so they're computed
+    side by side, one per lane.
+    
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param password password bytes
+    @param passLen number of bytes in password
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count, at least 1
+    @param out storage for the derived key
+    @param outLen number of bytes to derive
+    @return 0 on success, -1 with errno set if memory runs out
+  */
+int pbkdf2Lanes( const LaneEngine *engine, const byte *password, size_t passLen,
+                 const byte *salt, size_t saltLen, unsigned long iterations,
+                 byte *out, size_t outLen )
+{
+    HmacKey key;
+    hmacInit( &key, password, passLen );
+    
+    size_t blocks = ( outLen + DIGEST_BYTES - 1 ) / DIGEST_BYTES;
+    KeyBlock *jobs = (KeyBlock *) malloc( blocks * sizeof( KeyBlock ) );
+    if ( !jobs )
+        return -1;
+    
+    deriveBlocks( engine, jobs, listBlocks( &key, out, outLen, jobs ), salt, saltLen, iterations );
+    free( jobs );
+    return 0;
+}
+
+/**
+    Derives a key with PBKDF2-HMAC-RIPEMD160, using the engine chosen by
+    activeLaneEngine().
+    
+    @param password password bytes
+    @param passLen number of bytes in password
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count, at least 1
+    @param out storage for the derived key
+    @param outLen number of bytes to derive
+    @return 0 on success, -1 with errno set if memory runs out
+  */
+int pbkdf2( const byte *password, size_t passLen, const byte *salt, size_t saltLen,
+            unsigned long iterations, byte *out, size_t outLen )
+{
+    return pbkdf2Lanes( activeLaneEngine(), password, passLen, salt, saltLen, iterations, out, outLen );
+}
+
+/**
+    Derives keys for n passwords with the same salt and iteration count,
+    using the engine chosen by activeLaneEngine().  Every block of every key
+    takes a lane, so even short keys fill all the lanes.
+    
+    @param passwords address of each password
+    @param passLens length of each password in bytes
+    @param n number of passwords
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count, at least 1
+    @param outs storage for n packed keys of outLen bytes each
+    @param outLen number of bytes to derive for each password
+    @return 0 on success, -1 with errno set if memory runs out
+  */
+int pbkdf2Batch( const byte *const passwords[], const size_t passLens[], size_t n,
+                 const byte *salt, size_t saltLen, unsigned long iterations,
+                 byte *outs, size_t outLen )
+{
+    size_t perKey = ( outLen + DIGEST_BYTES - 1 ) / DIGEST_BYTES;
+    HmacKey *keys = (HmacKey *) malloc( n * sizeof( HmacKey ) );
+    KeyBlock *jobs = (KeyBlock *) malloc( n * perKey * sizeof( KeyBlock ) );
+    if ( !keys || !jobs ) {
+        free( keys );
+        free( jobs );
+        return -1;
+    }
+    
+    size_t count = 0;
+    for ( size_t i = 0; i < n; i++ ) {
+        hmacInit( &keys[ i ], passwords[ i ], passLens[ i ] );
+        count += listBlocks( &keys[ i ], outs + i * outLen, outLen, jobs + count );
+    }
+    
+    deriveBlocks( activeLaneEngine(), jobs, count, salt, saltLen, iterations );
+    free( keys );
+    free( jobs );
+    return 0;
+}
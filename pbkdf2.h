@@ -0,0 +1,66 @@
+/** 
+    @filename pbkdf2.h
+    @author Will Greene (wgreene)
+    
+    Header file for pbkdf2.c
+*/
+#ifndef _PBKDF2_H_
+#define _PBKDF2_H_
+
+#include "ripeMDLanes.h"
+
+/**
+    Derives a key with PBKDF2-HMAC-RIPEMD160 (RFC 8018), using the given
+    engine.  The output's 20-byte blocks are independent, so they're computed
+    side by side, one per lane.
+    
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param password password bytes
+    @param passLen number of bytes in password
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count, at least 1
+    @param out storage for the derived key
+    @param outLen number of bytes to derive
+    @return 0 on success, -1 with errno set if memory runs out
+  */
+int pbkdf2Lanes( const LaneEngine *engine, const byte *password, size_t passLen,
+                 const byte *salt, size_t saltLen, unsigned long iterations,
+                 byte *out, size_t outLen );
+
+/**
+    Derives a key with PBKDF2-HMAC-RIPEMD160, using the engine chosen by
+    activeLaneEngine().
+    
+    @param password password bytes
+    @param passLen number of bytes in password
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count, at least 1
+    @param out storage for the derived key
+    @param outLen number of bytes to derive
+    @return 0 on success, -1 with errno set if memory runs out
+  */
+int pbkdf2( const byte *password, size_t passLen, const byte *salt, size_t saltLen,
+            unsigned long iterations, byte *out, size_t outLen );
+
+/**
+    Derives keys for n passwords with the same salt and iteration count,
+    using the engine chosen by activeLaneEngine().  Every block of every key
+    takes a lane, so even short keys fill all the lanes.
+    
+    @param passwords address of each password
+    @param passLens length of each password in bytes
+    @param n number of passwords
+    @param salt salt bytes
+    @param saltLen number of bytes in salt
+    @param iterations iteration count, at least 1
+    @param outs storage for n packed keys of outLen bytes each
+    @param outLen number of bytes to derive for each password
+    @return 0 on success, -1 with errno set if memory runs out
+  */
+int pbkdf2Batch( const byte *const passwords[], const size_t passLens[], size_t n,
+                 const byte *salt, size_t saltLen, unsigned long iterations,
+                 byte *outs, size_t outLen );
+
+#endif
@@ -0,0 +1,256 @@
+/** 
+    @filename perfCounters.c
+    @author Will Greene (wgreene)
+    
+    Contains hardware performance counters, read through perf_event_open(),
+    for seeing what the compression kernels cost in cycles, instructions,
+    mispredicted branches and cache misses.  Builds for other systems, and
+    kernels or virtual machines that don't expose the counters, just report
+    them as unavailable.
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfCounters.h"
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/** Hardware event behind each PerfEvent. */
+static const unsigned long long eventConfig[ NUM_PERF_EVENTS ] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+};
+
+/**
+    Opens a counter for one hardware event.  It starts disabled, counts only
+    user space, and is inherited by threads created after it's opened.
+    
+    @param config which hardware event
+    @return file descriptor for the counter, or -1 on error
+  */
+static int openEvent( unsigned long long config )
+{
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size = sizeof( attr );
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    
+    return (int) syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+/**
+    Opens a counter for each event, covering this process and any threads it
+    starts afterward, in user space only.  Events the CPU or kernel can't
+    count are left closed and reported as missing in each reading.
+    
+    @param counters counters to open
+    @return 0 if at least the cycle or instruction counter opened, -1 (with
+            errno set) if hardware counters aren't available at all
+  */
+int openPerfCounters( PerfCounters *counters )
+{
+    int error = 0;
+    for ( int e = 0; e < NUM_PERF_EVENTS; e++ ) {
+        counters->fd[ e ] = openEvent( eventConfig[ e ] );
+        if ( counters->fd[ e ] < 0 && !error )
+            error = errno;
+    }
+    
+    // The kernel says ENOENT when there's no PMU to count an event with, as
+    // in most virtual machines; "no such device" explains that better.
+    if ( error == ENOENT )
+        error = ENODEV;
+    
+    if ( counters->fd[ PERF_CYCLES ] < 0 && counters->fd[ PERF_INSTRUCTIONS ] < 0 ) {
+        closePerfCounters( counters );
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+    Zeroes the open counters and starts them counting.
+    
+    @param counters open counters
+  */
+void startPerfCounters( PerfCounters *counters )
+{
+    for ( int e = 0; e < NUM_PERF_EVENTS; e++ )
+        if ( counters->fd[ e ] >= 0 ) {
+            ioctl( counters->fd[ e ], PERF_EVENT_IOC_RESET, 0 );
+            ioctl( counters->fd[ e ], PERF_EVENT_IOC_ENABLE, 0 );
+        }
+}
+
+/**
+    Stops the counters and reads them.
+    
+    @param counters running counters
+    @param reading storage for the counts
+  */
+void stopPerfCounters( PerfCounters *counters, PerfReading *reading )
+{
+    for ( int e = 0; e < NUM_PERF_EVENTS; e++ )
+        if ( counters->fd[ e ] >= 0 )
+            ioctl( counters->fd[ e ], PERF_EVENT_IOC_DISABLE, 0 );
+    
+    for ( int e = 0; e < NUM_PERF_EVENTS; e++ ) {
+        // The count, then the time the counter was enabled and the time it
+        // was actually counting; they differ when there are more events than
+        // hardware counters and the kernel takes turns.
+        unsigned long long values[ 3 ];
+        reading->count[ e ] = 0;
+        reading->valid[ e ] = counters->fd[ e ] >= 0 &&
+                              read( counters->fd[ e ], values, sizeof( values ) ) == sizeof( values );
+        if ( !reading->valid[ e ] )
+            continue;
+    
+        if ( values[ 2 ] == 0 )
+            reading->valid[ e ] = values[ 1 ] == 0;
+        else
+            reading->count[ e ] = (double) values[ 0 ] * values[ 1 ] / values[ 2 ];
+    }
+}
+
+/**
+    Closes the counters.
+    
+    @param counters counters to close
+  */
+void closePerfCounters( PerfCounters *counters )
+{
+    for ( int e = 0; e < NUM_PERF_EVENTS; e++ ) {
+        if ( counters->fd[ e ] >= 0 )
+            close( counters->fd[ e ] );
+        counters->fd[ e ] = -1;
+    }
+}
+
+#else
+
+/**
+    This build has no hardware counter support.
+    
+    @param counters counters to mark closed
+    @return -1, with errno set to ENOSYS
+  */
+int openPerfCounters( PerfCounters *counters )
+{
+    for ( int e = 0; e < NUM_PERF_EVENTS; e++ )
+        counters->fd[ e ] = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+/**
+    Nothing to start without counters.
+    
+    @param counters closed counters
+  */
+void startPerfCounters( PerfCounters *counters )
+{
+}
+
+/**
+    Marks every count as unavailable.
+    
+    @param counters closed counters
+    @param reading storage for the counts
+  */
+void stopPerfCounters( PerfCounters *counters, PerfReading *reading )
+{
+    for ( int e = 0; e < NUM_PERF_EVENTS; e++ ) {
+        reading->count[ e ] = 0;
+        reading->valid[ e ] = 0;
+    }
+}
+
+/**
+    Nothing to close without counters.
+    
+    @param counters closed counters
+  */
+void closePerfCounters( PerfCounters *counters )
+{
+}
+
+#endif
+
+/**
+    Works out a ratio of two counts in a reading.
+    
+    @param reading counts to use
+    @param num event counted in the numerator
+    @param den event counted in the denominator
+    @param ratio storage for num / den
+    @return true if both counts are valid and the denominator isn't zero
+  */
+int perfRatio( const PerfReading *reading, PerfEvent num, PerfEvent den, double *ratio )
+{
+    if ( !reading->valid[ num ] || !reading->valid[ den ] || reading->count[ den ] == 0 )
+        return 0;
+    *ratio = reading->count[ num ] / reading->count[ den ];
+    return 1;
+}
+
+/**
+    Prints one figure, or n/a if it couldn't be worked out.
+    
+    @param fp stream to print to
+    @param label name for the work measured
+    @param name name of the figure
+    @param valid whether value is meaningful
+    @param value the figure
+    @param unit text printed right after the value
+  */
+static void printFigure( FILE *fp, const char *label, const char *name, int valid, double value,
+                         const char *unit )
+{
+    if ( valid )
+        fprintf( fp, "%s %-18s %12.3f%s\n", label, name, value, unit );
+    else
+        fprintf( fp, "%s %-18s %12s\n", label, name, "n/a" );
+}
+
+/**
+    Prints cycles and instructions per byte, instructions per cycle, branch
+    miss rate and cache misses for a reading, one per line, each starting
+    with a label.  Figures that couldn't be counted are printed as n/a, and
+    per-byte figures are left out if bytes is zero.
+    
+    @param fp stream to print to
+    @param label name for the work measured, such as a kernel name
+    @param reading counts to print
+    @param bytes number of bytes the work processed
+  */
+void printPerfReading( FILE *fp, const char *label, const PerfReading *reading, double bytes )
+{
+    double ratio = 0;
+    
+    if ( bytes > 0 ) {
+        printFigure( fp, label, "cycles/byte", reading->valid[ PERF_CYCLES ],
+                     reading->count[ PERF_CYCLES ] / bytes, "" );
+        printFigure( fp, label, "instructions/byte", reading->valid[ PERF_INSTRUCTIONS ],
+                     reading->count[ PERF_INSTRUCTIONS ] / bytes, "" );
+    }
+    
+    int valid = perfRatio( reading, PERF_INSTRUCTIONS, PERF_CYCLES, &ratio );
+    printFigure( fp, label, "IPC", valid, ratio, "" );
+    valid = perfRatio( reading, PERF_BRANCH_MISSES, PERF_BRANCHES, &ratio );
+    printFigure( fp, label, "branch misses", valid, ratio * 100, "%" );
+    printFigure( fp, label, "cache misses", reading->valid[ PERF_CACHE_MISSES ],
+                 reading->count[ PERF_CACHE_MISSES ], "" );
+}
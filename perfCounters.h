@@ -0,0 +1,105 @@
+/** 
+    @filename perfCounters.h
+    @author Will Greene (wgreene)
+    
+    Header file for perfCounters.c
+*/
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <stdio.h>
+
+/** Hardware events counted around a piece of work. */
+typedef enum {
+  /** CPU cycles. */
+  PERF_CYCLES,
+  
+  /** Instructions retired. */
+  PERF_INSTRUCTIONS,
+  
+  /** Branch instructions retired. */
+  PERF_BRANCHES,
+  
+  /** Branches the CPU mispredicted. */
+  PERF_BRANCH_MISSES,
+  
+  /** References that missed the last level cache. */
+  PERF_CACHE_MISSES,
+  
+  /** Number of events. */
+  NUM_PERF_EVENTS
+} PerfEvent;
+
+/** Open hardware counters, one per event. */
+typedef struct {
+  /** File descriptor for each event's counter, or -1 if it couldn't be opened. */
+  int fd[ NUM_PERF_EVENTS ];
+} PerfCounters;
+
+/** What the counters saw between startPerfCounters() and stopPerfCounters(). */
+typedef struct {
+  /** Count of each event, scaled up if the kernel only ran the counter part of the time. */
+  double count[ NUM_PERF_EVENTS ];
+  
+  /** Whether each count could be read. */
+  int valid[ NUM_PERF_EVENTS ];
+} PerfReading;
+
+/**
+    Opens a counter for each event, covering this process and any threads it
+    starts afterward, in user space only.  Events the CPU or kernel can't
+    count are left closed and reported as missing in each reading.
+    
+    @param counters counters to open
+    @return 0 if at least the cycle or instruction counter opened, -1 (with
+            errno set) if hardware counters aren't available at all
+  */
+int openPerfCounters( PerfCounters *counters );
+
+/**
+    Zeroes the open counters and starts them counting.
+    
+    @param counters open counters
+  */
+void startPerfCounters( PerfCounters *counters );
+
+/**
+    Stops the counters and reads them.
+    
+    @param counters running counters
+    @param reading storage for the counts
+  */
+void stopPerfCounters( PerfCounters *counters, PerfReading *reading );
+
+/**
+    Closes the counters.
+    
+    @param counters counters to close
+  */
+void closePerfCounters( PerfCounters *counters );
+
+/**
+    Works out a ratio of two counts in a reading.
+    
+    @param reading counts to use
+    @param num event counted in the numerator
+    @param den event counted in the denominator
+    @param ratio storage for num / den
+    @return true if both counts are valid and the denominator isn't zero
+  */
+int perfRatio( const PerfReading *reading, PerfEvent num, PerfEvent den, double *ratio );
+
+/**
+    Prints cycles and instructions per byte, instructions per cycle, branch
+    miss rate and cache misses for a reading, one per line, each starting
+    with a label.  Figures that couldn't be counted are printed as n/a, and
+    per-byte figures are left out if bytes is zero.
+    
+    @param fp stream to print to
+    @param label name for the work measured, such as a kernel name
+    @param reading counts to print
+    @param bytes number of bytes the work processed
+  */
+void printPerfReading( FILE *fp, const char *label, const PerfReading *reading, double bytes );
+
+#endif
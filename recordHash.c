@@ -0,0 +1,253 @@
+/** 
+    @filename recordHash.c
+    @author Will Greene (wgreene)
+    
+    Contains a record mode, which hashes each line or other delimited record
+    of its input separately.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "recordHash.h"
+#include "ripeMDLanes.h"
+#include "stats.h"
+
+/** The records in one piece of input, and where their digests go. */
+typedef struct {
+  /** Start of the piece of input. */
+  const byte *base;
+  
+  /** Offset of each record from base. */
+  size_t *offsets;
+  
+  /** Length of each record. */
+  size_t *lengths;
+  
+  /** Number of records. */
+  size_t n;
+  
+  /** Number of records that fit in offsets and lengths. */
+  size_t cap;
+  
+  /** Storage for n packed digests. */
+  byte *digests;
+} RecordBatch;
+
+/** One thread's share of a RecordBatch. */
+typedef struct {
+  /** The whole batch. */
+  RecordBatch *batch;
+  
+  /** Index of the first record in this share. */
+  size_t first;
+  
+  /** Number of records in this share. */
+  size_t count;
+} RecordSlice;
+
+/**
+    Hashes one thread's share of a batch.
+    
+    @param arg the RecordSlice
+    @return NULL
+  */
+static void *hashSlice( void *arg )
+{
+    RecordSlice *slice = (RecordSlice *) arg;
+    RecordBatch *batch = slice->batch;
+    
+    STATS_START( timer );
+    hashMany( batch->base, batch->offsets + slice->first, batch->lengths + slice->first,
+              slice->count, batch->digests + slice->first * DIGEST_BYTES );
+    STATS_STOP( timer, STAGE_COMPRESS );
+    return NULL;
+}
+
+/**
+    Hashes every record in the batch, splitting them evenly over up to the
+    given number of threads.
+    
+    @param batch records to hash
+    @param threads number of threads to use
+  */
+static void hashBatch( RecordBatch *batch, int threads )
+{
+    if ( threads > batch->n / MIN_RECORDS_PER_THREAD )
+        threads = batch->n / MIN_RECORDS_PER_THREAD;
+    if ( threads < 1 )
+        threads = 1;
+    
+    RecordSlice slices[ threads ];
+    pthread_t workers[ threads ];
+    int started = 0;
+    
+    for ( int t = 0; t < threads; t++ ) {
+        slices[ t ].batch = batch;
+        slices[ t ].first = batch->n * t / threads;
+        slices[ t ].count = batch->n * ( t + 1 ) / threads - slices[ t ].first;
+    }
+    
+    // The calling thread does the last share, and any a thread couldn't
+    // be started for.
+    while ( started < threads - 1 &&
+            pthread_create( &workers[ started ], NULL, hashSlice, &slices[ started ] ) == 0 )
+        started++;
+    for ( int t = started; t < threads; t++ )
+        hashSlice( &slices[ t ] );
+    
+    for ( int t = 0; t < started; t++ )
+        pthread_join( workers[ t ], NULL );
+}
+
+/**
+    Adds a record to the batch, growing its arrays if needed.
+    
+    @param batch RecordBatch address
+    @param offset offset of the record from the batch base
+    @param len length of the record
+    @return 0 on success, -1 if there's no memory
+  */
+static int addRecord( RecordBatch *batch, size_t offset, size_t len )
+{
+    if ( batch->n == batch->cap ) {
+        size_t cap = batch->cap ? batch->cap * 2 : 4096;
+        size_t *offsets = (size_t *) realloc( batch->offsets, cap * sizeof( size_t ) );
+        if ( offsets )
+            batch->offsets = offsets;
+        size_t *lengths = (size_t *) realloc( batch->lengths, cap * sizeof( size_t ) );
+        if ( lengths )
+            batch->lengths = lengths;
+        byte *digests = (byte *) realloc( batch->digests, cap * DIGEST_BYTES );
+        if ( digests )
+            batch->digests = digests;
+        
+        if ( !offsets || !lengths || !digests ) {
+            errno = ENOMEM;
+            return -1;
+        }
+        batch->cap = cap;
+    }
+    
+    batch->offsets[ batch->n ] = offset;
+    batch->lengths[ batch->n ] = len;
+    batch->n++;
+    return 0;
+}
+
+/**
+    Fills as much of the buffer as the input allows, stopping only when it's
+    full or at the end of the input.
+    
+    @param fd file to read
+    @param buffer storage for the bytes
+    @param len number of bytes wanted
+    @return number of bytes read, or -1 on error
+  */
+static ssize_t readSome( int fd, byte *buffer, size_t len )
+{
+    size_t got = 0;
+    
+    STATS_START( timer );
+    while ( got < len ) {
+        ssize_t n = read( fd, buffer + got, len - got );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            return -1;
+        if ( n == 0 )
+            break;
+        got += n;
+    }
+    STATS_STOP( timer, STAGE_READ );
+    STATS_ADD( COUNT_BYTES_READ, got );
+    
+    return got;
+}
+
+/**
+    Splits the input on the given delimiter and hashes every record.  The
+    delimiter isn't part of any record.  A final record without a delimiter
+    after it still counts, but empty input has no records.  Input is read in
+    large pieces; the records in each piece are hashed in parallel with
+    hashMany(), and their digests are passed to emit in order.
+    
+    @param fd file to read records from
+    @param delim byte that ends each record, such as '\n' or '\0'
+    @param threads number of threads to use
+    @param emit function given each batch of digests
+    @param arg passed through to emit
+    @return 0 on success, -1 with errno set if the input can't be read
+  */
+int hashRecords( int fd, byte delim, int threads, RecordDigests emit, void *arg )
+{
+    size_t cap = RECORD_BUFFER_BYTES;
+    byte *buffer = (byte *) malloc( cap );
+    RecordBatch batch = { buffer, NULL, NULL, 0, 0, NULL };
+    size_t held = 0;
+    int status = 0;
+    
+    if ( !buffer )
+        return -1;
+    
+    for ( ;; ) {
+        ssize_t got = readSome( fd, buffer + held, cap - held );
+        if ( got < 0 ) {
+            status = -1;
+            break;
+        }
+        held += got;
+        int end = held < cap;
+        
+        // Split off every complete record.
+        size_t start = 0;
+        byte *delimPos;
+        batch.n = 0;
+        while ( status == 0 &&
+                ( delimPos = (byte *) memchr( buffer + start, delim, held - start ) ) ) {
+            status = addRecord( &batch, start, delimPos - ( buffer + start ) );
+            start = delimPos - buffer + 1;
+        }
+        
+        // At the end of the input, whatever's left is the last record.
+        if ( status == 0 && end && start < held ) {
+            status = addRecord( &batch, start, held - start );
+            start = held;
+        }
+        if ( status != 0 )
+            break;
+        
+        if ( batch.n > 0 ) {
+            hashBatch( &batch, threads );
+            emit( batch.digests, batch.n, arg );
+        }
+        
+        if ( end )
+            break;
+        
+        // Keep the partial record for next time.  If it fills the whole
+        // buffer, the buffer has to grow.
+        held -= start;
+        memmove( buffer, buffer + start, held );
+        if ( held == cap ) {
+            byte *bigger = (byte *) realloc( buffer, cap * 2 );
+            if ( !bigger ) {
+                status = -1;
+                break;
+            }
+            buffer = bigger;
+            batch.base = buffer;
+            cap *= 2;
+        }
+    }
+    
+    int err = errno;
+    free( buffer );
+    free( batch.offsets );
+    free( batch.lengths );
+    free( batch.digests );
+    errno = err;
+    return status;
+}
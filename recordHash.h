@@ -0,0 +1,39 @@
+/** 
+    @filename recordHash.h
+    @author Will Greene (wgreene)
+    
+    Header file for recordHash.c
+*/
+#ifndef _RECORD_HASH_H_
+#define _RECORD_HASH_H_
+
+#include "ripeMD.h"
+
+/** Bytes of input split into records and hashed at a time.  The buffer grows
+    if a single record is longer than this. */
+#define RECORD_BUFFER_BYTES ( 4 * 1024 * 1024 )
+
+/** Fewest records worth handing to a thread of their own. */
+#define MIN_RECORDS_PER_THREAD 1024
+
+/** Function given each batch of record digests, in input order.
+    See hashRecords(). */
+typedef void (*RecordDigests)( const byte *digests, size_t n, void *arg );
+
+/**
+    Splits the input on the given delimiter and hashes every record.  The
+    delimiter isn't part of any record.  A final record without a delimiter
+    after it still counts, but empty input has no records.  Input is read in
+    large pieces; the records in each piece are hashed in parallel with
+    hashMany(), and their digests are passed to emit in order.
+    
+    @param fd file to read records from
+    @param delim byte that ends each record, such as '\n' or '\0'
+    @param threads number of threads to use
+    @param emit function given each batch of digests
+    @param arg passed through to emit
+    @return 0 on success, -1 with errno set if the input can't be read
+  */
+int hashRecords( int fd, byte delim, int threads, RecordDigests emit, void *arg );
+
+#endif
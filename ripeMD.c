@@ -4,8 +4,12 @@
     
     Contains functions for computing a RIPEMD-160 hash.
 */
+#include <string.h>
 #include "ripeMD.h"
 #include "byteBuffer.h"
+#include "ripeMDSteps.h"
+#include "digestFormat.h"
+#include "stats.h"
 
 /**
     Initializes the fields of a given HashState instance.
@@ -23,28 +27,27 @@ void initState( HashState *state )
 
 /**
     Pads the given buffer by bringing its length up to a a multiple of 64 bytes.
-    Adds byte values as described in the RIPEMD algorithm.
+    Adds byte values as described in the RIPEMD algorithm, ending with the
+    full 64-bit message length in bits.
     
     @param buffer ByteBuffer address
   */
 void padBuffer( ByteBuffer *buffer )
 {
-    longword numBits = buffer->len * BBITS;
+    STATS_START( timer );
+    unsigned long long numBits = (unsigned long long) buffer->len * BBITS;
     
-    int length = buffer->len;
+    size_t length = buffer->len;
     
     addByte( buffer, LAST_BYTE_IN_LAST_BLOCK );
         
-    for ( int i = length % BLOCK_BYTES + 1; i < ( BLOCK_BYTES - BBITS ); i++ )
+    for ( size_t i = ( length + 1 ) % BLOCK_BYTES; i != BLOCK_BYTES - LENGTH_BYTES; i = ( i + 1 ) % BLOCK_BYTES )
         addByte( buffer, 0 );
         
-    addByte( buffer, ( numBits & 0x000000FF ) >> BBITS * 0 );
-    addByte( buffer, ( numBits & 0x0000FF00 ) >> BBITS * 1 );
-    addByte( buffer, ( numBits & 0x00FF0000 ) >> BBITS * 2 );
-    addByte( buffer, ( numBits & 0xFF000000 ) >> BBITS * 3 );
+    for ( int i = 0; i < LENGTH_BYTES; i++ )
+        addByte( buffer, ( numBits >> ( i * BBITS ) ) & 0xFF );
     
-    for ( int i = 0; i < 4; i++ )
-        addByte( buffer, 0 );
+    STATS_STOP( timer, STAGE_PAD );
 }
 
 /**
@@ -55,13 +58,9 @@ void padBuffer( ByteBuffer *buffer )
   */
 void printHash( HashState *state )
 {
-    PRINT_STATE_REVERSED( state->A );
-    PRINT_STATE_REVERSED( state->B );
-    PRINT_STATE_REVERSED( state->C );
-    PRINT_STATE_REVERSED( state->D );
-    PRINT_STATE_REVERSED( state->E );
-    
-    printf( "\n" );
+    byte digest[ DIGEST_BYTES ];
+    writeDigest( state, digest );
+    printDigest( digest );
 }
 
 /**
@@ -217,14 +216,15 @@ static void hashRound( HashState *state, longword data[ BLOCK_LONGWORDS ], int p
 }
 
 /**
-    Processes the given block of 64 bytes. The given state is the input state for 
-    processing the block, and it’s used as the output state for returning the resulting 
-    A, B, C, D and E values after the block is processed. Calls hashRound().
+    Reference version of the RIPEMD compression function, run over one block
+    of 16 longwords, updating the given state. Calls hashRound().  This is
+    the straightforward table-driven version of the algorithm, kept so the
+    specialized kernel can be checked against it.
     
     @param state HashState address
-    @param block array of longwords to be manipulated
+    @param longwordArray the block, already converted to longwords
   */
-void hashBlock( HashState *state, byte block[ BLOCK_BYTES ] )
+static void compressReference( HashState *state, longword longwordArray[ BLOCK_LONGWORDS ] )
 {
     int leftPerm0[ RIPE_ITERATIONS ] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
     int leftPerm1[ RIPE_ITERATIONS ] = { 7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8 };
@@ -265,13 +265,6 @@ void hashBlock( HashState *state, byte block[ BLOCK_BYTES ] )
     BitwiseFunction leftBitwise[ NUM_BITWISE_FUNCTIONS ] = { bitwiseF0, bitwiseF1, bitwiseF2, bitwiseF3, bitwiseF4 };
     BitwiseFunction rightBitwise[ NUM_BITWISE_FUNCTIONS ] = { bitwiseF4, bitwiseF3, bitwiseF2, bitwiseF1, bitwiseF0 };
     
-    longword longwordArray[ RIPE_ITERATIONS ] = {};
-    
-    for ( int i = 0; i < RIPE_ITERATIONS; i++ ) {
-        for ( int j = 0; j < sizeof( longword ); j++ )
-            longwordArray[ i ] = longwordArray[ i ] | ( block[ sizeof( longword ) * i + j ] << ( j * BBITS ) );
-    }
-    
     HashState leftSideRound = { state->A, state->B, state->C, state->D, state->E };
     HashState rightSideRound = { state->A, state->B, state->C, state->D, state->E };
             
@@ -295,6 +288,448 @@ void hashBlock( HashState *state, byte block[ BLOCK_BYTES ] )
     state->E =   temp   + leftSideRound.B + rightSideRound.C;
 }
 
+/**
+    Specialized version of the RIPEMD compression function.  All 160 iterations
+    are unrolled (see ripeMDSteps.h), so every message index, shift and constant
+    is known at compile time, and the left and right lines are interleaved so
+    their independent work can overlap.
+    
+    @param h the five chaining values, updated in place
+    @param block 64 bytes of message, with no alignment requirement
+  */
+static inline void compressUnrolled( longword h[ 5 ], const byte *block )
+{
+    longword X[ BLOCK_LONGWORDS ];
+    for ( int i = 0; i < BLOCK_LONGWORDS; i++ )
+        X[ i ] = loadLittleEndian( block + sizeof( longword ) * i );
+    
+    longword al = h[ 0 ], bl = h[ 1 ], cl = h[ 2 ], dl = h[ 3 ], el = h[ 4 ];
+    longword ar = h[ 0 ], br = h[ 1 ], cr = h[ 2 ], dr = h[ 3 ], er = h[ 4 ];
+    
+    RIPEMD_STEPS( X );
+    
+    longword temp = h[ 0 ];
+    h[ 0 ] = h[ 1 ] + cl + dr;
+    h[ 1 ] = h[ 2 ] + dl + er;
+    h[ 2 ] = h[ 3 ] + el + ar;
+    h[ 3 ] = h[ 4 ] + al + br;
+    h[ 4 ] =  temp  + bl + cr;
+}
+
+/**
+    Processes the given block of 64 bytes. The given state is the input state for 
+    processing the block, and it’s used as the output state for returning the resulting 
+    A, B, C, D and E values after the block is processed.
+    
+    @param state HashState address
+    @param block array of longwords to be manipulated
+  */
+void hashBlock( HashState *state, const byte block[ BLOCK_BYTES ] )
+{
+    hashBlocks( state, block, 1 );
+}
+
+/**
+    Runs the unrolled kernel over nblocks consecutive blocks. The chaining state
+    is kept in locals for the whole run and only written back at the end. This
+    gets inlined into each of the scalar kernels below, so each one is compiled
+    for its own instruction set.
+    
+    @param state HashState address
+    @param data first byte of the first block
+    @param nblocks number of blocks to process
+  */
+static inline void unrolledBlocks( HashState *state, const byte *data, size_t nblocks )
+{
+    longword h[ 5 ] = { state->A, state->B, state->C, state->D, state->E };
+    
+    for ( size_t b = 0; b < nblocks; b++ ) {
+        compressUnrolled( h, data );
+        data += BLOCK_BYTES;
+    }
+    
+    state->A = h[ 0 ];
+    state->B = h[ 1 ];
+    state->C = h[ 2 ];
+    state->D = h[ 3 ];
+    state->E = h[ 4 ];
+}
+
+/**
+    The unrolled kernel, built for the baseline instruction set.
+    
+    @param state HashState address
+    @param data first byte of the first block
+    @param nblocks number of blocks to process
+  */
+static void hashBlocksUnrolled( HashState *state, const byte *data, size_t nblocks )
+{
+    unrolledBlocks( state, data, nblocks );
+}
+
+/**
+    Every kernel in the baseline instruction set can run anywhere.
+    
+    @return true
+  */
+static int supportsBaseline( void )
+{
+    return 1;
+}
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+/**
+    The unrolled kernel, built to use BMI2's non-destructive rotate (rorx),
+    which saves a register copy on most of the rotates.
+    
+    @param state HashState address
+    @param data first byte of the first block
+    @param nblocks number of blocks to process
+  */
+static __attribute__(( target( "bmi2" ) )) void hashBlocksBmi2( HashState *state, const byte *data,
+                                                               size_t nblocks )
+{
+    unrolledBlocks( state, data, nblocks );
+}
+
+/**
+    Reports whether the CPU supports BMI2.
+    
+    @return true if the BMI2 kernel can run
+  */
+static int supportsBmi2( void )
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "bmi2" );
+}
+
+#endif
+
+const BlockKernel blockKernels[] = {
+    { "reference", supportsBaseline, hashBlocksReference },
+    { "unrolled", supportsBaseline, hashBlocksUnrolled },
+#if defined( __x86_64__ ) || defined( __i386__ )
+    { "bmi2", supportsBmi2, hashBlocksBmi2 },
+#endif
+};
+
+const int numBlockKernels = sizeof( blockKernels ) / sizeof( blockKernels[ 0 ] );
+
+/** Kernel used by hashBlocks(), or NULL until the first call picks one. */
+static const BlockKernel *activeKernel = NULL;
+
+/**
+    Makes the named kernel the one used by hashBlocks().
+    
+    @param name name of an entry in blockKernels
+    @return 0 on success, -1 if there's no such kernel or the CPU can't run it
+  */
+int selectBlockKernel( const char *name )
+{
+    for ( int i = 0; i < numBlockKernels; i++ ) {
+        if ( strcmp( blockKernels[ i ].name, name ) == 0 && blockKernels[ i ].supported() ) {
+            __atomic_store_n( &activeKernel, &blockKernels[ i ], __ATOMIC_RELEASE );
+            return 0;
+        }
+    }
+    
+    return -1;
+}
+
+/**
+    Returns the kernel used by hashBlocks(), choosing one on the first call:
+    the one named by the RIPEMD_KERNEL environment variable if it's usable,
+    otherwise the fastest one the CPU supports.
+    
+    @return the active kernel
+  */
+const BlockKernel *activeBlockKernel( void )
+{
+    const BlockKernel *kernel = __atomic_load_n( &activeKernel, __ATOMIC_ACQUIRE );
+    if ( kernel )
+        return kernel;
+    
+    const char *forced = getenv( KERNEL_ENV_VAR );
+    if ( forced && selectBlockKernel( forced ) == 0 )
+        return activeKernel;
+    
+    // The table is ordered from slowest to fastest.
+    for ( int i = numBlockKernels - 1; i >= 0; i-- ) {
+        if ( blockKernels[ i ].supported() ) {
+            kernel = &blockKernels[ i ];
+            break;
+        }
+    }
+    
+    __atomic_store_n( &activeKernel, kernel, __ATOMIC_RELEASE );
+    return kernel;
+}
+
+/**
+    Processes nblocks consecutive 64-byte blocks, straight out of the caller's
+    memory. The data doesn't need any particular alignment. Runs the kernel
+    chosen by activeBlockKernel().
+    
+    @param state HashState address
+    @param data first byte of the first block
+    @param nblocks number of blocks to process
+  */
+void hashBlocks( HashState *state, const byte *data, size_t nblocks )
+{
+    activeBlockKernel()->blocks( state, data, nblocks );
+    STATS_ADD( COUNT_BLOCKS, nblocks );
+}
+
+/**
+    Same as hashBlocks(), but using the reference implementation of the
+    compression function built on hashRound().  It's much slower; it's here
+    for checking the specialized kernel.
+    
+    @param state HashState address
+    @param data first byte of the first block
+    @param nblocks number of blocks to process
+  */
+void hashBlocksReference( HashState *state, const byte *data, size_t nblocks )
+{
+    HashState chain = *state;
+    longword words[ BLOCK_LONGWORDS ];
+    
+    for ( size_t b = 0; b < nblocks; b++ ) {
+        for ( int i = 0; i < BLOCK_LONGWORDS; i++ )
+            words[ i ] = loadLittleEndian( data + sizeof( longword ) * i );
+        
+        compressReference( &chain, words );
+        data += BLOCK_BYTES;
+    }
+    
+    *state = chain;
+}
+
+/**
+    Initializes a streaming hash context, ready to receive message bytes.
+    
+    @param ctx HashContext address
+  */
+void initContext( HashContext *ctx )
+{
+    initState( &ctx->state );
+    ctx->partialLen = 0;
+    ctx->length = 0;
+}
+
+/**
+    Adds len bytes of message to the given context.  Complete blocks are
+    hashed as soon as they are available; a trailing partial block is kept
+    in the context until more input arrives.
+    
+    @param ctx HashContext address
+    @param data message bytes to add
+    @param len number of bytes in data
+  */
+void updateContext( HashContext *ctx, const byte *data, size_t len )
+{
+    ctx->length += len;
+    
+    // Top up a partial block left over from the last call first.
+    if ( ctx->partialLen > 0 ) {
+        size_t fill = BLOCK_BYTES - ctx->partialLen;
+        if ( fill > len )
+            fill = len;
+        
+        memcpy( ctx->partial + ctx->partialLen, data, fill );
+        ctx->partialLen += fill;
+        data += fill;
+        len -= fill;
+        
+        if ( ctx->partialLen < BLOCK_BYTES )
+            return;
+        
+        hashBlock( &ctx->state, ctx->partial );
+        ctx->partialLen = 0;
+    }
+    
+    // Whole blocks are hashed straight out of the caller's memory.
+    size_t nblocks = len / BLOCK_BYTES;
+    hashBlocks( &ctx->state, data, nblocks );
+    data += nblocks * BLOCK_BYTES;
+    len -= nblocks * BLOCK_BYTES;
+    
+    memcpy( ctx->partial, data, len );
+    ctx->partialLen = len;
+}
+
+/**
+    Builds the padded final block or blocks of a message: the last restLen
+    bytes that don't fill a whole block, then the 0x80 byte, zeros, and the
+    64-bit message length in bits.
+    
+    @param tail storage for up to two blocks of output
+    @param rest the message bytes after the last whole block
+    @param restLen number of bytes in rest, less than BLOCK_BYTES
+    @param totalLen length of the whole message in bytes
+    @return number of blocks written to tail, 1 or 2
+  */
+int padFinalBlocks( byte tail[ 2 * BLOCK_BYTES ], const byte *rest, size_t restLen,
+                    unsigned long long totalLen )
+{
+    unsigned long long numBits = totalLen * BBITS;
+    
+    memmove( tail, rest, restLen );
+    tail[ restLen++ ] = LAST_BYTE_IN_LAST_BLOCK;
+    
+    // If there's no room left for the length, it goes in an extra block.
+    int blocks = restLen > BLOCK_BYTES - LENGTH_BYTES ? 2 : 1;
+    size_t end = blocks * BLOCK_BYTES;
+    
+    memset( tail + restLen, 0, end - LENGTH_BYTES - restLen );
+    for ( int i = 0; i < LENGTH_BYTES; i++ )
+        tail[ end - LENGTH_BYTES + i ] = ( numBits >> ( i * BBITS ) ) & 0xFF;
+    
+    return blocks;
+}
+
+/**
+    Writes the given state out as a digest: A through E, each least
+    significant byte first.
+    
+    @param state HashState address
+    @param digest storage for the resulting digest
+  */
+void writeDigest( const HashState *state, byte digest[ DIGEST_BYTES ] )
+{
+    longword words[] = { state->A, state->B, state->C, state->D, state->E };
+    for ( int i = 0; i < DIGEST_BYTES; i++ )
+        digest[ i ] = ( words[ i / sizeof( longword ) ] >> ( ( i % sizeof( longword ) ) * BBITS ) ) & 0xFF;
+}
+
+/**
+    Pads the message held by the context and writes the final digest.  The
+    padding is computed on the fly, so no buffer ever holds the whole message.
+    The context must be re-initialized before it's used again.
+    
+    @param ctx HashContext address
+    @param digest storage for the resulting 20-byte digest
+  */
+void finishContext( HashContext *ctx, byte digest[ DIGEST_BYTES ] )
+{
+    byte tail[ 2 * BLOCK_BYTES ];
+    int blocks = padFinalBlocks( tail, ctx->partial, ctx->partialLen, ctx->length );
+    
+    hashBlocks( &ctx->state, tail, blocks );
+    ctx->partialLen = 0;
+    
+    writeDigest( &ctx->state, digest );
+}
+
+/**
+    Hashes a whole message in one call, without a HashContext or any heap
+    allocation.  Messages up to 55 bytes are padded into a single block on the
+    stack and take one compression; up to 119 bytes take two.  Longer
+    messages work too, with their whole blocks hashed in place.
+    
+    @param msg message bytes
+    @param len number of bytes in msg
+    @param digest storage for the resulting 20-byte digest
+  */
+void hashShort( const byte *msg, size_t len, byte digest[ DIGEST_BYTES ] )
+{
+    HashState state;
+    initState( &state );
+    
+    size_t nblocks = len / BLOCK_BYTES;
+    if ( nblocks )
+        hashBlocks( &state, msg, nblocks );
+    
+    byte tail[ 2 * BLOCK_BYTES ];
+    int blocks = padFinalBlocks( tail, msg + nblocks * BLOCK_BYTES, len % BLOCK_BYTES, len );
+    hashBlocks( &state, tail, blocks );
+    
+    writeDigest( &state, digest );
+}
+
+/**
+    Hashes a message whose length is known at compile time.  Once this is
+    inlined with a constant len, the padding bytes, the length field and the
+    number of blocks are all constants, so only the message bytes are copied.
+    
+    @param msg message bytes
+    @param len number of bytes in msg; should be a constant
+    @param digest storage for the resulting 20-byte digest
+  */
+static inline void hashFixed( const byte *msg, size_t len, byte digest[ DIGEST_BYTES ] )
+{
+    HashState state;
+    initState( &state );
+    
+    size_t nblocks = len / BLOCK_BYTES;
+    size_t rest = len % BLOCK_BYTES;
+    int blocks = rest + 1 > BLOCK_BYTES - LENGTH_BYTES ? 2 : 1;
+    if ( nblocks )
+        hashBlocks( &state, msg, nblocks );
+    
+    byte tail[ 2 * BLOCK_BYTES ];
+    size_t end = blocks * BLOCK_BYTES;
+    memcpy( tail, msg + nblocks * BLOCK_BYTES, rest );
+    tail[ rest ] = LAST_BYTE_IN_LAST_BLOCK;
+    memset( tail + rest + 1, 0, end - rest - 1 );
+    tail[ end - LENGTH_BYTES ] = len * BBITS;
+    tail[ end - LENGTH_BYTES + 1 ] = len * BBITS >> BBITS;
+    hashBlocks( &state, tail, blocks );
+    
+    writeDigest( &state, digest );
+}
+
+/**
+    Hashes a 32-byte message, such as a SHA-256 digest, with the padding
+    laid out at compile time.
+    
+    @param msg the 32 message bytes
+    @param digest storage for the resulting 20-byte digest
+  */
+void hash32( const byte msg[ 32 ], byte digest[ DIGEST_BYTES ] )
+{
+    hashFixed( msg, 32, digest );
+}
+
+/**
+    Hashes a 33-byte message, such as a compressed public key, with the
+    padding laid out at compile time.
+    
+    @param msg the 33 message bytes
+    @param digest storage for the resulting 20-byte digest
+  */
+void hash33( const byte msg[ 33 ], byte digest[ DIGEST_BYTES ] )
+{
+    hashFixed( msg, 33, digest );
+}
+
+/**
+    Hashes a 65-byte message, such as an uncompressed public key, with the
+    padding laid out at compile time.
+    
+    @param msg the 65 message bytes
+    @param digest storage for the resulting 20-byte digest
+  */
+void hash65( const byte msg[ 65 ], byte digest[ DIGEST_BYTES ] )
+{
+    hashFixed( msg, 65, digest );
+}
+
+/**
+    Prints the given digest as a 160 bit number in hexadecimal.
+    
+    @param digest digest produced by finishContext()
+  */
+void printDigest( const byte digest[ DIGEST_BYTES ] )
+{
+    char line[ HEX_DIGEST_CHARS + 1 ];
+    formatHex( digest, line );
+    line[ HEX_DIGEST_CHARS ] = '\n';
+    
+    fwrite( line, 1, sizeof( line ), stdout );
+}
+
 // Put the following at the end of your implementation file.
 // If we're compiling for unit tests, create wrappers for the otherwise
 // private functions we'd like to be able to test.
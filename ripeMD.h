@@ -21,14 +21,6 @@ typedef unsigned int longword;
 /** Number of iterations for each round. */
 #define RIPE_ITERATIONS 16
 
-/** prints a state of HashState in reverse order */
-#define PRINT_STATE_REVERSED( state ) {                    \
-    printf( "%02x", ( state & 0x000000FF ) >> BBITS * 0 ); \
-    printf( "%02x", ( state & 0x0000FF00 ) >> BBITS * 1 ); \
-    printf( "%02x", ( state & 0x00FF0000 ) >> BBITS * 2 ); \
-    printf( "%02x", ( state & 0xFF000000 ) >> BBITS * 3 ); \
-}
-
 /** number of bitwise functions to be used */
 #define NUM_BITWISE_FUNCTIONS 5
 
@@ -38,6 +30,15 @@ typedef unsigned int longword;
 /** value of ending byte to buffer read */
 #define LAST_BYTE_IN_LAST_BLOCK 0x80
 
+/** Number of bytes at the end of the last block holding the message length. */
+#define LENGTH_BYTES 8
+
+/** Number of bytes in a finished RIPEMD-160 digest. */
+#define DIGEST_BYTES 20
+
+/** Environment variable naming a kernel to use instead of the fastest one. */
+#define KERNEL_ENV_VAR "RIPEMD_KERNEL"
+
 /** Type for a pointer to the bitwise f function used in each round. */
 typedef longword (*BitwiseFunction)( longword b, longword c, longword d );
 
@@ -63,6 +64,43 @@ typedef struct {
   
 } HashState;
 
+/** A single-message compression kernel, one of the implementations that
+    hashBlocks() can dispatch to. */
+typedef struct {
+  /** Name of the kernel, for reporting and selection. */
+  const char *name;
+  
+  /** Returns true if the CPU we're running on can execute this kernel. */
+  int (*supported)( void );
+  
+  /** Processes a run of blocks, like hashBlocks(). */
+  void (*blocks)( HashState *state, const byte *data, size_t nblocks );
+} BlockKernel;
+
+/** All the single-message kernels compiled into this build, slowest first. */
+extern const BlockKernel blockKernels[];
+
+/** Number of entries in blockKernels. */
+extern const int numBlockKernels;
+
+/** Incremental hashing context.  Wraps a HashState with enough extra
+    bookkeeping to accept input in arbitrary pieces: at most one partial
+    block is buffered, so memory use doesn't depend on the message size.
+    initContext() must be called before the first updateContext(). */
+typedef struct {
+  /** Chaining state after the last full block. */
+  HashState state;
+
+  /** Bytes of the current, not yet complete, block. */
+  byte partial[ BLOCK_BYTES ];
+
+  /** Number of bytes currently held in partial. */
+  unsigned int partialLen;
+
+  /** Total number of message bytes passed to updateContext() so far. */
+  unsigned long long length;
+} HashContext;
+
 /**
     Initializes the fields of a given HashState instance.
     
@@ -72,7 +110,8 @@ void initState( HashState *state );
 
 /**
     Pads the given buffer by bringing its length up to a a multiple of 64 bytes.
-    Adds byte values as described in the RIPEMD algorithm.
+    Adds byte values as described in the RIPEMD algorithm, ending with the
+    full 64-bit message length in bits.
     
     @param buffer ByteBuffer address
   */
@@ -89,12 +128,148 @@ void printHash( HashState *state );
 /**
     Processes the given block of 64 bytes. The given state is the input state for 
     processing the block, and it’s used as the output state for returning the resulting 
-    A, B, C, D and E values after the block is processed. Calls hashRound().
+    A, B, C, D and E values after the block is processed.
     
     @param state HashState address
     @param block array of longwords to be manipulated
   */
-void hashBlock( HashState *state, byte block[ BLOCK_BYTES ] );
+void hashBlock( HashState *state, const byte block[ BLOCK_BYTES ] );
+
+/**
+    Processes nblocks consecutive 64-byte blocks, straight out of the caller's
+    memory. The data doesn't need any particular alignment. Runs the kernel
+    chosen by activeBlockKernel().
+    
+    @param state HashState address
+    @param data first byte of the first block
+    @param nblocks number of blocks to process
+  */
+void hashBlocks( HashState *state, const byte *data, size_t nblocks );
+
+/**
+    Makes the named kernel the one used by hashBlocks().
+    
+    @param name name of an entry in blockKernels
+    @return 0 on success, -1 if there's no such kernel or the CPU can't run it
+  */
+int selectBlockKernel( const char *name );
+
+/**
+    Returns the kernel used by hashBlocks(), choosing one on the first call:
+    the one named by the RIPEMD_KERNEL environment variable if it's usable,
+    otherwise the fastest one the CPU supports.
+    
+    @return the active kernel
+  */
+const BlockKernel *activeBlockKernel( void );
+
+/**
+    Same as hashBlocks(), but using the reference implementation of the
+    compression function built on hashRound().  It's much slower; it's here
+    for checking the specialized kernel.
+    
+    @param state HashState address
+    @param data first byte of the first block
+    @param nblocks number of blocks to process
+  */
+void hashBlocksReference( HashState *state, const byte *data, size_t nblocks );
+
+/**
+    Builds the padded final block or blocks of a message: the last restLen
+    bytes that don't fill a whole block, then the 0x80 byte, zeros, and the
+    64-bit message length in bits.
+    
+    @param tail storage for up to two blocks of output
+    @param rest the message bytes after the last whole block
+    @param restLen number of bytes in rest, less than BLOCK_BYTES
+    @param totalLen length of the whole message in bytes
+    @return number of blocks written to tail, 1 or 2
+  */
+int padFinalBlocks( byte tail[ 2 * BLOCK_BYTES ], const byte *rest, size_t restLen,
+                    unsigned long long totalLen );
+
+/**
+    Writes the given state out as a digest: A through E, each least
+    significant byte first.
+    
+    @param state HashState address
+    @param digest storage for the resulting digest
+  */
+void writeDigest( const HashState *state, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Initializes a streaming hash context, ready to receive message bytes.
+    
+    @param ctx HashContext address
+  */
+void initContext( HashContext *ctx );
+
+/**
+    Adds len bytes of message to the given context.  Complete blocks are
+    hashed as soon as they are available; a trailing partial block is kept
+    in the context until more input arrives.
+    
+    @param ctx HashContext address
+    @param data message bytes to add
+    @param len number of bytes in data
+  */
+void updateContext( HashContext *ctx, const byte *data, size_t len );
+
+/**
+    Pads the message held by the context and writes the final digest.  The
+    padding is computed on the fly, so no buffer ever holds the whole message.
+    The context must be re-initialized before it's used again.
+    
+    @param ctx HashContext address
+    @param digest storage for the resulting 20-byte digest
+  */
+void finishContext( HashContext *ctx, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Hashes a whole message in one call, without a HashContext or any heap
+    allocation.  Messages up to 55 bytes are padded into a single block on the
+    stack and take one compression; up to 119 bytes take two.  Longer
+    messages work too, with their whole blocks hashed in place.
+    
+    @param msg message bytes
+    @param len number of bytes in msg
+    @param digest storage for the resulting 20-byte digest
+  */
+void hashShort( const byte *msg, size_t len, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Hashes a 32-byte message, such as a SHA-256 digest, with the padding
+    laid out at compile time.
+    
+    @param msg the 32 message bytes
+    @param digest storage for the resulting 20-byte digest
+  */
+void hash32( const byte msg[ 32 ], byte digest[ DIGEST_BYTES ] );
+
+/**
+    Hashes a 33-byte message, such as a compressed public key, with the
+    padding laid out at compile time.
+    
+    @param msg the 33 message bytes
+    @param digest storage for the resulting 20-byte digest
+  */
+void hash33( const byte msg[ 33 ], byte digest[ DIGEST_BYTES ] );
+
+/**
+    Hashes a 65-byte message, such as an uncompressed public key, with the
+    padding laid out at compile time.
+    
+    @param msg the 65 message bytes
+    @param digest storage for the resulting 20-byte digest
+  */
+void hash65( const byte msg[ 65 ], byte digest[ DIGEST_BYTES ] );
+
+/**
+    Prints the given digest as a 160 bit number in hexadecimal.
+    
+    @param digest digest produced by finishContext()
+  */
+void printDigest( const byte digest[ DIGEST_BYTES ] );
 
 // If we're compiling for test, expose a collection of wrapper
 // functions that let us (indirectly) call internal (static) functions
@@ -0,0 +1,58 @@
+/** 
+    @filename ripeMDLaneKernel.h
+    @author Will Greene (wgreene)
+    
+    Template for one multi-lane compression function.  ripeMDLanes.c includes
+    this once for each vector width, after defining:
+    
+      LANE_VECTOR    vector type holding one longword per lane
+      LANE_COUNT     number of lanes in LANE_VECTOR
+      LANE_FUNCTION  name of the function to define
+      LANE_TARGET    function attributes enabling the instruction set
+*/
+
+/**
+    Runs the compression function once for each lane, keeping the A to E
+    values of every lane in vector registers for all 160 iterations.
+    
+    @param state chaining values for each lane, updated in place
+    @param blocks address of the 64-byte block for each lane
+  */
+static LANE_TARGET void LANE_FUNCTION( LaneState *state, const byte *const blocks[] )
+{
+    // Gather message longword i of every lane into vector X[ i ].
+    LANE_VECTOR X[ BLOCK_LONGWORDS ];
+    for ( int i = 0; i < BLOCK_LONGWORDS; i++ )
+        for ( int lane = 0; lane < LANE_COUNT; lane++ )
+            X[ i ][ lane ] = loadLittleEndian( blocks[ lane ] + sizeof( longword ) * i );
+    
+    LANE_VECTOR h0, h1, h2, h3, h4;
+    memcpy( &h0, state->A, sizeof( LANE_VECTOR ) );
+    memcpy( &h1, state->B, sizeof( LANE_VECTOR ) );
+    memcpy( &h2, state->C, sizeof( LANE_VECTOR ) );
+    memcpy( &h3, state->D, sizeof( LANE_VECTOR ) );
+    memcpy( &h4, state->E, sizeof( LANE_VECTOR ) );
+    
+    LANE_VECTOR al = h0, bl = h1, cl = h2, dl = h3, el = h4;
+    LANE_VECTOR ar = h0, br = h1, cr = h2, dr = h3, er = h4;
+    
+    RIPEMD_STEPS( X );
+    
+    LANE_VECTOR temp = h0;
+    h0 = h1 + cl + dr;
+    h1 = h2 + dl + er;
+    h2 = h3 + el + ar;
+    h3 = h4 + al + br;
+    h4 = temp + bl + cr;
+    
+    memcpy( state->A, &h0, sizeof( LANE_VECTOR ) );
+    memcpy( state->B, &h1, sizeof( LANE_VECTOR ) );
+    memcpy( state->C, &h2, sizeof( LANE_VECTOR ) );
+    memcpy( state->D, &h3, sizeof( LANE_VECTOR ) );
+    memcpy( state->E, &h4, sizeof( LANE_VECTOR ) );
+}
+
+#undef LANE_VECTOR
+#undef LANE_COUNT
+#undef LANE_FUNCTION
+#undef LANE_TARGET
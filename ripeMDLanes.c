@@ -0,0 +1,650 @@
+/**
+    @filename ripeMDLanes.c
+    @author Will Greene (wgreene)
+
+    Contains multi-lane versions of the RIPEMD-160 compression function, which
+    hash several independent messages at once using SIMD instructions, and a
+    scheduler that feeds them from a list of messages.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "ripeMDLanes.h"
+#include "ripeMDSteps.h"
+#include "stats.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+/** Vector of 4 longwords, one SSE2 register. */
+typedef longword Vector4 __attribute__(( vector_size( 16 ) ));
+
+/** Vector of 8 longwords, one AVX2 register. */
+typedef longword Vector8 __attribute__(( vector_size( 32 ) ));
+
+/** Vector of 16 longwords, one AVX-512 register. */
+typedef longword Vector16 __attribute__(( vector_size( 64 ) ));
+
+#define LANE_VECTOR Vector4
+#define LANE_COUNT 4
+#define LANE_FUNCTION compressSse2
+#define LANE_TARGET __attribute__(( target( "sse2" ) ))
+#include "ripeMDLaneKernel.h"
+
+#define LANE_VECTOR Vector8
+#define LANE_COUNT 8
+#define LANE_FUNCTION compressAvx2
+#define LANE_TARGET __attribute__(( target( "avx2" ) ))
+#include "ripeMDLaneKernel.h"
+
+#define LANE_VECTOR Vector16
+#define LANE_COUNT 16
+#define LANE_FUNCTION compressAvx512
+#define LANE_TARGET __attribute__(( target( "avx512f" ) ))
+#include "ripeMDLaneKernel.h"
+
+/**
+    Reports whether the CPU supports SSE2.
+
+    @return true if the SSE2 engine can run
+  */
+static int supportsSse2( void )
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "sse2" );
+}
+
+/**
+    Reports whether the CPU supports AVX2.
+
+    @return true if the AVX2 engine can run
+  */
+static int supportsAvx2( void )
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" );
+}
+
+/**
+    Reports whether the CPU supports AVX-512 Foundation.
+
+    @return true if the AVX-512 engine can run
+  */
+static int supportsAvx512( void )
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx512f" );
+}
+
+const LaneEngine laneEngines[] = {
+    { "sse2", 4, supportsSse2, compressSse2 },
+    { "avx2", 8, supportsAvx2, compressAvx2 },
+    { "avx512", 16, supportsAvx512, compressAvx512 },
+};
+
+#else
+
+/** Vector of 4 longwords, using whatever SIMD the target has. */
+typedef longword Vector4 __attribute__(( vector_size( 16 ) ));
+
+#define LANE_VECTOR Vector4
+#define LANE_COUNT 4
+#define LANE_FUNCTION compressGeneric
+#define LANE_TARGET
+#include "ripeMDLaneKernel.h"
+
+/**
+    The generic engine runs anywhere.
+
+    @return true
+  */
+static int supportsGeneric( void )
+{
+    return 1;
+}
+
+const LaneEngine laneEngines[] = {
+    { "generic4", 4, supportsGeneric, compressGeneric },
+};
+
+#endif
+
+const int numLaneEngines = sizeof( laneEngines ) / sizeof( laneEngines[ 0 ] );
+
+/** Engine used by hashMessages(), or NULL until the first call picks one. */
+static const LaneEngine *activeEngine = NULL;
+
+/**
+    Makes the named engine the one used by hashMessages().
+
+    @param name name of an entry in laneEngines
+    @return 0 on success, -1 if there's no such engine or the CPU can't run it
+  */
+int selectLaneEngine( const char *name )
+{
+    for ( int i = 0; i < numLaneEngines; i++ ) {
+        if ( strcmp( laneEngines[ i ].name, name ) == 0 && laneEngines[ i ].supported() ) {
+            __atomic_store_n( &activeEngine, &laneEngines[ i ], __ATOMIC_RELEASE );
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+    Returns the engine used by hashMessages(), choosing one on the first call:
+    the one named by the RIPEMD_KERNEL environment variable if it's usable,
+    otherwise the widest one the CPU supports.
+
+    @return the active engine
+  */
+const LaneEngine *activeLaneEngine( void )
+{
+    const LaneEngine *engine = __atomic_load_n( &activeEngine, __ATOMIC_ACQUIRE );
+    if ( engine )
+        return engine;
+
+    const char *forced = getenv( KERNEL_ENV_VAR );
+    if ( forced && selectLaneEngine( forced ) == 0 )
+        return activeEngine;
+
+    // The table is ordered from narrowest to widest.  The first engine is
+    // the baseline for the architecture, so there's always one to fall back on.
+    engine = &laneEngines[ 0 ];
+    for ( int i = numLaneEngines - 1; i > 0; i-- ) {
+        if ( laneEngines[ i ].supported() ) {
+            engine = &laneEngines[ i ];
+            break;
+        }
+    }
+
+    __atomic_store_n( &activeEngine, engine, __ATOMIC_RELEASE );
+    return engine;
+}
+
+/**
+    Copies a HashState into the given lane of a LaneState.
+
+    @param state LaneState address
+    @param lane lane to set
+    @param value HashState to copy
+  */
+void setLane( LaneState *state, int lane, const HashState *value )
+{
+    state->A[ lane ] = value->A;
+    state->B[ lane ] = value->B;
+    state->C[ lane ] = value->C;
+    state->D[ lane ] = value->D;
+    state->E[ lane ] = value->E;
+}
+
+/**
+    Copies the given lane of a LaneState out into a HashState.
+
+    @param state LaneState address
+    @param lane lane to read
+    @param value HashState to fill in
+  */
+void getLane( const LaneState *state, int lane, HashState *value )
+{
+    value->A = state->A[ lane ];
+    value->B = state->B[ lane ];
+    value->C = state->C[ lane ];
+    value->D = state->D[ lane ];
+    value->E = state->E[ lane ];
+}
+
+/**
+    Runs an engine once, for the statistics counting only the lanes that
+    carry a message.
+
+    @param engine multi-lane engine to use
+    @param state LaneState address
+    @param blocks each lane's block
+    @param active number of lanes in use
+  */
+static void compressLanes( const LaneEngine *engine, LaneState *state, const byte *const blocks[],
+                           int active )
+{
+    engine->compress( state, blocks );
+    STATS_ADD( COUNT_BLOCKS, active );
+}
+
+/** Progress of the message currently assigned to one lane. */
+typedef struct {
+  /** Index of the message in the caller's list, or n if the lane is idle. */
+  size_t index;
+
+  /** Start of the message. */
+  const byte *data;
+
+  /** Number of whole blocks hashed straight out of the message. */
+  size_t fullBlocks;
+
+  /** Total number of blocks, including the padded tail. */
+  size_t totalBlocks;
+
+  /** Number of blocks already hashed. */
+  size_t done;
+
+  /** The padded final block or blocks. */
+  byte tail[ 2 * BLOCK_BYTES ];
+} LaneCursor;
+
+/**
+    Assigns a message to a lane, resetting the lane's chaining values.
+
+    @param state LaneState address
+    @param lane lane to assign
+    @param start chaining values the message starts from
+    @param prefixLen bytes already hashed into start
+    @param cursor cursor for the lane
+    @param index index of the message
+    @param msg start of the message
+    @param len length of the message
+  */
+static void startLane( LaneState *state, int lane, const HashState *start,
+                       unsigned long long prefixLen, LaneCursor *cursor, size_t index,
+                       const byte *msg, size_t len )
+{
+    setLane( state, lane, start );
+
+    cursor->index = index;
+    cursor->data = msg;
+    cursor->fullBlocks = len / BLOCK_BYTES;
+    cursor->done = 0;
+    cursor->totalBlocks = cursor->fullBlocks +
+        padFinalBlocks( cursor->tail, msg + cursor->fullBlocks * BLOCK_BYTES,
+                        len % BLOCK_BYTES, prefixLen + len );
+}
+
+/**
+    Runs the lane scheduler: as soon as one message is finished, the next
+    message in the list takes over its lane.
+
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param start chaining values every message starts from
+    @param prefixLen bytes already hashed into start, a multiple of BLOCK_BYTES
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param outputs where in digests each message's digest goes, or NULL to
+                   put them in list order
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+static void scheduleLanes( const LaneEngine *engine, const HashState *start,
+                           unsigned long long prefixLen, const byte *const msgs[],
+                           const size_t lens[], size_t n, const size_t outputs[],
+                           byte *digests )
+{
+    // Idle lanes still get compressed; they just hash this block and the
+    // result is thrown away.
+    static const byte idleBlock[ BLOCK_BYTES ];
+
+    LaneState state;
+    memset( &state, 0, sizeof( state ) );
+    LaneCursor cursors[ MAX_LANES ];
+    const byte *blocks[ MAX_LANES ];
+
+    size_t next = 0;
+    int active = 0;
+
+    for ( int lane = 0; lane < engine->lanes; lane++ ) {
+        if ( next < n ) {
+            startLane( &state, lane, start, prefixLen, &cursors[ lane ], next, msgs[ next ],
+                       lens[ next ] );
+            next++;
+            active++;
+        } else
+            cursors[ lane ].index = n;
+    }
+
+    while ( active > 0 ) {
+        for ( int lane = 0; lane < engine->lanes; lane++ ) {
+            LaneCursor *c = &cursors[ lane ];
+
+            if ( c->index == n )
+                blocks[ lane ] = idleBlock;
+            else if ( c->done < c->fullBlocks )
+                blocks[ lane ] = c->data + c->done * BLOCK_BYTES;
+            else
+                blocks[ lane ] = c->tail + ( c->done - c->fullBlocks ) * BLOCK_BYTES;
+        }
+
+        compressLanes( engine, &state, blocks, active );
+
+        for ( int lane = 0; lane < engine->lanes; lane++ ) {
+            LaneCursor *c = &cursors[ lane ];
+
+            if ( c->index == n || ++c->done < c->totalBlocks )
+                continue;
+
+            // This message is finished; hand the lane to the next one.
+            HashState result;
+            getLane( &state, lane, &result );
+            size_t out = outputs ? outputs[ c->index ] : c->index;
+            writeDigest( &result, digests + out * DIGEST_BYTES );
+
+            if ( next < n ) {
+                startLane( &state, lane, start, prefixLen, c, next, msgs[ next ], lens[ next ] );
+                next++;
+            } else {
+                c->index = n;
+                active--;
+            }
+        }
+    }
+}
+
+/**
+    Hashes n independent messages with the given engine.  A scheduler keeps
+    every lane busy: as soon as one message is finished, the next message in
+    the list takes over its lane, so messages of different lengths can be
+    mixed freely.  Digests are bit-identical to hashing each message with a
+    HashContext.
+
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashMessagesLanes( const LaneEngine *engine, const byte *const msgs[],
+                        const size_t lens[], size_t n, byte *digests )
+{
+    HashState init;
+    initState( &init );
+    scheduleLanes( engine, &init, 0, msgs, lens, n, NULL, digests );
+}
+
+/**
+    Finishes n messages that all start with the same, already hashed, prefix:
+    each digest is that of the prefix followed by the message.  The prefix
+    is given as the state after hashing it, so it costs nothing per message.
+
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param start state after hashing the prefix
+    @param prefixLen length of the prefix, a multiple of BLOCK_BYTES
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void continueMessagesLanes( const LaneEngine *engine, const HashState *start,
+                            unsigned long long prefixLen, const byte *const msgs[],
+                            const size_t lens[], size_t n, byte *digests )
+{
+    scheduleLanes( engine, start, prefixLen, msgs, lens, n, NULL, digests );
+}
+
+/**
+    Hashes n independent messages with the engine chosen by activeLaneEngine().
+
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashMessages( const byte *const msgs[], const size_t lens[], size_t n, byte *digests )
+{
+    hashMessagesLanes( activeLaneEngine(), msgs, lens, n, digests );
+}
+
+/**
+    Hashes n messages of the same length, packed one after another, with the
+    given engine.  Since every message has the same length, they all take the
+    same number of blocks and finish together, and the padding is laid out
+    just once; for each group of messages only the message bytes in the
+    final block are copied.
+
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param msgs n messages of len bytes each, back to back
+    @param len length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashFixedLanes( const LaneEngine *engine, const byte *msgs, size_t len, size_t n,
+                     byte *digests )
+{
+    HashState init;
+    initState( &init );
+    continueFixedLanes( engine, &init, 0, msgs, len, n, digests );
+}
+
+/**
+    Like hashFixedLanes(), but every message follows the same, already
+    hashed, prefix, as in continueMessagesLanes().
+
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param start state after hashing the prefix
+    @param prefixLen length of the prefix, a multiple of BLOCK_BYTES
+    @param msgs n messages of len bytes each, back to back
+    @param len length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void continueFixedLanes( const LaneEngine *engine, const HashState *start,
+                         unsigned long long prefixLen, const byte *msgs, size_t len, size_t n,
+                         byte *digests )
+{
+    if ( n == 0 )
+        return;
+
+    size_t fullBlocks = len / BLOCK_BYTES;
+    size_t rest = len % BLOCK_BYTES;
+
+    // Each lane gets its own copy of the padded tail, filled in once; only
+    // the first rest bytes change from one message to the next.
+    byte tails[ MAX_LANES ][ 2 * BLOCK_BYTES ];
+    int tailBlocks = padFinalBlocks( tails[ 0 ], msgs + fullBlocks * BLOCK_BYTES, rest,
+                                     prefixLen + len );
+    for ( int lane = 1; lane < engine->lanes; lane++ )
+        memcpy( tails[ lane ], tails[ 0 ], tailBlocks * BLOCK_BYTES );
+
+    LaneState state;
+    const byte *blocks[ MAX_LANES ];
+
+    for ( size_t first = 0; first < n; first += engine->lanes ) {
+        int count = n - first < engine->lanes ? n - first : engine->lanes;
+        const byte *group = msgs + first * len;
+
+        for ( int lane = 0; lane < engine->lanes; lane++ )
+            setLane( &state, lane, start );
+        for ( int lane = 0; lane < count; lane++ )
+            memcpy( tails[ lane ], group + lane * len + fullBlocks * BLOCK_BYTES, rest );
+
+        // Lanes past the end of the list just hash the first lane's blocks.
+        for ( size_t b = 0; b < fullBlocks; b++ ) {
+            for ( int lane = 0; lane < engine->lanes; lane++ )
+                blocks[ lane ] = group + ( lane < count ? lane : 0 ) * len + b * BLOCK_BYTES;
+            compressLanes( engine, &state, blocks, count );
+        }
+
+        for ( int b = 0; b < tailBlocks; b++ ) {
+            for ( int lane = 0; lane < engine->lanes; lane++ )
+                blocks[ lane ] = tails[ lane < count ? lane : 0 ] + b * BLOCK_BYTES;
+            compressLanes( engine, &state, blocks, count );
+        }
+
+        for ( int lane = 0; lane < count; lane++ ) {
+            HashState result;
+            getLane( &state, lane, &result );
+            writeDigest( &result, digests + ( first + lane ) * DIGEST_BYTES );
+        }
+    }
+}
+
+/**
+    Hashes n packed 32-byte messages with the engine chosen by
+    activeLaneEngine().
+
+    @param msgs n messages of 32 bytes each, back to back
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashBatch32( const byte *msgs, size_t n, byte *digests )
+{
+    hashFixedLanes( activeLaneEngine(), msgs, 32, n, digests );
+}
+
+/**
+    Hashes n packed 33-byte messages with the engine chosen by
+    activeLaneEngine().
+
+    @param msgs n messages of 33 bytes each, back to back
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashBatch33( const byte *msgs, size_t n, byte *digests )
+{
+    hashFixedLanes( activeLaneEngine(), msgs, 33, n, digests );
+}
+
+/**
+    Hashes n packed 65-byte messages with the engine chosen by
+    activeLaneEngine().
+
+    @param msgs n messages of 65 bytes each, back to back
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashBatch65( const byte *msgs, size_t n, byte *digests )
+{
+    hashFixedLanes( activeLaneEngine(), msgs, 65, n, digests );
+}
+
+/** Messages in hashMany() are grouped by block count up to this many blocks;
+    longer messages all go in the last group. */
+#define MANY_GROUPS 32
+
+/**
+    Hashes messages that all take the same number of blocks, a full set of
+    lanes at a time.  Since they all finish together, there's no per-block
+    bookkeeping: each step just points every lane at its next block.
+
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param blocks number of blocks each message takes, with padding
+    @param outputs where in digests each message's digest goes
+    @param digests storage for the packed digests
+  */
+static void hashLockstep( const LaneEngine *engine, const byte *const msgs[],
+                          const size_t lens[], size_t n, size_t blocks,
+                          const size_t outputs[], byte *digests )
+{
+    HashState init;
+    initState( &init );
+    LaneState state;
+    byte tails[ MAX_LANES ][ 2 * BLOCK_BYTES ];
+    size_t fullBlocks[ MAX_LANES ];
+    const byte *blockPtrs[ MAX_LANES ];
+
+    for ( size_t first = 0; first < n; first += engine->lanes ) {
+        int count = n - first < engine->lanes ? n - first : engine->lanes;
+
+        // Lanes past the end of the list just repeat the first lane.
+        for ( int lane = 0; lane < engine->lanes; lane++ ) {
+            size_t i = first + ( lane < count ? lane : 0 );
+            setLane( &state, lane, &init );
+            fullBlocks[ lane ] = lens[ i ] / BLOCK_BYTES;
+            padFinalBlocks( tails[ lane ], msgs[ i ] + fullBlocks[ lane ] * BLOCK_BYTES,
+                            lens[ i ] % BLOCK_BYTES, lens[ i ] );
+        }
+
+        for ( size_t b = 0; b < blocks; b++ ) {
+            for ( int lane = 0; lane < engine->lanes; lane++ ) {
+                size_t i = first + ( lane < count ? lane : 0 );
+                blockPtrs[ lane ] = b < fullBlocks[ lane ] ? msgs[ i ] + b * BLOCK_BYTES
+                                  : tails[ lane ] + ( b - fullBlocks[ lane ] ) * BLOCK_BYTES;
+            }
+            compressLanes( engine, &state, blockPtrs, count );
+        }
+
+        for ( int lane = 0; lane < count; lane++ ) {
+            HashState result;
+            getLane( &state, lane, &result );
+            writeDigest( &result, digests + outputs[ first + lane ] * DIGEST_BYTES );
+        }
+    }
+}
+
+/**
+    Returns the group hashMany() puts a message in: one less than the number
+    of blocks it takes after padding, capped at the last group.
+
+    @param len length of the message in bytes
+    @return group index
+  */
+static int manyGroup( size_t len )
+{
+    size_t group = ( len + LENGTH_BYTES ) / BLOCK_BYTES;
+    return group < MANY_GROUPS ? group : MANY_GROUPS - 1;
+}
+
+/**
+    Hashes n messages packed into one arena, writing the digests into a packed
+    array in the same order.  Messages are grouped by the number of blocks
+    they take, so the lanes of the active engine are filled with messages that
+    finish together, and each group runs in lockstep without the scheduler's
+    per-block bookkeeping.  The grouping is a counting sort, which keeps
+    messages in arrival order within each group.  The only allocation is one
+    set of scratch arrays for the whole call.
+
+    @param base start of the arena
+    @param offsets offset of each message from base
+    @param lengths length of each message in bytes
+    @param n number of messages
+    @param digestsOut storage for n packed digests of DIGEST_BYTES each
+  */
+void hashMany( const byte *base, const size_t *offsets, const size_t *lengths, size_t n,
+               byte *digestsOut )
+{
+    const byte **msgs = (const byte **) malloc( n * sizeof( byte * ) );
+    size_t *lens = (size_t *) malloc( n * sizeof( size_t ) );
+    size_t *outputs = (size_t *) malloc( n * sizeof( size_t ) );
+
+    if ( !msgs || !lens || !outputs ) {
+        // Out of memory for the scratch arrays; do them one at a time.
+        for ( size_t i = 0; i < n; i++ )
+            hashShort( base + offsets[ i ], lengths[ i ], digestsOut + i * DIGEST_BYTES );
+    } else {
+        // Count the messages in each group, then turn the counts into the
+        // position where each group starts.
+        size_t start[ MANY_GROUPS ] = { 0 };
+        for ( size_t i = 0; i < n; i++ )
+            start[ manyGroup( lengths[ i ] ) ]++;
+        size_t total = 0;
+        for ( int g = 0; g < MANY_GROUPS; g++ ) {
+            size_t count = start[ g ];
+            start[ g ] = total;
+            total += count;
+        }
+
+        for ( size_t i = 0; i < n; i++ ) {
+            size_t pos = start[ manyGroup( lengths[ i ] ) ]++;
+            msgs[ pos ] = base + offsets[ i ];
+            lens[ pos ] = lengths[ i ];
+            outputs[ pos ] = i;
+        }
+
+        // Each group now ends where the next one starts.  Every message in
+        // one of the exact groups takes g + 1 blocks, so those run in
+        // lockstep; the last group has a mix, so it gets the scheduler.
+        const LaneEngine *engine = activeLaneEngine();
+        size_t first = 0;
+        for ( int g = 0; g < MANY_GROUPS - 1; g++ ) {
+            hashLockstep( engine, msgs + first, lens + first, start[ g ] - first, g + 1,
+                          outputs + first, digestsOut );
+            first = start[ g ];
+        }
+        HashState init;
+        initState( &init );
+        scheduleLanes( engine, &init, 0, msgs + first, lens + first, n - first, outputs + first,
+                       digestsOut );
+    }
+
+    free( msgs );
+    free( lens );
+    free( outputs );
+}
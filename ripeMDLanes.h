@@ -0,0 +1,212 @@
+/** 
+    @filename ripeMDLanes.h
+    @author Will Greene (wgreene)
+    
+    Header file for ripeMDLanes.c
+*/
+#ifndef _RIPEMD_LANES_H_
+#define _RIPEMD_LANES_H_
+
+#include "ripeMD.h"
+
+/** Largest number of lanes used by any engine. */
+#define MAX_LANES 16
+
+/** Chaining values for up to MAX_LANES independent messages.  Each field is
+    stored as its own array, so the values for all the lanes can be moved in
+    and out of a vector register with a single load or store. */
+typedef struct {
+  /** Hash field A for each lane */
+  longword A[ MAX_LANES ];
+  
+  /** Hash field B for each lane */
+  longword B[ MAX_LANES ];
+  
+  /** Hash field C for each lane */
+  longword C[ MAX_LANES ];
+  
+  /** Hash field D for each lane */
+  longword D[ MAX_LANES ];
+  
+  /** Hash field E for each lane */
+  longword E[ MAX_LANES ];
+} __attribute__(( aligned( 64 ) )) LaneState;
+
+/** A compression engine that processes one block for each of several
+    independent messages at the same time, one message per SIMD lane. */
+typedef struct {
+  /** Name of the engine, for reporting and selection. */
+  const char *name;
+  
+  /** Number of messages handled by each call to compress. */
+  int lanes;
+  
+  /** Returns true if the CPU we're running on can execute this engine. */
+  int (*supported)( void );
+  
+  /** Runs the compression function once for each lane.  Lane i hashes the 64
+      bytes at blocks[ i ], updating its chaining values in state. */
+  void (*compress)( LaneState *state, const byte *const blocks[] );
+} LaneEngine;
+
+/** All the multi-lane engines compiled into this build, narrowest first. */
+extern const LaneEngine laneEngines[];
+
+/** Number of entries in laneEngines. */
+extern const int numLaneEngines;
+
+/**
+    Makes the named engine the one used by hashMessages().
+    
+    @param name name of an entry in laneEngines
+    @return 0 on success, -1 if there's no such engine or the CPU can't run it
+  */
+int selectLaneEngine( const char *name );
+
+/**
+    Returns the engine used by hashMessages(), choosing one on the first call:
+    the one named by the RIPEMD_KERNEL environment variable if it's usable,
+    otherwise the widest one the CPU supports.
+    
+    @return the active engine
+  */
+const LaneEngine *activeLaneEngine( void );
+
+/**
+    Copies a HashState into the given lane of a LaneState.
+    
+    @param state LaneState address
+    @param lane lane to set
+    @param value HashState to copy
+  */
+void setLane( LaneState *state, int lane, const HashState *value );
+
+/**
+    Copies the given lane of a LaneState out into a HashState.
+    
+    @param state LaneState address
+    @param lane lane to read
+    @param value HashState to fill in
+  */
+void getLane( const LaneState *state, int lane, HashState *value );
+
+/**
+    Hashes n independent messages with the given engine.  A scheduler keeps
+    every lane busy: as soon as one message is finished, the next message in
+    the list takes over its lane, so messages of different lengths can be
+    mixed freely.  Digests are bit-identical to hashing each message with a
+    HashContext.
+    
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashMessagesLanes( const LaneEngine *engine, const byte *const msgs[],
+                        const size_t lens[], size_t n, byte *digests );
+
+/**
+    Finishes n messages that all start with the same, already hashed, prefix:
+    each digest is that of the prefix followed by the message.  The prefix
+    is given as the state after hashing it, so it costs nothing per message.
+    
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param start state after hashing the prefix
+    @param prefixLen length of the prefix, a multiple of BLOCK_BYTES
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void continueMessagesLanes( const LaneEngine *engine, const HashState *start,
+                            unsigned long long prefixLen, const byte *const msgs[],
+                            const size_t lens[], size_t n, byte *digests );
+
+/**
+    Hashes n independent messages with the engine chosen by activeLaneEngine().
+    
+    @param msgs address of each message
+    @param lens length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashMessages( const byte *const msgs[], const size_t lens[], size_t n, byte *digests );
+
+/**
+    Hashes n messages of the same length, packed one after another, with the
+    given engine.  Since every message has the same length, they all take the
+    same number of blocks and finish together, and the padding is laid out
+    just once.
+    
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param msgs n messages of len bytes each, back to back
+    @param len length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashFixedLanes( const LaneEngine *engine, const byte *msgs, size_t len, size_t n,
+                     byte *digests );
+
+/**
+    Like hashFixedLanes(), but every message follows the same, already
+    hashed, prefix, as in continueMessagesLanes().
+    
+    @param engine multi-lane engine to use; it must be supported by the CPU
+    @param start state after hashing the prefix
+    @param prefixLen length of the prefix, a multiple of BLOCK_BYTES
+    @param msgs n messages of len bytes each, back to back
+    @param len length of each message in bytes
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void continueFixedLanes( const LaneEngine *engine, const HashState *start,
+                         unsigned long long prefixLen, const byte *msgs, size_t len, size_t n,
+                         byte *digests );
+
+/**
+    Hashes n packed 32-byte messages with the engine chosen by
+    activeLaneEngine().
+    
+    @param msgs n messages of 32 bytes each, back to back
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashBatch32( const byte *msgs, size_t n, byte *digests );
+
+/**
+    Hashes n packed 33-byte messages with the engine chosen by
+    activeLaneEngine().
+    
+    @param msgs n messages of 33 bytes each, back to back
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashBatch33( const byte *msgs, size_t n, byte *digests );
+
+/**
+    Hashes n packed 65-byte messages with the engine chosen by
+    activeLaneEngine().
+    
+    @param msgs n messages of 65 bytes each, back to back
+    @param n number of messages
+    @param digests storage for n packed digests of DIGEST_BYTES each
+  */
+void hashBatch65( const byte *msgs, size_t n, byte *digests );
+
+/**
+    Hashes n messages packed into one arena, writing the digests into a packed
+    array in the same order.  Messages are grouped by the number of blocks
+    they take, so the lanes of the active engine are filled with messages that
+    finish together.  There's no allocation per message.
+    
+    @param base start of the arena
+    @param offsets offset of each message from base
+    @param lengths length of each message in bytes
+    @param n number of messages
+    @param digestsOut storage for n packed digests of DIGEST_BYTES each
+  */
+void hashMany( const byte *base, const size_t *offsets, const size_t *lengths, size_t n,
+               byte *digestsOut );
+
+#endif
@@ -0,0 +1,161 @@
+/** 
+    @filename ripeMDSteps.h
+    @author Will Greene (wgreene)
+    
+    Building blocks shared by the specialized compression kernels: message
+    loading, round constants, inlined bitwise functions and the fully unrolled
+    sequence of iterations.  They're written as macros so the same code works on plain
+    longwords and on vectors of longwords.  This header is internal to the
+    ripeMD components.
+*/
+#ifndef _RIPEMD_STEPS_H_
+#define _RIPEMD_STEPS_H_
+
+#include "ripeMD.h"
+
+/**
+    Reads a little-endian longword from the given address, which doesn't need
+    to be aligned.  Compilers turn this into a single load on little-endian
+    machines.
+    
+    @param p address of the first of four bytes
+    @return longword value
+  */
+static inline longword loadLittleEndian( const byte *p )
+{
+    return (longword) p[ 0 ] | (longword) p[ 1 ] << BBITS |
+           (longword) p[ 2 ] << ( BBITS * 2 ) | (longword) p[ 3 ] << ( BBITS * 3 );
+}
+
+/** Constant added in each round of the left line. */
+#define KL0 0x00000000
+#define KL1 0x5A827999
+#define KL2 0x6ED9EBA1
+#define KL3 0x8F1BBCDC
+#define KL4 0xA953FD4E
+
+/** Constant added in each round of the right line. */
+#define KR0 0x50A28BE6
+#define KR1 0x5C4DD124
+#define KR2 0x6D703EF3
+#define KR3 0x7A6D76E9
+#define KR4 0x00000000
+
+/** Inlined versions of the bitwise functions, for the unrolled kernel. */
+#define F0( x, y, z ) ( ( x ) ^ ( y ) ^ ( z ) )
+#define F1( x, y, z ) ( ( ( x ) & ( y ) ) | ( ~( x ) & ( z ) ) )
+#define F2( x, y, z ) ( ( ( x ) | ~( y ) ) ^ ( z ) )
+#define F3( x, y, z ) ( ( ( x ) & ( z ) ) | ( ( y ) & ~( z ) ) )
+#define F4( x, y, z ) ( ( x ) ^ ( ( y ) | ~( z ) ) )
+
+/** Rotates x left by a constant number of bits, 0 < n < 32.  Compilers turn
+    this into a single rotate instruction. */
+#define ROTL( x, n ) ( ( ( x ) << ( n ) ) | ( ( x ) >> ( sizeof( longword ) * BBITS - ( n ) ) ) )
+
+/** One iteration of the algorithm, the same as hashIteration().  Instead of
+    shuffling the five values at the end, the caller rotates which variable
+    plays the part of A, B, C, D and E from one step to the next. */
+#define STEP( f, a, b, c, d, e, x, s, k ) {      \
+    a += f( b, c, d ) + ( x ) + ( k );           \
+    a = ROTL( a, s ) + e;                        \
+    c = ROTL( c, NUM_C_ROTATIONS );              \
+}
+
+/** All 160 iterations of the algorithm, with the left and right lines
+    interleaved so their independent work can overlap.  Expects the left
+    line's values in variables al, bl, cl, dl, el, the right line's in
+    ar, br, cr, dr, er, and the 16 message longwords in X.  Afterwards each
+    variable is back in its original role. */
+#define RIPEMD_STEPS( X ) {                                                                              \
+    /* Round 0: left line F0, right line F4. */                                                          \
+    STEP( F0, al, bl, cl, dl, el, X[  0 ], 11, KL0 ); STEP( F4, ar, br, cr, dr, er, X[  5 ],  8, KR0 );  \
+    STEP( F0, el, al, bl, cl, dl, X[  1 ], 14, KL0 ); STEP( F4, er, ar, br, cr, dr, X[ 14 ],  9, KR0 );  \
+    STEP( F0, dl, el, al, bl, cl, X[  2 ], 15, KL0 ); STEP( F4, dr, er, ar, br, cr, X[  7 ],  9, KR0 );  \
+    STEP( F0, cl, dl, el, al, bl, X[  3 ], 12, KL0 ); STEP( F4, cr, dr, er, ar, br, X[  0 ], 11, KR0 );  \
+    STEP( F0, bl, cl, dl, el, al, X[  4 ],  5, KL0 ); STEP( F4, br, cr, dr, er, ar, X[  9 ], 13, KR0 );  \
+    STEP( F0, al, bl, cl, dl, el, X[  5 ],  8, KL0 ); STEP( F4, ar, br, cr, dr, er, X[  2 ], 15, KR0 );  \
+    STEP( F0, el, al, bl, cl, dl, X[  6 ],  7, KL0 ); STEP( F4, er, ar, br, cr, dr, X[ 11 ], 15, KR0 );  \
+    STEP( F0, dl, el, al, bl, cl, X[  7 ],  9, KL0 ); STEP( F4, dr, er, ar, br, cr, X[  4 ],  5, KR0 );  \
+    STEP( F0, cl, dl, el, al, bl, X[  8 ], 11, KL0 ); STEP( F4, cr, dr, er, ar, br, X[ 13 ],  7, KR0 );  \
+    STEP( F0, bl, cl, dl, el, al, X[  9 ], 13, KL0 ); STEP( F4, br, cr, dr, er, ar, X[  6 ],  7, KR0 );  \
+    STEP( F0, al, bl, cl, dl, el, X[ 10 ], 14, KL0 ); STEP( F4, ar, br, cr, dr, er, X[ 15 ],  8, KR0 );  \
+    STEP( F0, el, al, bl, cl, dl, X[ 11 ], 15, KL0 ); STEP( F4, er, ar, br, cr, dr, X[  8 ], 11, KR0 );  \
+    STEP( F0, dl, el, al, bl, cl, X[ 12 ],  6, KL0 ); STEP( F4, dr, er, ar, br, cr, X[  1 ], 14, KR0 );  \
+    STEP( F0, cl, dl, el, al, bl, X[ 13 ],  7, KL0 ); STEP( F4, cr, dr, er, ar, br, X[ 10 ], 14, KR0 );  \
+    STEP( F0, bl, cl, dl, el, al, X[ 14 ],  9, KL0 ); STEP( F4, br, cr, dr, er, ar, X[  3 ], 12, KR0 );  \
+    STEP( F0, al, bl, cl, dl, el, X[ 15 ],  8, KL0 ); STEP( F4, ar, br, cr, dr, er, X[ 12 ],  6, KR0 );  \
+                                                                                                         \
+    /* Round 1: left line F1, right line F3. */                                                          \
+    STEP( F1, el, al, bl, cl, dl, X[  7 ],  7, KL1 ); STEP( F3, er, ar, br, cr, dr, X[  6 ],  9, KR1 );  \
+    STEP( F1, dl, el, al, bl, cl, X[  4 ],  6, KL1 ); STEP( F3, dr, er, ar, br, cr, X[ 11 ], 13, KR1 );  \
+    STEP( F1, cl, dl, el, al, bl, X[ 13 ],  8, KL1 ); STEP( F3, cr, dr, er, ar, br, X[  3 ], 15, KR1 );  \
+    STEP( F1, bl, cl, dl, el, al, X[  1 ], 13, KL1 ); STEP( F3, br, cr, dr, er, ar, X[  7 ],  7, KR1 );  \
+    STEP( F1, al, bl, cl, dl, el, X[ 10 ], 11, KL1 ); STEP( F3, ar, br, cr, dr, er, X[  0 ], 12, KR1 );  \
+    STEP( F1, el, al, bl, cl, dl, X[  6 ],  9, KL1 ); STEP( F3, er, ar, br, cr, dr, X[ 13 ],  8, KR1 );  \
+    STEP( F1, dl, el, al, bl, cl, X[ 15 ],  7, KL1 ); STEP( F3, dr, er, ar, br, cr, X[  5 ],  9, KR1 );  \
+    STEP( F1, cl, dl, el, al, bl, X[  3 ], 15, KL1 ); STEP( F3, cr, dr, er, ar, br, X[ 10 ], 11, KR1 );  \
+    STEP( F1, bl, cl, dl, el, al, X[ 12 ],  7, KL1 ); STEP( F3, br, cr, dr, er, ar, X[ 14 ],  7, KR1 );  \
+    STEP( F1, al, bl, cl, dl, el, X[  0 ], 12, KL1 ); STEP( F3, ar, br, cr, dr, er, X[ 15 ],  7, KR1 );  \
+    STEP( F1, el, al, bl, cl, dl, X[  9 ], 15, KL1 ); STEP( F3, er, ar, br, cr, dr, X[  8 ], 12, KR1 );  \
+    STEP( F1, dl, el, al, bl, cl, X[  5 ],  9, KL1 ); STEP( F3, dr, er, ar, br, cr, X[ 12 ],  7, KR1 );  \
+    STEP( F1, cl, dl, el, al, bl, X[  2 ], 11, KL1 ); STEP( F3, cr, dr, er, ar, br, X[  4 ],  6, KR1 );  \
+    STEP( F1, bl, cl, dl, el, al, X[ 14 ],  7, KL1 ); STEP( F3, br, cr, dr, er, ar, X[  9 ], 15, KR1 );  \
+    STEP( F1, al, bl, cl, dl, el, X[ 11 ], 13, KL1 ); STEP( F3, ar, br, cr, dr, er, X[  1 ], 13, KR1 );  \
+    STEP( F1, el, al, bl, cl, dl, X[  8 ], 12, KL1 ); STEP( F3, er, ar, br, cr, dr, X[  2 ], 11, KR1 );  \
+                                                                                                         \
+    /* Round 2: left line F2, right line F2. */                                                          \
+    STEP( F2, dl, el, al, bl, cl, X[  3 ], 11, KL2 ); STEP( F2, dr, er, ar, br, cr, X[ 15 ],  9, KR2 );  \
+    STEP( F2, cl, dl, el, al, bl, X[ 10 ], 13, KL2 ); STEP( F2, cr, dr, er, ar, br, X[  5 ],  7, KR2 );  \
+    STEP( F2, bl, cl, dl, el, al, X[ 14 ],  6, KL2 ); STEP( F2, br, cr, dr, er, ar, X[  1 ], 15, KR2 );  \
+    STEP( F2, al, bl, cl, dl, el, X[  4 ],  7, KL2 ); STEP( F2, ar, br, cr, dr, er, X[  3 ], 11, KR2 );  \
+    STEP( F2, el, al, bl, cl, dl, X[  9 ], 14, KL2 ); STEP( F2, er, ar, br, cr, dr, X[  7 ],  8, KR2 );  \
+    STEP( F2, dl, el, al, bl, cl, X[ 15 ],  9, KL2 ); STEP( F2, dr, er, ar, br, cr, X[ 14 ],  6, KR2 );  \
+    STEP( F2, cl, dl, el, al, bl, X[  8 ], 13, KL2 ); STEP( F2, cr, dr, er, ar, br, X[  6 ],  6, KR2 );  \
+    STEP( F2, bl, cl, dl, el, al, X[  1 ], 15, KL2 ); STEP( F2, br, cr, dr, er, ar, X[  9 ], 14, KR2 );  \
+    STEP( F2, al, bl, cl, dl, el, X[  2 ], 14, KL2 ); STEP( F2, ar, br, cr, dr, er, X[ 11 ], 12, KR2 );  \
+    STEP( F2, el, al, bl, cl, dl, X[  7 ],  8, KL2 ); STEP( F2, er, ar, br, cr, dr, X[  8 ], 13, KR2 );  \
+    STEP( F2, dl, el, al, bl, cl, X[  0 ], 13, KL2 ); STEP( F2, dr, er, ar, br, cr, X[ 12 ],  5, KR2 );  \
+    STEP( F2, cl, dl, el, al, bl, X[  6 ],  6, KL2 ); STEP( F2, cr, dr, er, ar, br, X[  2 ], 14, KR2 );  \
+    STEP( F2, bl, cl, dl, el, al, X[ 13 ],  5, KL2 ); STEP( F2, br, cr, dr, er, ar, X[ 10 ], 13, KR2 );  \
+    STEP( F2, al, bl, cl, dl, el, X[ 11 ], 12, KL2 ); STEP( F2, ar, br, cr, dr, er, X[  0 ], 13, KR2 );  \
+    STEP( F2, el, al, bl, cl, dl, X[  5 ],  7, KL2 ); STEP( F2, er, ar, br, cr, dr, X[  4 ],  7, KR2 );  \
+    STEP( F2, dl, el, al, bl, cl, X[ 12 ],  5, KL2 ); STEP( F2, dr, er, ar, br, cr, X[ 13 ],  5, KR2 );  \
+                                                                                                         \
+    /* Round 3: left line F3, right line F1. */                                                          \
+    STEP( F3, cl, dl, el, al, bl, X[  1 ], 11, KL3 ); STEP( F1, cr, dr, er, ar, br, X[  8 ], 15, KR3 );  \
+    STEP( F3, bl, cl, dl, el, al, X[  9 ], 12, KL3 ); STEP( F1, br, cr, dr, er, ar, X[  6 ],  5, KR3 );  \
+    STEP( F3, al, bl, cl, dl, el, X[ 11 ], 14, KL3 ); STEP( F1, ar, br, cr, dr, er, X[  4 ],  8, KR3 );  \
+    STEP( F3, el, al, bl, cl, dl, X[ 10 ], 15, KL3 ); STEP( F1, er, ar, br, cr, dr, X[  1 ], 11, KR3 );  \
+    STEP( F3, dl, el, al, bl, cl, X[  0 ], 14, KL3 ); STEP( F1, dr, er, ar, br, cr, X[  3 ], 14, KR3 );  \
+    STEP( F3, cl, dl, el, al, bl, X[  8 ], 15, KL3 ); STEP( F1, cr, dr, er, ar, br, X[ 11 ], 14, KR3 );  \
+    STEP( F3, bl, cl, dl, el, al, X[ 12 ],  9, KL3 ); STEP( F1, br, cr, dr, er, ar, X[ 15 ],  6, KR3 );  \
+    STEP( F3, al, bl, cl, dl, el, X[  4 ],  8, KL3 ); STEP( F1, ar, br, cr, dr, er, X[  0 ], 14, KR3 );  \
+    STEP( F3, el, al, bl, cl, dl, X[ 13 ],  9, KL3 ); STEP( F1, er, ar, br, cr, dr, X[  5 ],  6, KR3 );  \
+    STEP( F3, dl, el, al, bl, cl, X[  3 ], 14, KL3 ); STEP( F1, dr, er, ar, br, cr, X[ 12 ],  9, KR3 );  \
+    STEP( F3, cl, dl, el, al, bl, X[  7 ],  5, KL3 ); STEP( F1, cr, dr, er, ar, br, X[  2 ], 12, KR3 );  \
+    STEP( F3, bl, cl, dl, el, al, X[ 15 ],  6, KL3 ); STEP( F1, br, cr, dr, er, ar, X[ 13 ],  9, KR3 );  \
+    STEP( F3, al, bl, cl, dl, el, X[ 14 ],  8, KL3 ); STEP( F1, ar, br, cr, dr, er, X[  9 ], 12, KR3 );  \
+    STEP( F3, el, al, bl, cl, dl, X[  5 ],  6, KL3 ); STEP( F1, er, ar, br, cr, dr, X[  7 ],  5, KR3 );  \
+    STEP( F3, dl, el, al, bl, cl, X[  6 ],  5, KL3 ); STEP( F1, dr, er, ar, br, cr, X[ 10 ], 15, KR3 );  \
+    STEP( F3, cl, dl, el, al, bl, X[  2 ], 12, KL3 ); STEP( F1, cr, dr, er, ar, br, X[ 14 ],  8, KR3 );  \
+                                                                                                         \
+    /* Round 4: left line F4, right line F0. */                                                          \
+    STEP( F4, bl, cl, dl, el, al, X[  4 ],  9, KL4 ); STEP( F0, br, cr, dr, er, ar, X[ 12 ],  8, KR4 );  \
+    STEP( F4, al, bl, cl, dl, el, X[  0 ], 15, KL4 ); STEP( F0, ar, br, cr, dr, er, X[ 15 ],  5, KR4 );  \
+    STEP( F4, el, al, bl, cl, dl, X[  5 ],  5, KL4 ); STEP( F0, er, ar, br, cr, dr, X[ 10 ], 12, KR4 );  \
+    STEP( F4, dl, el, al, bl, cl, X[  9 ], 11, KL4 ); STEP( F0, dr, er, ar, br, cr, X[  4 ],  9, KR4 );  \
+    STEP( F4, cl, dl, el, al, bl, X[  7 ],  6, KL4 ); STEP( F0, cr, dr, er, ar, br, X[  1 ], 12, KR4 );  \
+    STEP( F4, bl, cl, dl, el, al, X[ 12 ],  8, KL4 ); STEP( F0, br, cr, dr, er, ar, X[  5 ],  5, KR4 );  \
+    STEP( F4, al, bl, cl, dl, el, X[  2 ], 13, KL4 ); STEP( F0, ar, br, cr, dr, er, X[  8 ], 14, KR4 );  \
+    STEP( F4, el, al, bl, cl, dl, X[ 10 ], 12, KL4 ); STEP( F0, er, ar, br, cr, dr, X[  7 ],  6, KR4 );  \
+    STEP( F4, dl, el, al, bl, cl, X[ 14 ],  5, KL4 ); STEP( F0, dr, er, ar, br, cr, X[  6 ],  8, KR4 );  \
+    STEP( F4, cl, dl, el, al, bl, X[  1 ], 12, KL4 ); STEP( F0, cr, dr, er, ar, br, X[  2 ], 13, KR4 );  \
+    STEP( F4, bl, cl, dl, el, al, X[  3 ], 13, KL4 ); STEP( F0, br, cr, dr, er, ar, X[ 13 ],  6, KR4 );  \
+    STEP( F4, al, bl, cl, dl, el, X[  8 ], 14, KL4 ); STEP( F0, ar, br, cr, dr, er, X[ 14 ],  5, KR4 );  \
+    STEP( F4, el, al, bl, cl, dl, X[ 11 ], 11, KL4 ); STEP( F0, er, ar, br, cr, dr, X[  0 ], 15, KR4 );  \
+    STEP( F4, dl, el, al, bl, cl, X[  6 ],  8, KL4 ); STEP( F0, dr, er, ar, br, cr, X[  3 ], 13, KR4 );  \
+    STEP( F4, cl, dl, el, al, bl, X[ 15 ],  5, KL4 ); STEP( F0, cr, dr, er, ar, br, X[  9 ], 11, KR4 );  \
+    STEP( F4, bl, cl, dl, el, al, X[ 13 ],  6, KL4 ); STEP( F0, br, cr, dr, er, ar, X[ 11 ], 11, KR4 );  \
+}
+
+#endif
@@ -0,0 +1,150 @@
+/** 
+    @filename stats.c
+    @author Will Greene (wgreene)
+    
+    Contains the totals behind the --stats flag: time spent in each stage of
+    a run and counts of the work done.  Every thread adds to the same
+    totals with atomic operations.
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#ifndef NO_STATS
+
+#include <string.h>
+#include <time.h>
+
+/** Whether statistics are being gathered; set by the --stats flag. */
+int statsEnabled = 0;
+
+/** Wall clock time spent in each stage, in nanoseconds, over all threads. */
+static unsigned long long stageWall[ NUM_STAGES ];
+
+/** CPU time spent in each stage, in nanoseconds, over all threads. */
+static unsigned long long stageCpu[ NUM_STAGES ];
+
+/** Value of each counter. */
+static unsigned long long counters[ NUM_COUNTERS ];
+
+/** Wall clock and process CPU time when startStats() was called. */
+static StageTimer runStart;
+
+/** Name printed for each stage. */
+static const char *stageNames[ NUM_STAGES ] = { "read", "pad", "compress", "output" };
+
+/**
+    Returns the current value of a clock, in nanoseconds.
+    
+    @param clock which clock
+    @return time in nanoseconds
+  */
+static long long readClock( clockid_t clock )
+{
+    struct timespec ts;
+    clock_gettime( clock, &ts );
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+    Starts timing a pass through a stage.
+    
+    @return the current wall clock and thread CPU times
+  */
+StageTimer startStage( void )
+{
+    StageTimer timer = { readClock( CLOCK_MONOTONIC ), readClock( CLOCK_THREAD_CPUTIME_ID ) };
+    return timer;
+}
+
+/**
+    Adds the time since startStage() to the given stage's totals.
+    
+    @param timer StageTimer address
+    @param stage the stage being timed
+  */
+void stopStage( const StageTimer *timer, Stage stage )
+{
+    long long wall = readClock( CLOCK_MONOTONIC ) - timer->wall;
+    long long cpu = readClock( CLOCK_THREAD_CPUTIME_ID ) - timer->cpu;
+    
+    __atomic_fetch_add( &stageWall[ stage ], wall, __ATOMIC_RELAXED );
+    __atomic_fetch_add( &stageCpu[ stage ], cpu, __ATOMIC_RELAXED );
+}
+
+/**
+    Adds to a counter.
+    
+    @param counter which counter
+    @param n amount to add
+  */
+void addCount( Counter counter, unsigned long long n )
+{
+    __atomic_fetch_add( &counters[ counter ], n, __ATOMIC_RELAXED );
+}
+
+/**
+    Raises a counter that holds a maximum, such as COUNT_PEAK_CAPACITY.
+    
+    @param counter which counter
+    @param n new value, kept if it's larger than the old one
+  */
+void raiseCount( Counter counter, unsigned long long n )
+{
+    unsigned long long old = __atomic_load_n( &counters[ counter ], __ATOMIC_RELAXED );
+    while ( n > old && !__atomic_compare_exchange_n( &counters[ counter ], &old, n, 1,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+}
+
+/**
+    Clears all the totals and counters and starts gathering statistics.
+  */
+void startStats( void )
+{
+    memset( stageWall, 0, sizeof( stageWall ) );
+    memset( stageCpu, 0, sizeof( stageCpu ) );
+    memset( counters, 0, sizeof( counters ) );
+    
+    runStart.wall = readClock( CLOCK_MONOTONIC );
+    runStart.cpu = readClock( CLOCK_PROCESS_CPUTIME_ID );
+    statsEnabled = 1;
+}
+
+/**
+    Returns a counter's value.
+    
+    @param counter which counter
+    @return the value
+  */
+unsigned long long statCount( Counter counter )
+{
+    return __atomic_load_n( &counters[ counter ], __ATOMIC_RELAXED );
+}
+
+/**
+    Prints a table of the time spent in each stage, summed over all threads,
+    then the whole run's time since startStats(), and the counters.  The
+    buffer counters are left out if no ByteBuffer was used.
+    
+    @param fp where to print
+  */
+void printStats( FILE *fp )
+{
+    fprintf( fp, "%-10s %12s %12s\n", "stage", "wall ms", "cpu ms" );
+    for ( int s = 0; s < NUM_STAGES; s++ )
+        fprintf( fp, "%-10s %12.3f %12.3f\n", stageNames[ s ], stageWall[ s ] / 1e6, stageCpu[ s ] / 1e6 );
+    fprintf( fp, "%-10s %12.3f %12.3f\n", "total", ( readClock( CLOCK_MONOTONIC ) - runStart.wall ) / 1e6,
+             ( readClock( CLOCK_PROCESS_CPUTIME_ID ) - runStart.cpu ) / 1e6 );
+    
+    fprintf( fp, "bytes read: %llu\n", counters[ COUNT_BYTES_READ ] );
+    fprintf( fp, "blocks compressed: %llu\n", counters[ COUNT_BLOCKS ] );
+    
+    // Only ByteBuffers are counted, and most modes don't use one.
+    if ( counters[ COUNT_PEAK_CAPACITY ] ) {
+        fprintf( fp, "buffer reallocs: %llu\n", counters[ COUNT_REALLOCS ] );
+        fprintf( fp, "peak buffer capacity: %llu bytes\n", counters[ COUNT_PEAK_CAPACITY ] );
+    }
+}
+
+#endif
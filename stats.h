@@ -0,0 +1,142 @@
+/** 
+    @filename stats.h
+    @author Will Greene (wgreene)
+    
+    Header file for stats.c
+*/
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+
+/** Stages of a run that are timed separately.  Stages are timed a chunk,
+    batch or file at a time, never per block or per digest, so the clock
+    reads cost little next to the work they measure. */
+typedef enum {
+  /** Reading input with read() or fread(), a chunk at a time. */
+  STAGE_READ,
+  
+  /** Padding and finishing each file's digest, and padding whole buffers.
+      In record mode this is part of STAGE_COMPRESS. */
+  STAGE_PAD,
+  
+  /** Hashing each chunk, mapped file, tree leaf or batch of records. */
+  STAGE_COMPRESS,
+  
+  /** Writing out buffers of formatted digests. */
+  STAGE_OUTPUT,
+  
+  /** Number of stages. */
+  NUM_STAGES
+} Stage;
+
+/** Things that are counted. */
+typedef enum {
+  /** Bytes of input read. */
+  COUNT_BYTES_READ,
+  
+  /** Blocks run through the compression function, in any lane. */
+  COUNT_BLOCKS,
+  
+  /** Times a ByteBuffer was reallocated to grow it. */
+  COUNT_REALLOCS,
+  
+  /** Largest capacity any ByteBuffer grew to, in bytes. */
+  COUNT_PEAK_CAPACITY,
+  
+  /** Number of counters. */
+  NUM_COUNTERS
+} Counter;
+
+#ifndef NO_STATS
+
+/** Whether statistics are being gathered; set by the --stats flag. */
+extern int statsEnabled;
+
+/** Timing of one pass through a stage. */
+typedef struct {
+  /** Wall clock time at the start, in nanoseconds. */
+  long long wall;
+  
+  /** CPU time used by this thread at the start, in nanoseconds. */
+  long long cpu;
+} StageTimer;
+
+/**
+    Starts timing a pass through a stage.
+    
+    @return the current wall clock and thread CPU times
+  */
+StageTimer startStage( void );
+
+/**
+    Adds the time since startStage() to the given stage's totals.
+    
+    @param timer StageTimer address
+    @param stage the stage being timed
+  */
+void stopStage( const StageTimer *timer, Stage stage );
+
+/**
+    Adds to a counter.
+    
+    @param counter which counter
+    @param n amount to add
+  */
+void addCount( Counter counter, unsigned long long n );
+
+/**
+    Raises a counter that holds a maximum, such as COUNT_PEAK_CAPACITY.
+    
+    @param counter which counter
+    @param n new value, kept if it's larger than the old one
+  */
+void raiseCount( Counter counter, unsigned long long n );
+
+/**
+    Clears all the totals and counters and starts gathering statistics.
+  */
+void startStats( void );
+
+/**
+    Returns a counter's value.
+    
+    @param counter which counter
+    @return the value
+  */
+unsigned long long statCount( Counter counter );
+
+/**
+    Prints a table of the time spent in each stage, summed over all threads,
+    then the whole run's time since startStats(), and the counters.  The
+    buffer counters are left out if no ByteBuffer was used.
+    
+    @param fp where to print
+  */
+void printStats( FILE *fp );
+
+/** Starts timing a stage, declaring a timer with the given name.  This is a
+    declaration, so it can only go where one is allowed. */
+#define STATS_START( timer ) StageTimer timer = statsEnabled ? startStage() : (StageTimer) { 0, 0 }
+
+/** Stops the timer started by STATS_START(), charging the time to a stage. */
+#define STATS_STOP( timer, stage ) ( statsEnabled ? stopStage( &timer, stage ) : (void) 0 )
+
+/** Adds n to a counter. */
+#define STATS_ADD( counter, n ) ( statsEnabled ? addCount( counter, n ) : (void) 0 )
+
+/** Raises a maximum counter to n. */
+#define STATS_RAISE( counter, n ) ( statsEnabled ? raiseCount( counter, n ) : (void) 0 )
+
+#else
+
+// Built with -DNO_STATS: every hook disappears.
+
+#define STATS_START( timer )
+#define STATS_STOP( timer, stage ) ( (void) 0 )
+#define STATS_ADD( counter, n ) ( (void) 0 )
+#define STATS_RAISE( counter, n ) ( (void) 0 )
+
+#endif
+
+#endif
@@ -131,6 +131,22 @@ if [ -x testdriver ]; then
 	echo "**** Your program didn't pass all the test driver tests."
 	FAIL=1
     fi
+
+    # Check every compression kernel this CPU can run.
+    ./testdriver kernels
+    if [ $? -ne 0 ]; then
+	echo "**** Some compression kernels didn't match the test vectors."
+	FAIL=1
+    fi
+
+    # Hashing a multi-GB stream takes a while, so it's only done on request.
+    if [ -n "$LARGE_TESTS" ]; then
+	./testdriver large
+	if [ $? -ne 0 ]; then
+	    echo "**** The multi-GB synthetic stream didn't hash correctly."
+	    FAIL=1
+	fi
+    fi
 else
     echo "**** We couldn't build the test driver with your implementation, so we couldn't run the unit tests."
     FAIL=1
@@ -162,6 +178,36 @@ if [ -x hash ]; then
     
     args=(bad-filename.txt)
     testHash 07 1
+
+    args=(-j 3 input-01.txt input-02.txt input-03.txt input-05.bin)
+    testHash 08 0
+
+    args=(--tree --chunk-size 1K --fanout 4 -j 2 input-05.bin input-01.txt)
+    testHash 09 0
+
+    args=(--pipeline input-05.bin)
+    testHash 10 0
+
+    args=(--uring input-01.txt bad-filename.txt input-05.bin)
+    testHash 11 1
+
+    args=(--lines -j 2 input-04.txt)
+    testHash 12 0
+
+    args=(--nul input-05.bin)
+    testHash 13 0
+
+    args=(--format base64 input-01.txt input-03.txt)
+    testHash 14 0
+
+    args=(--format raw --lines input-02.txt)
+    testHash 15 0
+
+    args=(-j 2 -c input-06.txt)
+    testHash 16 7
+
+    args=(--cache output-cache.txt --rebuild-cache -c input-06.txt)
+    testHash 17 7
 else
     fail "Since your program didn't compile, we couldn't test it"
 fi
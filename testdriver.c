@@ -5,10 +5,29 @@
 */
 
 #include <stdlib.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "byteBuffer.h"
 #include "ripeMD.h"
+#include "fileHash.h"
+#include "ripeMDLanes.h"
+#include "hashPool.h"
+#include "treeHash.h"
+#include "uringHash.h"
+#include "recordHash.h"
+#include "outputBuffer.h"
+#include "digestFormat.h"
+#include "verify.h"
+#include "digestCache.h"
+#include "midstate.h"
+#include "hmac.h"
+#include "pbkdf2.h"
+#include "stats.h"
+#include "perfCounters.h"
 
 /** Total number or tests we tried. */
 static int totalTests = 0;
@@ -17,7 +36,7 @@ static int totalTests = 0;
 static int passedTests = 0;
 
 /** Number of tests we should have, if they're all turned on. */
-#define EXPECTED_TOTAL 97
+#define EXPECTED_TOTAL 216
 
 /** Macro to check the condition on a test case, keep counts of
     passed/failed tests and report a message if the test fails. */
@@ -30,8 +49,184 @@ static int passedTests = 0;
   } \
 }
 
-int main()
+/** Returns true if the given digest matches the given string of
+    hex digits. */
+static int digestMatches( const byte digest[ DIGEST_BYTES ], const char *hex )
 {
+  char str[ DIGEST_BYTES * 2 + 1 ];
+  for ( int i = 0; i < DIGEST_BYTES; i++ )
+    sprintf( str + i * 2, "%02x", digest[ i ] );
+  return strcmp( str, hex ) == 0;
+}
+
+/** Callback for hashFiles(); checks jobs are reported in order. */
+static void countJob( FileJob *job, void *arg )
+{
+  FileJob **expected = (FileJob **) arg;
+  if ( job == *expected )
+    *expected += 1;
+}
+
+/** Digests collected from hashRecords(). */
+typedef struct {
+  /** Storage for the digests. */
+  byte digests[ 8 * DIGEST_BYTES ];
+
+  /** Number of digests collected. */
+  size_t n;
+} CollectedDigests;
+
+/** Callback for hashRecords(); keeps the first few digests. */
+static void collectDigests( const byte *digests, size_t n, void *arg )
+{
+  CollectedDigests *collected = (CollectedDigests *) arg;
+  for ( size_t i = 0; i < n; i++, collected->n++ )
+    if ( collected->n < 8 )
+      memcpy( collected->digests + collected->n * DIGEST_BYTES, digests + i * DIGEST_BYTES,
+              DIGEST_BYTES );
+}
+
+/** Standard test vectors for checking every kernel. */
+static const struct {
+  /** Message, or a single character to repeat. */
+  const char *msg;
+
+  /** Number of times to repeat msg, or 1 to use it as is. */
+  int repeat;
+
+  /** Expected digest in hex. */
+  const char *digest;
+} kernelVectors[] = {
+  { "", 1, "9c1185a5c5e9fc54612808977ee8f548b2258d31" },
+  { "abc", 1, "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc" },
+  { "message digest", 1, "5d0689ef49d2fae572b881b123a85ffa21595f36" },
+  { "This is a short input file.\n", 1, "ca7c79428444ad2747e8db47cf13868f63bd1961" },
+  { "x", 55, "c35538a4ab9792cab98479aa3ae2cc435c699b64" },
+  { "x", 56, "af13b5ead9b74a9a6b97c4a612ddfd0baf61ff11" },
+  { "x", 64, "bab3f04cc25d952a882718636600f5b22307ac41" },
+  { "a", 1000000, "52783243c1697bdbe16d37f97f68f08325dc1528" },
+};
+
+/** Number of entries in kernelVectors. */
+#define NUM_KERNEL_VECTORS ( sizeof( kernelVectors ) / sizeof( kernelVectors[ 0 ] ) )
+
+/**
+    Runs the standard vectors through every kernel and multi-lane engine
+    compiled into this build, reporting a line for each.  Kernels the CPU
+    can't run are reported as skipped.
+
+    @return exit status
+  */
+static int testKernels()
+{
+  const byte *msgs[ NUM_KERNEL_VECTORS ];
+  size_t lens[ NUM_KERNEL_VECTORS ];
+  byte digests[ NUM_KERNEL_VECTORS * DIGEST_BYTES ];
+  int failed = 0;
+
+  for ( int v = 0; v < NUM_KERNEL_VECTORS; v++ ) {
+    if ( kernelVectors[ v ].repeat == 1 ) {
+      msgs[ v ] = (const byte *) kernelVectors[ v ].msg;
+      lens[ v ] = strlen( kernelVectors[ v ].msg );
+    } else {
+      byte *msg = (byte *) malloc( kernelVectors[ v ].repeat );
+      memset( msg, kernelVectors[ v ].msg[ 0 ], kernelVectors[ v ].repeat );
+      msgs[ v ] = msg;
+      lens[ v ] = kernelVectors[ v ].repeat;
+    }
+  }
+
+  for ( int k = 0; k < numBlockKernels; k++ ) {
+    if ( selectBlockKernel( blockKernels[ k ].name ) != 0 ) {
+      printf( "kernel %-10s skipped (not supported by this CPU)\n", blockKernels[ k ].name );
+      continue;
+    }
+
+    int ok = 1;
+    for ( int v = 0; v < NUM_KERNEL_VECTORS; v++ ) {
+      HashContext ctx;
+      initContext( &ctx );
+      updateContext( &ctx, msgs[ v ], lens[ v ] );
+      finishContext( &ctx, digests );
+      ok = ok && digestMatches( digests, kernelVectors[ v ].digest );
+    }
+
+    printf( "kernel %-10s %s\n", blockKernels[ k ].name, ok ? "pass" : "FAIL" );
+    failed |= !ok;
+  }
+
+  for ( int e = 0; e < numLaneEngines; e++ ) {
+    if ( selectLaneEngine( laneEngines[ e ].name ) != 0 ) {
+      printf( "engine %-10s skipped (not supported by this CPU)\n", laneEngines[ e ].name );
+      continue;
+    }
+
+    hashMessages( msgs, lens, NUM_KERNEL_VECTORS, digests );
+    int ok = 1;
+    for ( int v = 0; v < NUM_KERNEL_VECTORS; v++ )
+      ok = ok && digestMatches( digests + v * DIGEST_BYTES, kernelVectors[ v ].digest );
+
+    printf( "engine %-10s %s\n", laneEngines[ e ].name, ok ? "pass" : "FAIL" );
+    failed |= !ok;
+  }
+
+  for ( int v = 0; v < NUM_KERNEL_VECTORS; v++ )
+    if ( kernelVectors[ v ].repeat != 1 )
+      free( (byte *) msgs[ v ] );
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/** Size of the repeating chunk in synthetic streams. */
+#define SYNTHETIC_CHUNK_BYTES ( 1024 * 1024 )
+
+/**
+    Hashes a synthetic message of the given length without holding it in
+    memory: a 1 MiB pattern, byte i being i * 31 + 7, repeated over and over.
+
+    @param total length of the message in bytes
+    @param digest storage for the digest
+  */
+static void hashSynthetic( unsigned long long total, byte digest[ DIGEST_BYTES ] )
+{
+  static byte chunk[ SYNTHETIC_CHUNK_BYTES ];
+  for ( int i = 0; i < SYNTHETIC_CHUNK_BYTES; i++ )
+    chunk[ i ] = i * 31 + 7;
+
+  HashContext ctx;
+  initContext( &ctx );
+  for ( ; total >= SYNTHETIC_CHUNK_BYTES; total -= SYNTHETIC_CHUNK_BYTES )
+    updateContext( &ctx, chunk, SYNTHETIC_CHUNK_BYTES );
+  updateContext( &ctx, chunk, total );
+  finishContext( &ctx, digest );
+}
+
+/**
+    Hashes a synthetic stream over 4 GiB, so the byte count itself no
+    longer fits in 32 bits.  This takes a while, so it's run separately.
+
+    @return exit status
+  */
+static int testLarge()
+{
+  byte digest[ DIGEST_BYTES ];
+  hashSynthetic( ( 4ULL << 30 ) + 5, digest );
+  int ok = digestMatches( digest, "53b2606ab8d88da4e417c16c2c529073298d31fe" );
+
+  printf( "4 GiB stream %s\n", ok ? "pass" : "FAIL" );
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main( int argc, char *argv[] )
+{
+  // With "kernels" on the command line, just check every compiled-in kernel.
+  if ( argc > 1 && strcmp( argv[ 1 ], "kernels" ) == 0 )
+    return testKernels();
+
+  // With "large", hash a synthetic stream of several GiB.
+  if ( argc > 1 && strcmp( argv[ 1 ], "large" ) == 0 )
+    return testLarge();
+
   // As you finish parts of your implementation, move this directive
   // down past the blocks of code below.  That will enable tests of
   // various functions you're expected to implement.
@@ -102,6 +297,28 @@ int main()
     freeBuffer( buffer );
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Test addBytes()
+  
+  {
+    ByteBuffer *buffer = createBuffer();
+
+    // A range that fits without growing.
+    addBytes( buffer, (const byte *) "abc", 3 );
+    TestCase( buffer->len == 3 );
+    TestCase( buffer->cap == 5 );
+
+    // A range much bigger than the capacity should grow it in one step.
+    byte block[ 100 ];
+    memset( block, '#', sizeof( block ) );
+    addBytes( buffer, block, sizeof( block ) );
+    TestCase( buffer->len == 103 );
+    TestCase( buffer->cap >= 103 );
+    TestCase( memcmp( buffer->data, "abc###", 6 ) == 0 );
+
+    freeBuffer( buffer );
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // Test readFile()
   
@@ -146,9 +363,20 @@ int main()
     TestCase( buffer->len == 11328 );
     TestCase( buffer->data[ 11327 ] == 0x1b );
     
+    // Padding fits without growing the buffer.
+    size_t cap = buffer->cap;
+    padBuffer( buffer );
+    TestCase( buffer->cap == cap );
+    
     freeBuffer( buffer );
   }
   
+  {
+    // A directory opens, but reading it fails.
+    ByteBuffer *buffer = readFile( "." );
+    TestCase( buffer == NULL );
+  }
+  
   {
     // Try a file that doesn't exist.
     ByteBuffer *buffer = readFile( "no-input-file.txt" );
@@ -365,6 +593,20 @@ int main()
     freeBuffer( buffer );
   }
 
+  {
+    // 60 bytes leaves no room for the length, so it takes an extra block.
+    ByteBuffer *buffer = createBuffer();
+    byte msg[ 60 ];
+    memset( msg, 'x', sizeof( msg ) );
+    addBytes( buffer, msg, sizeof( msg ) );
+    padBuffer( buffer );
+
+    TestCase( buffer->len == 128 );
+    TestCase( buffer->data[ 60 ] == 0x80 && buffer->data[ 119 ] == 0x00 );
+    TestCase( buffer->data[ 120 ] == 0xE0 && buffer->data[ 121 ] == 0x01 );
+    freeBuffer( buffer );
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // Test the hashIteration() function
   
@@ -552,6 +794,824 @@ int main()
     TestCase( state.E == 0x639BEE89 );
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Test the hashBlocks() function
+
+  {
+    // Three blocks starting at an odd address should give the same state
+    // as three separate hashBlock() calls.
+    byte storage[ BLOCK_BYTES * 3 + 1 ];
+    for ( int i = 0; i < sizeof( storage ); i++ )
+      storage[ i ] = i * 13 + 5;
+    byte *data = storage + 1;
+
+    HashState expected, state;
+    initState( &expected );
+    for ( int i = 0; i < 3; i++ ) {
+      byte block[ BLOCK_BYTES ];
+      memcpy( block, data + i * BLOCK_BYTES, BLOCK_BYTES );
+      hashBlock( &expected, block );
+    }
+
+    initState( &state );
+    hashBlocks( &state, data, 3 );
+    TestCase( memcmp( &state, &expected, sizeof( HashState ) ) == 0 );
+
+    // Zero blocks leaves the state alone.
+    hashBlocks( &state, data, 0 );
+    TestCase( memcmp( &state, &expected, sizeof( HashState ) ) == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Compare the specialized kernel against the reference one.
+
+  {
+    // Same vector as the first hashBlock() test, through the reference kernel.
+    HashState state = { 0x61975820, 0x20DF29DA, 0x1BA7D460, 0x304626E9,
+                        0x0372D2E9 };
+    byte data[ BLOCK_BYTES ];
+    for ( int i = 0; i < BLOCK_BYTES; i++ )
+      data[ i ] = i;
+
+    HashState expected = state;
+    hashBlocksReference( &expected, data, 1 );
+    hashBlocks( &state, data, 1 );
+    TestCase( memcmp( &state, &expected, sizeof( HashState ) ) == 0 );
+  }
+
+  {
+    // A long run of pseudo-random blocks.
+    byte data[ BLOCK_BYTES * 50 ];
+    unsigned int seed = 12345;
+    for ( int i = 0; i < sizeof( data ); i++ ) {
+      seed = seed * 1103515245 + 12345;
+      data[ i ] = seed >> 16;
+    }
+
+    HashState expected, state;
+    initState( &expected );
+    initState( &state );
+    hashBlocksReference( &expected, data, 50 );
+    hashBlocks( &state, data, 50 );
+    TestCase( memcmp( &state, &expected, sizeof( HashState ) ) == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the streaming context functions.
+
+  {
+    // The same message as input-01.txt, added in uneven pieces.
+    HashContext ctx;
+    byte digest[ DIGEST_BYTES ];
+    const char *str = "This is a short input file.\n";
+
+    initContext( &ctx );
+    updateContext( &ctx, (const byte *) str, 3 );
+    updateContext( &ctx, (const byte *) str + 3, 0 );
+    updateContext( &ctx, (const byte *) str + 3, 25 );
+    finishContext( &ctx, digest );
+
+    TestCase( digestMatches( digest, "ca7c79428444ad2747e8db47cf13868f63bd1961" ) );
+  }
+
+  {
+    // The empty message.
+    HashContext ctx;
+    byte digest[ DIGEST_BYTES ];
+
+    initContext( &ctx );
+    finishContext( &ctx, digest );
+
+    TestCase( digestMatches( digest, "9c1185a5c5e9fc54612808977ee8f548b2258d31" ) );
+  }
+
+  {
+    // Lengths around the point where padding needs an extra block.
+    byte msg[ BLOCK_BYTES ];
+    memset( msg, 'x', sizeof( msg ) );
+    byte digest[ DIGEST_BYTES ];
+    HashContext ctx;
+
+    initContext( &ctx );
+    updateContext( &ctx, msg, 55 );
+    finishContext( &ctx, digest );
+    TestCase( digestMatches( digest, "c35538a4ab9792cab98479aa3ae2cc435c699b64" ) );
+
+    initContext( &ctx );
+    updateContext( &ctx, msg, 56 );
+    finishContext( &ctx, digest );
+    TestCase( digestMatches( digest, "af13b5ead9b74a9a6b97c4a612ddfd0baf61ff11" ) );
+  }
+
+  {
+    // A longer message, added 7 bytes at a time so the partial block
+    // keeps getting topped up.
+    byte msg[ 7 ];
+    memset( msg, 'a', sizeof( msg ) );
+    byte digest[ DIGEST_BYTES ];
+    HashContext ctx;
+
+    initContext( &ctx );
+    for ( int i = 0; i < 1000 / 7; i++ )
+      updateContext( &ctx, msg, 7 );
+    updateContext( &ctx, msg, 1000 % 7 );
+    finishContext( &ctx, digest );
+
+    TestCase( digestMatches( digest, "aa69deee9a8922e92f8105e007f76110f381e9cf" ) );
+  }
+
+  {
+    // The length field holds all 64 bits of the bit count, even past
+    // 512 MiB, where the count no longer fits in 32 bits.
+    byte tail[ 2 * BLOCK_BYTES ];
+    padFinalBlocks( tail, NULL, 0, ( 5ULL << 30 ) + 1 );
+    byte expected[ LENGTH_BYTES ] = { 0x08, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x00, 0x00 };
+    TestCase( memcmp( tail + BLOCK_BYTES - LENGTH_BYTES, expected, LENGTH_BYTES ) == 0 );
+
+    // A synthetic stream just over 512 MiB, hashed without storing it.
+    byte digest[ DIGEST_BYTES ];
+    hashSynthetic( ( 512ULL << 20 ) + 3, digest );
+    TestCase( digestMatches( digest, "33fb50b9fbfe4bc421f8234e4d2b6794a3160281" ) );
+  }
+
+  {
+    // hashShort() on the standard vectors.
+    byte digest[ DIGEST_BYTES ];
+    hashShort( (const byte *) "", 0, digest );
+    TestCase( digestMatches( digest, "9c1185a5c5e9fc54612808977ee8f548b2258d31" ) );
+
+    hashShort( (const byte *) "abc", 3, digest );
+    TestCase( digestMatches( digest, "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc" ) );
+
+    // Every length from one block to three should match the context.
+    byte msg[ 3 * BLOCK_BYTES ];
+    for ( int i = 0; i < sizeof( msg ); i++ )
+      msg[ i ] = i * 7;
+    int ok = 1;
+    for ( int len = 0; len <= sizeof( msg ); len++ ) {
+      byte expected[ DIGEST_BYTES ];
+      HashContext ctx;
+      initContext( &ctx );
+      updateContext( &ctx, msg, len );
+      finishContext( &ctx, expected );
+      hashShort( msg, len, digest );
+      ok = ok && memcmp( digest, expected, DIGEST_BYTES ) == 0;
+    }
+    TestCase( ok );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the multi-lane engines.
+
+  {
+    // A mix of message lengths, so lanes finish at different times and
+    // get handed new messages.  Every engine this CPU can run should give
+    // the same digests as the streaming context.
+    enum { COUNT = 53 };
+    static byte storage[ 400 * COUNT ];
+    const byte *msgs[ COUNT ];
+    size_t lens[ COUNT ];
+    byte expected[ COUNT * DIGEST_BYTES ], digests[ COUNT * DIGEST_BYTES ];
+
+    for ( int i = 0; i < sizeof( storage ); i++ )
+      storage[ i ] = i * 31 + ( i >> 9 );
+
+    for ( int i = 0; i < COUNT; i++ ) {
+      msgs[ i ] = storage + i * 400 + i % 3;
+      lens[ i ] = ( i * 97 ) % 390;
+      HashContext ctx;
+      initContext( &ctx );
+      updateContext( &ctx, msgs[ i ], lens[ i ] );
+      finishContext( &ctx, expected + i * DIGEST_BYTES );
+    }
+
+    int ok = 1;
+    for ( int e = 0; e < numLaneEngines; e++ ) {
+      const LaneEngine *engine = &laneEngines[ e ];
+      if ( engine->supported() ) {
+        memset( digests, 0, sizeof( digests ) );
+        hashMessagesLanes( engine, msgs, lens, COUNT, digests );
+        if ( memcmp( digests, expected, sizeof( digests ) ) != 0 ) {
+          printf( "Engine %s doesn't match\n", engine->name );
+          ok = 0;
+        }
+      }
+    }
+    TestCase( numLaneEngines > 0 );
+    TestCase( ok );
+
+    // hashMany() on the same messages, as offsets into the arena.
+    size_t offsets[ COUNT ];
+    for ( int i = 0; i < COUNT; i++ )
+      offsets[ i ] = msgs[ i ] - storage;
+    memset( digests, 0, sizeof( digests ) );
+    hashMany( storage, offsets, lens, COUNT, digests );
+    TestCase( memcmp( digests, expected, sizeof( digests ) ) == 0 );
+  }
+
+  {
+    // The fixed-length entry points, one message at a time and in batches.
+    // 37 messages leaves some lanes idle in the last group on every engine.
+    enum { COUNT = 37 };
+    static byte storage[ 65 * COUNT ];
+    byte expected[ COUNT * DIGEST_BYTES ], digests[ COUNT * DIGEST_BYTES ];
+    static const size_t lengths[] = { 32, 33, 65 };
+    void (*single[])( const byte *, byte [ DIGEST_BYTES ] ) = { hash32, hash33, hash65 };
+    void (*batch[])( const byte *, size_t, byte * ) = { hashBatch32, hashBatch33, hashBatch65 };
+
+    for ( int i = 0; i < sizeof( storage ); i++ )
+      storage[ i ] = i * 13 + ( i >> 7 );
+
+    int singleOk = 1, batchOk = 1;
+    for ( int l = 0; l < 3; l++ ) {
+      for ( int i = 0; i < COUNT; i++ ) {
+        hashShort( storage + i * lengths[ l ], lengths[ l ], expected + i * DIGEST_BYTES );
+        single[ l ]( storage + i * lengths[ l ], digests + i * DIGEST_BYTES );
+      }
+      singleOk = singleOk && memcmp( digests, expected, sizeof( digests ) ) == 0;
+
+      memset( digests, 0, sizeof( digests ) );
+      batch[ l ]( storage, COUNT, digests );
+      batchOk = batchOk && memcmp( digests, expected, sizeof( digests ) ) == 0;
+
+      for ( int e = 0; e < numLaneEngines; e++ ) {
+        if ( laneEngines[ e ].supported() ) {
+          memset( digests, 0, sizeof( digests ) );
+          hashFixedLanes( &laneEngines[ e ], storage, lengths[ l ], COUNT, digests );
+          batchOk = batchOk && memcmp( digests, expected, sizeof( digests ) ) == 0;
+        }
+      }
+    }
+    TestCase( singleOk );
+    TestCase( batchOk );
+
+    // A length spanning several whole blocks, through the general version.
+    memset( digests, 0, DIGEST_BYTES * 5 );
+    hashFixedLanes( activeLaneEngine(), storage, 150, 5, digests );
+    hashShort( storage + 4 * 150, 150, expected );
+    TestCase( memcmp( digests + 4 * DIGEST_BYTES, expected, DIGEST_BYTES ) == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test hashFiles()
+
+  {
+    FileJob jobs[ 20 ];
+    for ( int i = 0; i < 20; i++ )
+      jobs[ i ].path = i == 7 ? "no-input-file.txt" : i % 2 ? "input-01.txt" : "input-05.bin";
+
+    // Every job should be reported once, in order.
+    FileJob *next = jobs;
+    hashFiles( jobs, 20, 3, NULL, countJob, &next );
+    TestCase( next == jobs + 20 );
+
+    TestCase( digestMatches( jobs[ 3 ].digest, "ca7c79428444ad2747e8db47cf13868f63bd1961" ) );
+    TestCase( digestMatches( jobs[ 18 ].digest, "f81dbcbd97a637ba633148a1b694583523540bfd" ) );
+    TestCase( jobs[ 7 ].error != 0 && jobs[ 6 ].error == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test hashFilesUring(), which is the same as hashFiles() without io_uring
+
+  {
+    FileJob jobs[ 20 ];
+    for ( int i = 0; i < 20; i++ )
+      jobs[ i ].path = i == 7 ? "no-input-file.txt" : i % 2 ? "input-01.txt" : "input-05.bin";
+
+    FileJob *next = jobs;
+    hashFilesUring( jobs, 20, 3, countJob, &next );
+    TestCase( next == jobs + 20 );
+
+    TestCase( digestMatches( jobs[ 3 ].digest, "ca7c79428444ad2747e8db47cf13868f63bd1961" ) );
+    TestCase( digestMatches( jobs[ 18 ].digest, "f81dbcbd97a637ba633148a1b694583523540bfd" ) );
+    TestCase( jobs[ 7 ].error != 0 && jobs[ 6 ].error == 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the tree hash
+
+  {
+    // An empty message is one empty leaf, under one parent.
+    byte digest[ DIGEST_BYTES ];
+    treeLeaf( NULL, 0, digest );
+    treeCombine( digest, 1, 4, digest );
+    TestCase( digestMatches( digest, "468d7518d69d17256575b3b2336d43056f0e3ca8" ) );
+
+    // 12 leaves with fanout 4 gives three levels, hashed on several threads.
+    TestCase( treeHashFile( "input-05.bin", 1024, 4, 3, digest ) == 0 );
+    TestCase( digestMatches( digest, "43d71f6321835db8933b1b2447138790a01d3b43" ) );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test hashFile()
+
+  {
+    // A small file goes through the streaming path.
+    byte digest[ DIGEST_BYTES ];
+    TestCase( hashFile( "input-01.txt", digest ) == 0 );
+    TestCase( digestMatches( digest, "ca7c79428444ad2747e8db47cf13868f63bd1961" ) );
+
+    TestCase( hashFile( "no-input-file.txt", digest ) != 0 );
+  }
+
+  {
+    // A file past the mapping threshold, with a partial last block, should
+    // hash the same as the streaming context.
+    const char *filename = "output-mmap.txt";
+    FILE *fp = fopen( filename, "wb" );
+    HashContext ctx;
+    initContext( &ctx );
+    for ( int i = 0; i < MMAP_THRESHOLD_BYTES * 2 + 37; i++ ) {
+      byte b = i * 7 + ( i >> 8 );
+      fputc( b, fp );
+      updateContext( &ctx, &b, 1 );
+    }
+    fclose( fp );
+
+    byte expected[ DIGEST_BYTES ], digest[ DIGEST_BYTES ];
+    finishContext( &ctx, expected );
+    hashFile( filename, digest );
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+    remove( filename );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test hashRecords() and OutputBuffer
+
+  {
+    // Two short records, an empty one, and a last one with no newline that's
+    // longer than the read buffer, so the buffer has to grow.
+    const char *filename = "output-records.txt";
+    FILE *fp = fopen( filename, "wb" );
+    fputs( "abc\nmessage digest\n\n", fp );
+    for ( int i = 0; i < 5 * 1024 * 1024; i++ )
+      fputc( 'a', fp );
+    fclose( fp );
+
+    CollectedDigests collected = { { 0 }, 0 };
+    int fd = open( filename, O_RDONLY );
+    TestCase( hashRecords( fd, '\n', 2, collectDigests, &collected ) == 0 );
+    close( fd );
+
+    TestCase( collected.n == 4 );
+    TestCase( digestMatches( collected.digests, "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc" ) );
+    TestCase( digestMatches( collected.digests + 1 * DIGEST_BYTES, "5d0689ef49d2fae572b881b123a85ffa21595f36" ) );
+    TestCase( digestMatches( collected.digests + 2 * DIGEST_BYTES, "9c1185a5c5e9fc54612808977ee8f548b2258d31" ) );
+    TestCase( digestMatches( collected.digests + 3 * DIGEST_BYTES, "14299a3a8c5af90110d26d3bf773a33f4b69d982" ) );
+
+    // The same file split on NUL is one record.
+    collected.n = 0;
+    fd = open( filename, O_RDONLY );
+    hashRecords( fd, '\0', 1, collectDigests, &collected );
+    close( fd );
+    TestCase( collected.n == 1 );
+
+    // Write a digest in hex through an OutputBuffer and read it back.
+    fd = open( filename, O_WRONLY | O_TRUNC );
+    OutputBuffer *out = createOutput( fd );
+    putDigest( out, FORMAT_HEX, collected.digests );
+    putBytes( out, "\n", 1 );
+    TestCase( freeOutput( out ) == 0 );
+    close( fd );
+
+    char line[ 64 ] = "";
+    fp = fopen( filename, "r" );
+    fgets( line, sizeof( line ), fp );
+    fclose( fp );
+    TestCase( strcmp( line, "505b5116ec40c8cef0002b9f7b1adc04390d4b9f\n" ) == 0 );
+    remove( filename );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the digest formats
+
+  {
+    // RIPEMD-160 of "abc", in each format.
+    byte digest[ DIGEST_BYTES ];
+    char text[ MAX_FORMATTED_DIGEST ];
+    hashShort( (const byte *) "abc", 3, digest );
+
+    TestCase( formatDigest( FORMAT_HEX, digest, text ) == HEX_DIGEST_CHARS );
+    TestCase( memcmp( text, "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc", HEX_DIGEST_CHARS ) == 0 );
+
+    TestCase( formatDigest( FORMAT_BASE64, digest, text ) == BASE64_DIGEST_CHARS );
+    TestCase( memcmp( text, "jrII9+BdmHqbBEqOmMawh/FaC/w=", BASE64_DIGEST_CHARS ) == 0 );
+
+    TestCase( formatDigest( FORMAT_RAW, digest, text ) == DIGEST_BYTES );
+    TestCase( memcmp( text, digest, DIGEST_BYTES ) == 0 );
+
+    DigestFormat format;
+    TestCase( parseFormat( "base64", &format ) == 0 && format == FORMAT_BASE64 );
+    TestCase( parseFormat( "octal", &format ) != 0 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test checking against a manifest
+
+  {
+    byte digest[ DIGEST_BYTES ];
+    TestCase( parseHexDigest( "8EB208F7E05D987A9B044A8E98C6B087F15A0BFC", digest ) == 0 &&
+              digestMatches( digest, "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc" ) );
+    TestCase( parseHexDigest( "8eb208f7e05d987a9b044a8e98c6b087f15a0bf", digest ) != 0 );
+
+    // One good entry, one wrong digest, one bad line and one missing file.
+    const char *filename = "output-manifest.txt";
+    FILE *fp = fopen( filename, "w" );
+    fputs( "ca7c79428444ad2747e8db47cf13868f63bd1961  input-01.txt\n"
+           "ca7c79428444ad2747e8db47cf13868f63bd1961  input-02.txt\n"
+           "ca7c79428444ad2747e8db47cf13868f63bd1961\n"
+           "ca7c79428444ad2747e8db47cf13868f63bd1961  no-input-file.txt\n", fp );
+    fclose( fp );
+
+    // Send the results and stderr to the same file, to check the warning
+    // comes out between the results around it.
+    const char *reportname = "output-verify.txt";
+    int fd = open( reportname, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+    int savedStderr = dup( STDERR_FILENO );
+    dup2( fd, STDERR_FILENO );
+    OutputBuffer *out = createOutput( fd );
+    VerifyCounts counts;
+    TestCase( verifyManifest( filename, 2, NULL, out, &counts ) == 0 );
+    freeOutput( out );
+    dup2( savedStderr, STDERR_FILENO );
+    close( savedStderr );
+    close( fd );
+    TestCase( counts.ok == 1 && counts.failed == 1 && counts.missing == 1 && counts.malformed == 1 );
+    TestCase( verifyStatus( &counts ) == ( VERIFY_FAILED | VERIFY_UNREADABLE | VERIFY_MALFORMED ) );
+
+    const char *expectedReport = "input-02.txt: FAILED\n"
+                                 "output-manifest.txt:3: improperly formatted line\n"
+                                 "no-input-file.txt: MISSING\n";
+    ByteBuffer *buffer = readFile( reportname );
+    TestCase( buffer && buffer->len == strlen( expectedReport ) &&
+              memcmp( buffer->data, expectedReport, buffer->len ) == 0 );
+    freeBuffer( buffer );
+    remove( reportname );
+    remove( filename );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the digest cache
+
+  {
+    const char *filename = "output-cache.txt";
+    byte digest[ DIGEST_BYTES ], found[ DIGEST_BYTES ];
+    for ( int i = 0; i < DIGEST_BYTES; i++ )
+      digest[ i ] = i * 13;
+
+    DigestCache *cache = openCache( filename, 1 );
+    TestCase( cache != NULL );
+    CacheKey key = { 1, 2, 3, 4 };
+    TestCase( !cacheLookup( cache, &key, found ) );
+    cacheStore( cache, &key, digest );
+    TestCase( cacheLookup( cache, &key, found ) && memcmp( found, digest, DIGEST_BYTES ) == 0 );
+
+    // A new version of the same file misses, and replaces the old one.
+    CacheKey touched = { 1, 2, 3, 5 };
+    TestCase( !cacheLookup( cache, &touched, found ) );
+    cacheStore( cache, &touched, digest );
+    TestCase( !cacheLookup( cache, &key, found ) && cache->header->count == 1 );
+
+    // Enough files to make the table grow.
+    for ( int i = 0; i < CACHE_INITIAL_SLOTS; i++ ) {
+      CacheKey other = { 7, i, i, i };
+      digest[ 0 ] = i;
+      cacheStore( cache, &other, digest );
+    }
+    TestCase( cache->capacity > CACHE_INITIAL_SLOTS && cache->header->count == CACHE_INITIAL_SLOTS + 1 );
+    closeCache( cache );
+
+    // Everything is still there after reopening.
+    cache = openCache( filename, 0 );
+    int all = 1;
+    for ( int i = 0; i < CACHE_INITIAL_SLOTS; i++ ) {
+      CacheKey other = { 7, i, i, i };
+      all = all && cacheLookup( cache, &other, found ) && found[ 0 ] == (byte) i && found[ 1 ] == 13;
+    }
+    TestCase( all && cacheLookup( cache, &touched, found ) );
+    // The file also counts the hit from before it was reopened.
+    TestCase( cache->hits == CACHE_INITIAL_SLOTS + 1 && cache->header->hits == CACHE_INITIAL_SLOTS + 2 );
+    closeCache( cache );
+
+    // Rebuilding throws it all away.
+    cache = openCache( filename, 1 );
+    TestCase( !cacheLookup( cache, &touched, found ) && cache->header->count == 0 );
+
+    // A real file gets the right digest either way, and a directory isn't
+    // something to cache.
+    TestCase( hashFileCached( cache, hashFile, "input-01.txt", found ) == 0 &&
+              digestMatches( found, "ca7c79428444ad2747e8db47cf13868f63bd1961" ) );
+    TestCase( hashFileCached( cache, hashFile, "input-01.txt", found ) == 0 &&
+              digestMatches( found, "ca7c79428444ad2747e8db47cf13868f63bd1961" ) );
+    TestCase( cacheKeyOf( "input-01.txt", &key ) == 1 && cacheKeyOf( ".", &key ) == 0 );
+    closeCache( cache );
+    remove( filename );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test midstate export and import
+
+  {
+    byte msg[ 300 ], expected[ DIGEST_BYTES ], digest[ DIGEST_BYTES ];
+    for ( int i = 0; i < sizeof( msg ); i++ )
+      msg[ i ] = i * 7 + 3;
+    hashShort( msg, sizeof( msg ), expected );
+
+    // Stop partway through a block, move the state to a fresh context, and
+    // carry on.
+    HashContext ctx, resumed;
+    initContext( &ctx );
+    updateContext( &ctx, msg, 150 );
+    byte saved[ MIDSTATE_BYTES ];
+    exportMidstate( &ctx, saved );
+    TestCase( importMidstate( &resumed, saved ) == 0 );
+    updateContext( &resumed, msg + 150, sizeof( msg ) - 150 );
+    finishContext( &resumed, digest );
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    // The layout is fixed: A is stored least significant byte first.
+    TestCase( saved[ 8 ] == ( ctx.state.A & 0xFF ) && saved[ 28 ] == 150 );
+
+    // Anything inconsistent is turned away.
+    saved[ 0 ] ^= 1;
+    TestCase( importMidstate( &resumed, saved ) != 0 );
+    saved[ 0 ] ^= 1;
+    saved[ 36 ]++;
+    TestCase( importMidstate( &resumed, saved ) != 0 );
+
+    // Through a file, and extended as the file grows.
+    const char *filename = "output-append.txt";
+    const char *sidecar = "output-append.txt" MIDSTATE_SUFFIX;
+    remove( sidecar );
+    FILE *fp = fopen( filename, "wb" );
+    fwrite( msg, 1, 100, fp );
+    fclose( fp );
+    TestCase( hashFileAppending( filename, digest ) == 0 );
+    ByteBuffer *state = readFile( sidecar );
+    TestCase( state && state->len == SIDECAR_BYTES && importMidstate( &resumed, state->data ) == 0 &&
+              resumed.length == 100 );
+    freeBuffer( state );
+
+    fp = fopen( filename, "ab" );
+    fwrite( msg + 100, 1, sizeof( msg ) - 100, fp );
+    fclose( fp );
+    TestCase( hashFileAppending( filename, digest ) == 0 && memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    // A file that was rewritten instead of appended to is hashed from the
+    // start.
+    msg[ 299 ]++;
+    fp = fopen( filename, "wb" );
+    fwrite( msg, 1, sizeof( msg ), fp );
+    fclose( fp );
+    hashShort( msg, sizeof( msg ), expected );
+    TestCase( hashFileAppending( filename, digest ) == 0 && memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    // So is one that shrank.
+    fp = fopen( filename, "wb" );
+    fwrite( msg, 1, 10, fp );
+    fclose( fp );
+    hashShort( msg, 10, expected );
+    TestCase( hashFileAppending( filename, digest ) == 0 && memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    // So is one rewritten to the same length, ending on a block boundary
+    // so there are no buffered bytes to compare.
+    fp = fopen( filename, "wb" );
+    fwrite( msg, 1, 128, fp );
+    fclose( fp );
+    TestCase( hashFileAppending( filename, digest ) == 0 );
+    msg[ 100 ]++;
+    fp = fopen( filename, "wb" );
+    fwrite( msg, 1, 128, fp );
+    fclose( fp );
+    hashShort( msg, 128, expected );
+    TestCase( hashFileAppending( filename, digest ) == 0 && memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    // And a log rotated out from under its sidecar, even when the end of
+    // the old prefix is the same.
+    const char *rotated = "output-rotated.txt";
+    msg[ 0 ]++;
+    fp = fopen( rotated, "wb" );
+    fwrite( msg, 1, sizeof( msg ), fp );
+    fclose( fp );
+    rename( rotated, filename );
+    hashShort( msg, sizeof( msg ), expected );
+    TestCase( hashFileAppending( filename, digest ) == 0 && memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+
+    // A sidecar that can't be written is a warning, not a failure.  A
+    // directory where its temporary file goes makes sure of that, even as
+    // root.
+    const char *blocker = "output-append.txt" MIDSTATE_SUFFIX ".tmp";
+    const char *warnings = "output-warnings.txt";
+    remove( sidecar );
+    mkdir( blocker, 0755 );
+    int errFd = open( warnings, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+    int savedStderr = dup( STDERR_FILENO );
+    dup2( errFd, STDERR_FILENO );
+    int status = hashFileAppending( filename, digest );
+    dup2( savedStderr, STDERR_FILENO );
+    close( savedStderr );
+    close( errFd );
+    TestCase( status == 0 && memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+    ByteBuffer *warning = readFile( warnings );
+    TestCase( warning && warning->len > strlen( sidecar ) &&
+              memcmp( warning->data, sidecar, strlen( sidecar ) ) == 0 );
+    freeBuffer( warning );
+    rmdir( blocker );
+    remove( warnings );
+    remove( filename );
+    remove( sidecar );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test HMAC-RIPEMD160
+
+  {
+    // Vectors from RFC 2286.
+    byte secret[ 80 ], mac[ DIGEST_BYTES ];
+    HmacKey key;
+    memset( secret, 0x0B, 20 );
+    hmacInit( &key, secret, 20 );
+    hmacMessage( &key, (const byte *) "Hi There", 8, mac );
+    TestCase( digestMatches( mac, "24cb4bd67d20fc1a5d2ed7732dcc39377f0a5668" ) );
+
+    hmacInit( &key, (const byte *) "Jefe", 4 );
+    const char *question = "what do ya want for nothing?";
+    hmacMessage( &key, (const byte *) question, strlen( question ), mac );
+    TestCase( digestMatches( mac, "dda6c0213a485a9e24f4742064a7f033b43c4069" ) );
+
+    // A key longer than a block is hashed first.
+    HmacKey longKey;
+    memset( secret, 0xAA, 80 );
+    hmacInit( &longKey, secret, 80 );
+    const char *text = "Test Using Larger Than Block-Size Key - Hash Key First";
+    hmacMessage( &longKey, (const byte *) text, strlen( text ), mac );
+    TestCase( digestMatches( mac, "6466ca07ac5eac29e1bd523e5ada7605b791fd8b" ) );
+
+    // A message several blocks long.
+    byte msg[ 300 ];
+    for ( int i = 0; i < sizeof( msg ); i++ )
+      msg[ i ] = i * 7 + 3;
+    hmacMessage( &key, msg, sizeof( msg ), mac );
+    TestCase( digestMatches( mac, "3285f8b79da206835c404871f7b3a94b3f2ee07b" ) );
+
+    // The batch matches one at a time, for more messages than fit in one
+    // run through the lanes and of every length up to a few blocks.
+    size_t n = HMAC_BATCH_MESSAGES + 45;
+    const byte *msgs[ HMAC_BATCH_MESSAGES + 45 ];
+    size_t lens[ HMAC_BATCH_MESSAGES + 45 ];
+    byte *macs = (byte *) malloc( n * DIGEST_BYTES );
+    for ( size_t i = 0; i < n; i++ ) {
+      lens[ i ] = i % ( sizeof( msg ) + 1 );
+      msgs[ i ] = msg + sizeof( msg ) - lens[ i ];
+    }
+    hmacBatch( &key, msgs, lens, n, macs );
+    int same = 1;
+    for ( size_t i = 0; i < n; i++ ) {
+      hmacMessage( &key, msgs[ i ], lens[ i ], mac );
+      same = same && memcmp( mac, macs + i * DIGEST_BYTES, DIGEST_BYTES ) == 0;
+    }
+    TestCase( same );
+    TestCase( digestMatches( macs + 300 * DIGEST_BYTES, "3285f8b79da206835c404871f7b3a94b3f2ee07b" ) );
+    free( macs );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test PBKDF2-HMAC-RIPEMD160
+
+  {
+    // Vectors computed with Python's hashlib.pbkdf2_hmac().
+    byte key[ 50 ];
+    TestCase( pbkdf2( (const byte *) "password", 8, (const byte *) "salt", 4, 1, key, 20 ) == 0 &&
+              digestMatches( key, "b725258b125e0bacb0e2307e34feb16a4d0d6aed" ) );
+    pbkdf2( (const byte *) "password", 8, (const byte *) "salt", 4, 2, key, 20 );
+    TestCase( digestMatches( key, "768dcc27b7bfdef794a1ff9d935090fcf598555e" ) );
+
+    // Several blocks, ending partway through one, with every engine.
+    const char *password = "passwordPASSWORDpassword";
+    const char *salt = "saltSALTsaltSALTsaltSALTsaltSALTsalt";
+    int all = 1;
+    for ( int e = 0; e < numLaneEngines; e++ ) {
+      if ( !laneEngines[ e ].supported() )
+        continue;
+      memset( key, 0, sizeof( key ) );
+      pbkdf2Lanes( &laneEngines[ e ], (const byte *) password, strlen( password ), (const byte *) salt,
+                   strlen( salt ), 4096, key, 50 );
+      all = all && digestMatches( key, "503b9a069633b261b2d3e4f21c5d0cafeb3f5008" ) &&
+        digestMatches( key + 20, "aec25ed21418d12630b6ce036ec82a0430ef1974" ) &&
+        key[ 40 ] == 0xd3 && key[ 49 ] == 0x10;
+    }
+    TestCase( all );
+
+    // Embedded NULs, and a key shorter than a block.
+    pbkdf2( (const byte *) "pass\0word", 9, (const byte *) "sa\0lt", 5, 4096, key, 16 );
+    TestCase( key[ 0 ] == 0x7b && key[ 15 ] == 0x4a );
+
+    // A batch matches one password at a time.
+    const byte *passwords[ 21 ];
+    size_t lens[ 21 ];
+    byte keys[ 21 * 30 ];
+    for ( int i = 0; i < 21; i++ ) {
+      passwords[ i ] = (const byte *) password + i;
+      lens[ i ] = strlen( password ) - i;
+    }
+    TestCase( pbkdf2Batch( passwords, lens, 21, (const byte *) salt, strlen( salt ), 10, keys, 30 ) == 0 );
+    int same = 1;
+    for ( int i = 0; i < 21; i++ ) {
+      pbkdf2( passwords[ i ], lens[ i ], (const byte *) salt, strlen( salt ), 10, key, 30 );
+      same = same && memcmp( key, keys + i * 30, 30 ) == 0;
+    }
+    TestCase( same );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the --stats counters
+
+  {
+    startStats();
+
+    // 5, 10, 20, 40, 80 bytes: four reallocs.
+    ByteBuffer *buffer = createBuffer();
+    for ( int i = 0; i < 80; i++ )
+      addByte( buffer, i );
+    TestCase( statCount( COUNT_REALLOCS ) == 4 && statCount( COUNT_PEAK_CAPACITY ) == 80 );
+
+    HashState state;
+    initState( &state );
+    hashBlocks( &state, buffer->data, 1 );
+    TestCase( statCount( COUNT_BLOCKS ) == 1 );
+    freeBuffer( buffer );
+
+    // The file's bytes, then its final padded block.
+    byte digest[ DIGEST_BYTES ];
+    int fd = open( "input-01.txt", O_RDONLY );
+    hashStream( fd, digest );
+    close( fd );
+    TestCase( statCount( COUNT_BYTES_READ ) == 28 && statCount( COUNT_BLOCKS ) == 2 );
+
+    // Nothing is counted once it's off.
+    statsEnabled = 0;
+    hashShort( digest, DIGEST_BYTES, digest );
+    TestCase( statCount( COUNT_BLOCKS ) == 2 );
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test the hardware performance counters
+
+  {
+    PerfReading reading = { { 300, 600, 50, 5, 0 }, { 1, 1, 1, 1, 0 } };
+    double ratio = 0;
+    TestCase( perfRatio( &reading, PERF_INSTRUCTIONS, PERF_CYCLES, &ratio ) && ratio == 2 );
+    TestCase( perfRatio( &reading, PERF_BRANCH_MISSES, PERF_BRANCHES, &ratio ) && ratio == 0.1 );
+
+    // Missing counts and zero denominators give no ratio.
+    reading.valid[ PERF_BRANCHES ] = 0;
+    TestCase( !perfRatio( &reading, PERF_BRANCH_MISSES, PERF_BRANCHES, &ratio ) );
+    reading.count[ PERF_CYCLES ] = 0;
+    TestCase( !perfRatio( &reading, PERF_INSTRUCTIONS, PERF_CYCLES, &ratio ) );
+
+    // Most virtual machines have no counters, so either outcome is fine,
+    // as long as a failure says why and a success counts something.
+    PerfCounters counters;
+    if ( openPerfCounters( &counters ) != 0 ) {
+      TestCase( errno != 0 && counters.fd[ PERF_CYCLES ] < 0 );
+    } else {
+      byte digest[ DIGEST_BYTES ];
+      startPerfCounters( &counters );
+      for ( int i = 0; i < 1000; i++ )
+        hashShort( digest, DIGEST_BYTES, digest );
+      stopPerfCounters( &counters, &reading );
+      closePerfCounters( &counters );
+      TestCase( ( reading.valid[ PERF_CYCLES ] && reading.count[ PERF_CYCLES ] > 0 ) ||
+                ( reading.valid[ PERF_INSTRUCTIONS ] && reading.count[ PERF_INSTRUCTIONS ] > 0 ) );
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Test hashFilePipelined()
+
+  {
+    // A file that takes a few trips around the ring, ending partway
+    // through a buffer.
+    const char *filename = "output-pipeline.txt";
+    FILE *fp = fopen( filename, "wb" );
+    HashContext ctx;
+    initContext( &ctx );
+    for ( int i = 0; i < PIPELINE_BUFFER_BYTES * ( PIPELINE_BUFFERS + 2 ) + 1000; i++ ) {
+      byte b = i * 11 + ( i >> 12 );
+      fputc( b, fp );
+      updateContext( &ctx, &b, 1 );
+    }
+    fclose( fp );
+
+    byte expected[ DIGEST_BYTES ], digest[ DIGEST_BYTES ];
+    finishContext( &ctx, expected );
+    TestCase( hashFilePipelined( filename, digest ) == 0 );
+    TestCase( memcmp( digest, expected, DIGEST_BYTES ) == 0 );
+    remove( filename );
+
+    TestCase( hashFilePipelined( "no-input-file.txt", digest ) != 0 );
+  }
+
   printf( "You passed %d / %d unit tests\n", passedTests, totalTests );
 
   if ( totalTests != EXPECTED_TOTAL )
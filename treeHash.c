@@ -0,0 +1,298 @@
+/** 
+    @filename treeHash.c
+    @author Will Greene (wgreene)
+    
+    Contains functions for the chunked tree hash, which splits a file into
+    fixed-size leaves that can be hashed in parallel and combines them with
+    a Merkle-style tree of RIPEMD-160 parent hashes.
+*/
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "treeHash.h"
+#include "stats.h"
+
+/** State shared by the leaf-hashing threads. */
+typedef struct {
+  /** File being hashed. */
+  int fd;
+  
+  /** Size of the file. */
+  off_t size;
+  
+  /** Bytes per leaf. */
+  size_t chunkBytes;
+  
+  /** Number of leaves. */
+  size_t chunks;
+  
+  /** Packed leaf digests, one per chunk. */
+  byte *leaves;
+  
+  /** Index of the next chunk nobody has claimed. */
+  size_t next;
+  
+  /** errno value from the first failed read, or zero. */
+  int error;
+} LeafJob;
+
+/**
+    Computes the digest of one leaf of a tree hash: RIPEMD-160 of the leaf
+    prefix byte followed by the chunk.
+    
+    @param chunk message bytes in this leaf
+    @param len number of bytes in chunk
+    @param digest storage for the leaf digest
+  */
+void treeLeaf( const byte *chunk, size_t len, byte digest[ DIGEST_BYTES ] )
+{
+    byte prefix = TREE_LEAF_PREFIX;
+    HashContext ctx;
+    
+    STATS_START( timer );
+    initContext( &ctx );
+    updateContext( &ctx, &prefix, 1 );
+    updateContext( &ctx, chunk, len );
+    finishContext( &ctx, digest );
+    STATS_STOP( timer, STAGE_COMPRESS );
+}
+
+/**
+    Combines a level of n digests into the root of the tree.  Each parent is
+    RIPEMD-160 of the node prefix byte followed by up to fanout child digests,
+    in order.  Levels are combined until a single parent remains, so even a
+    one-leaf tree gets a parent.  The digests array is overwritten.
+    
+    @param digests n packed digests, the leaves
+    @param n number of leaves, at least 1
+    @param fanout maximum children per parent, at least 2
+    @param root storage for the root digest
+  */
+void treeCombine( byte *digests, size_t n, int fanout, byte root[ DIGEST_BYTES ] )
+{
+    byte prefix = TREE_NODE_PREFIX;
+    
+    do {
+        size_t parents = ( n + fanout - 1 ) / fanout;
+        
+        // Parent i only reads children after its own slot, so the level can
+        // be rewritten in place.
+        for ( size_t i = 0; i < parents; i++ ) {
+            size_t first = i * fanout;
+            size_t count = n - first < fanout ? n - first : fanout;
+            
+            HashContext ctx;
+            initContext( &ctx );
+            updateContext( &ctx, &prefix, 1 );
+            updateContext( &ctx, digests + first * DIGEST_BYTES, count * DIGEST_BYTES );
+            finishContext( &ctx, digests + i * DIGEST_BYTES );
+        }
+        
+        n = parents;
+    } while ( n > 1 );
+    
+    memcpy( root, digests, DIGEST_BYTES );
+}
+
+/**
+    Reads exactly len bytes at the given offset, unless the file ends first.
+    
+    @param fd file to read
+    @param buffer storage for the bytes
+    @param len number of bytes wanted
+    @param offset position in the file
+    @return number of bytes read, or -1 on error
+  */
+static ssize_t readFully( int fd, byte *buffer, size_t len, off_t offset )
+{
+    size_t got = 0;
+    
+    while ( got < len ) {
+        ssize_t n = offset < 0 ? read( fd, buffer + got, len - got )
+                               : pread( fd, buffer + got, len - got, offset + got );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+            return -1;
+        if ( n == 0 )
+            break;
+        got += n;
+    }
+    
+    STATS_ADD( COUNT_BYTES_READ, got );
+    
+    return got;
+}
+
+/**
+    Leaf-hashing thread: claims chunks one at a time, reads each with pread()
+    into a private buffer, and stores its leaf digest.
+    
+    @param arg the LeafJob
+    @return NULL
+  */
+static void *leafWorker( void *arg )
+{
+    LeafJob *job = (LeafJob *) arg;
+    byte *buffer = (byte *) malloc( job->chunkBytes );
+    size_t i;
+    
+    while ( ( i = __atomic_fetch_add( &job->next, 1, __ATOMIC_RELAXED ) ) < job->chunks ) {
+        off_t offset = (off_t) i * job->chunkBytes;
+        size_t len = job->size - offset < job->chunkBytes ? job->size - offset : job->chunkBytes;
+        
+        ssize_t got = buffer ? readFully( job->fd, buffer, len, offset ) : -1;
+        if ( got != len ) {
+            // A short read means the file shrank while we were hashing it.
+            __atomic_store_n( &job->error, !buffer ? ENOMEM : got < 0 ? errno : EIO,
+                              __ATOMIC_RELAXED );
+            break;
+        }
+        
+        treeLeaf( buffer, len, job->leaves + i * DIGEST_BYTES );
+    }
+    
+    free( buffer );
+    return NULL;
+}
+
+/**
+    Hashes the leaves of a regular file in parallel.
+    
+    @param fd open file
+    @param size size of the file
+    @param chunkBytes bytes per leaf
+    @param fanout maximum children per parent
+    @param threads number of threads to use
+    @param digest storage for the root digest
+    @return 0 on success, -1 with errno set on failure
+  */
+static int treeHashRegular( int fd, off_t size, size_t chunkBytes, int fanout, int threads,
+                            byte digest[ DIGEST_BYTES ] )
+{
+    size_t chunks = size == 0 ? 1 : ( size + chunkBytes - 1 ) / chunkBytes;
+    LeafJob job = { fd, size, chunkBytes, chunks, (byte *) malloc( chunks * DIGEST_BYTES ), 0, 0 };
+    if ( !job.leaves )
+        return -1;
+    
+    if ( threads > chunks )
+        threads = chunks;
+    
+    // Without room for the thread handles, the calling thread hashes
+    // every chunk.
+    pthread_t *workers = (pthread_t *) malloc( threads * sizeof( pthread_t ) );
+    int started = 0;
+    while ( workers && started < threads - 1 && pthread_create( &workers[ started ], NULL, leafWorker, &job ) == 0 )
+        started++;
+    
+    // The calling thread does its share too.
+    leafWorker( &job );
+    
+    for ( int i = 0; i < started; i++ )
+        pthread_join( workers[ i ], NULL );
+    free( workers );
+    
+    if ( job.error == 0 )
+        treeCombine( job.leaves, chunks, fanout, digest );
+    
+    free( job.leaves );
+    errno = job.error;
+    return job.error ? -1 : 0;
+}
+
+/**
+    Hashes the leaves of a pipe or other non-seekable file, in order.
+    
+    @param fd open file
+    @param chunkBytes bytes per leaf
+    @param fanout maximum children per parent
+    @param digest storage for the root digest
+    @return 0 on success, -1 with errno set on failure
+  */
+static int treeHashStream( int fd, size_t chunkBytes, int fanout, byte digest[ DIGEST_BYTES ] )
+{
+    byte *buffer = (byte *) malloc( chunkBytes );
+    size_t cap = 64, chunks = 0;
+    byte *leaves = (byte *) malloc( cap * DIGEST_BYTES );
+    ssize_t len;
+    
+    if ( !buffer || !leaves ) {
+        free( buffer );
+        free( leaves );
+        return -1;
+    }
+    
+    // Always at least one leaf, even if it's empty.
+    while ( ( len = readFully( fd, buffer, chunkBytes, -1 ) ) > 0 || ( len == 0 && chunks == 0 ) ) {
+        if ( chunks == cap ) {
+            byte *grown = (byte *) realloc( leaves, 2 * cap * DIGEST_BYTES );
+            if ( !grown ) {
+                free( buffer );
+                free( leaves );
+                errno = ENOMEM;
+                return -1;
+            }
+            leaves = grown;
+            cap *= 2;
+        }
+        
+        treeLeaf( buffer, len, leaves + chunks * DIGEST_BYTES );
+        chunks++;
+        
+        if ( len < chunkBytes )
+            break;
+    }
+    
+    int status = len < 0 ? -1 : 0;
+    if ( status == 0 )
+        treeCombine( leaves, chunks, fanout, digest );
+    
+    int err = errno;
+    free( buffer );
+    free( leaves );
+    errno = err;
+    return status;
+}
+
+/**
+    Computes the tree hash of a file.  The file is split into chunkBytes-sized
+    chunks (the last one may be shorter, and an empty file is one empty chunk),
+    and the leaves are combined with treeCombine().  The digest is different
+    from the plain RIPEMD-160 of the file, and depends on chunkBytes and fanout.
+    Leaves of a regular file are hashed in parallel on the given number of
+    threads; other files are read and hashed in order.
+    
+    @param filename name of file to hash
+    @param chunkBytes bytes per leaf, at least 1
+    @param fanout maximum children per parent, at least 2
+    @param threads number of threads to use
+    @param digest storage for the root digest
+    @return 0 on success, -1 with errno set if the file can't be opened or read
+  */
+int treeHashFile( const char *filename, size_t chunkBytes, int fanout, int threads,
+                  byte digest[ DIGEST_BYTES ] )
+{
+    int fd = open( filename, O_RDONLY );
+    if ( fd < 0 )
+        return -1;
+    
+    struct stat st;
+    int status;
+    
+    if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) )
+        status = treeHashRegular( fd, st.st_size, chunkBytes, fanout, threads, digest );
+    else
+        status = treeHashStream( fd, chunkBytes, fanout, digest );
+    
+    int err = errno;
+    close( fd );
+    errno = err;
+    
+    return status;
+}
@@ -0,0 +1,65 @@
+/** 
+    @filename treeHash.h
+    @author Will Greene (wgreene)
+    
+    Header file for treeHash.c
+*/
+#ifndef _TREE_HASH_H_
+#define _TREE_HASH_H_
+
+#include "ripeMD.h"
+
+/** Default number of message bytes in each leaf of a tree hash. */
+#define DEFAULT_TREE_CHUNK_BYTES ( 1024 * 1024 )
+
+/** Default number of children combined by each parent node. */
+#define DEFAULT_TREE_FANOUT 16
+
+/** Byte hashed in front of each chunk to make a leaf digest. */
+#define TREE_LEAF_PREFIX 0x00
+
+/** Byte hashed in front of the child digests to make a parent digest. */
+#define TREE_NODE_PREFIX 0x01
+
+/**
+    Computes the digest of one leaf of a tree hash: RIPEMD-160 of the leaf
+    prefix byte followed by the chunk.
+    
+    @param chunk message bytes in this leaf
+    @param len number of bytes in chunk
+    @param digest storage for the leaf digest
+  */
+void treeLeaf( const byte *chunk, size_t len, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Combines a level of n digests into the root of the tree.  Each parent is
+    RIPEMD-160 of the node prefix byte followed by up to fanout child digests,
+    in order.  Levels are combined until a single parent remains, so even a
+    one-leaf tree gets a parent.  The digests array is overwritten.
+    
+    @param digests n packed digests, the leaves
+    @param n number of leaves, at least 1
+    @param fanout maximum children per parent, at least 2
+    @param root storage for the root digest
+  */
+void treeCombine( byte *digests, size_t n, int fanout, byte root[ DIGEST_BYTES ] );
+
+/**
+    Computes the tree hash of a file.  The file is split into chunkBytes-sized
+    chunks (the last one may be shorter, and an empty file is one empty chunk),
+    and the leaves are combined with treeCombine().  The digest is different
+    from the plain RIPEMD-160 of the file, and depends on chunkBytes and fanout.
+    Leaves of a regular file are hashed in parallel on the given number of
+    threads; other files are read and hashed in order.
+    
+    @param filename name of file to hash
+    @param chunkBytes bytes per leaf, at least 1
+    @param fanout maximum children per parent, at least 2
+    @param threads number of threads to use
+    @param digest storage for the root digest
+    @return 0 on success, -1 with errno set if the file can't be opened or read
+  */
+int treeHashFile( const char *filename, size_t chunkBytes, int fanout, int threads,
+                  byte digest[ DIGEST_BYTES ] );
+
+#endif
@@ -0,0 +1,452 @@
+/** 
+    @filename uringHash.c
+    @author Will Greene (wgreene)
+    
+    Contains an asynchronous read backend for hashing many files, built
+    directly on the io_uring system calls.  Builds without io_uring support
+    fall back to the blocking reads in fileHash.c.
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "uringHash.h"
+#include "stats.h"
+
+#if defined( __linux__ ) && defined( __has_include )
+#if __has_include( <linux/io_uring.h> )
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/** One io_uring instance: the submission and completion queues, mapped
+    into our memory. */
+typedef struct {
+  /** File descriptor for the ring. */
+  int fd;
+  
+  /** Submission queue head, advanced by the kernel. */
+  unsigned *sqHead;
+  
+  /** Submission queue tail, advanced by us. */
+  unsigned *sqTail;
+  
+  /** Mask for indexing the submission queue. */
+  unsigned sqMask;
+  
+  /** Submission queue index array. */
+  unsigned *sqArray;
+  
+  /** Submission queue entries. */
+  struct io_uring_sqe *sqes;
+  
+  /** Completion queue head, advanced by us. */
+  unsigned *cqHead;
+  
+  /** Completion queue tail, advanced by the kernel. */
+  unsigned *cqTail;
+  
+  /** Mask for indexing the completion queue. */
+  unsigned cqMask;
+  
+  /** Completion queue entries. */
+  struct io_uring_cqe *cqes;
+  
+  /** Mapping holding the submission queue ring. */
+  void *sqMap;
+  
+  /** Length of sqMap. */
+  size_t sqMapBytes;
+  
+  /** Mapping holding the completion queue ring, maybe the same as sqMap. */
+  void *cqMap;
+  
+  /** Length of cqMap. */
+  size_t cqMapBytes;
+  
+  /** Length of the mapping holding sqes. */
+  size_t sqesBytes;
+  
+  /** Number of submissions queued but not yet passed to the kernel. */
+  unsigned pending;
+} Uring;
+
+/**
+    Creates a ring with room for the given number of entries.
+    
+    @param ring Uring to initialize
+    @param entries queue depth
+    @return 0 on success, -1 with errno set if io_uring isn't usable
+  */
+static int uringInit( Uring *ring, unsigned entries )
+{
+    struct io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+    memset( ring, 0, sizeof( *ring ) );
+    
+    ring->fd = syscall( __NR_io_uring_setup, entries, &params );
+    if ( ring->fd < 0 )
+        return -1;
+    
+    ring->sqMapBytes = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    ring->cqMapBytes = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+    
+    // Newer kernels put both rings in a single mapping.
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        if ( ring->cqMapBytes > ring->sqMapBytes )
+            ring->sqMapBytes = ring->cqMapBytes;
+        ring->cqMapBytes = ring->sqMapBytes;
+    }
+    
+    ring->sqMap = mmap( NULL, ring->sqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING );
+    if ( ring->sqMap == MAP_FAILED )
+        goto fail;
+    
+    if ( params.features & IORING_FEAT_SINGLE_MMAP )
+        ring->cqMap = ring->sqMap;
+    else {
+        ring->cqMap = mmap( NULL, ring->cqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING );
+        if ( ring->cqMap == MAP_FAILED )
+            goto failSq;
+    }
+    
+    ring->sqesBytes = params.sq_entries * sizeof( struct io_uring_sqe );
+    ring->sqes = mmap( NULL, ring->sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQES );
+    if ( ring->sqes == MAP_FAILED )
+        goto failCq;
+    
+    byte *sq = (byte *) ring->sqMap;
+    ring->sqHead = (unsigned *) ( sq + params.sq_off.head );
+    ring->sqTail = (unsigned *) ( sq + params.sq_off.tail );
+    ring->sqMask = *(unsigned *) ( sq + params.sq_off.ring_mask );
+    ring->sqArray = (unsigned *) ( sq + params.sq_off.array );
+    
+    byte *cq = (byte *) ring->cqMap;
+    ring->cqHead = (unsigned *) ( cq + params.cq_off.head );
+    ring->cqTail = (unsigned *) ( cq + params.cq_off.tail );
+    ring->cqMask = *(unsigned *) ( cq + params.cq_off.ring_mask );
+    ring->cqes = (struct io_uring_cqe *) ( cq + params.cq_off.cqes );
+    
+    return 0;
+    
+failCq:
+    if ( ring->cqMap != ring->sqMap )
+        munmap( ring->cqMap, ring->cqMapBytes );
+failSq:
+    munmap( ring->sqMap, ring->sqMapBytes );
+fail:
+    close( ring->fd );
+    return -1;
+}
+
+/**
+    Unmaps and closes a ring.
+    
+    @param ring Uring to free
+  */
+static void uringFree( Uring *ring )
+{
+    munmap( ring->sqes, ring->sqesBytes );
+    if ( ring->cqMap != ring->sqMap )
+        munmap( ring->cqMap, ring->cqMapBytes );
+    munmap( ring->sqMap, ring->sqMapBytes );
+    close( ring->fd );
+}
+
+/**
+    Queues a read of len bytes at the given offset.  The request isn't passed
+    to the kernel until the next uringWait().
+    
+    @param ring Uring to use
+    @param fd file to read
+    @param buffer storage for the bytes
+    @param len number of bytes to read
+    @param offset position in the file
+    @param tag value returned with the completion
+  */
+static void uringRead( Uring *ring, int fd, byte *buffer, unsigned len, unsigned long long offset,
+                       unsigned long long tag )
+{
+    unsigned tail = *ring->sqTail;
+    unsigned index = tail & ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[ index ];
+    
+    memset( sqe, 0, sizeof( *sqe ) );
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long) (size_t) buffer;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    
+    ring->sqArray[ index ] = index;
+    __atomic_store_n( ring->sqTail, tail + 1, __ATOMIC_RELEASE );
+    ring->pending++;
+}
+
+/**
+    Submits any queued reads and waits for at least one completion.
+    
+    @param ring Uring to use
+    @return 0 on success, -1 with errno set on failure
+  */
+static int uringWait( Uring *ring )
+{
+    for ( ;; ) {
+        int n = syscall( __NR_io_uring_enter, ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS,
+                         NULL, 0 );
+        if ( n >= 0 ) {
+            ring->pending -= n;
+            return 0;
+        }
+        if ( errno != EINTR )
+            return -1;
+    }
+}
+
+/**
+    Takes the next completion off the ring, if there is one.
+    
+    @param ring Uring to use
+    @param tag set to the tag of the completed read
+    @param result set to the result of the read: bytes read, or minus errno
+    @return true if there was a completion
+  */
+static int uringReap( Uring *ring, unsigned long long *tag, int *result )
+{
+    unsigned head = *ring->cqHead;
+    if ( head == __atomic_load_n( ring->cqTail, __ATOMIC_ACQUIRE ) )
+        return 0;
+    
+    struct io_uring_cqe *cqe = &ring->cqes[ head & ring->cqMask ];
+    *tag = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n( ring->cqHead, head + 1, __ATOMIC_RELEASE );
+    return 1;
+}
+
+/**
+    Reports whether this kernel (and build) supports io_uring.  The answer is
+    worked out once, by trying to create a ring.
+    
+    @return true if hashFilesUring() will use io_uring
+  */
+int uringAvailable( void )
+{
+    // -1 until we know.
+    static int available = -1;
+    
+    int result = __atomic_load_n( &available, __ATOMIC_RELAXED );
+    if ( result < 0 ) {
+        Uring ring;
+        result = uringInit( &ring, 1 ) == 0;
+        if ( result )
+            uringFree( &ring );
+        __atomic_store_n( &available, result, __ATOMIC_RELAXED );
+    }
+    
+    return result;
+}
+
+/** One file being read through the ring. */
+typedef struct {
+  /** The job for this file. */
+  FileJob *job;
+  
+  /** Open file. */
+  int fd;
+  
+  /** Offset of the next read. */
+  unsigned long long offset;
+  
+  /** Hash of the file so far. */
+  HashContext ctx;
+  
+  /** Buffer the current read goes into. */
+  byte *buffer;
+} UringFile;
+
+/**
+    Opens the next job's file in the given slot and queues its first read.
+    Jobs whose files can't be opened are finished on the spot.
+    
+    @param ring Uring to use
+    @param slots all the slots
+    @param s index of the slot to fill
+    @param jobs remaining jobs
+    @param count number of remaining jobs
+    @return number of jobs used up
+  */
+static size_t startFile( Uring *ring, UringFile slots[], size_t s, FileJob jobs[], size_t count )
+{
+    UringFile *slot = &slots[ s ];
+    
+    for ( size_t used = 0; used < count; used++ ) {
+        int fd = open( jobs[ used ].path, O_RDONLY );
+        if ( fd < 0 ) {
+            jobs[ used ].error = errno;
+            continue;
+        }
+        
+        slot->job = &jobs[ used ];
+        slot->fd = fd;
+        slot->offset = 0;
+        initContext( &slot->ctx );
+        uringRead( ring, fd, slot->buffer, URING_READ_BYTES, 0, s );
+        return used + 1;
+    }
+    
+    slot->job = NULL;
+    return count;
+}
+
+/**
+    Hashes a batch of files through io_uring: every file in the batch gets
+    its own read in flight (up to URING_QUEUE_DEPTH at once), and each
+    completed buffer is hashed by this thread while the kernel works on the
+    rest.  This is a BatchHasher for hashFileBatches().  Files the ring can't
+    read are hashed with hashFile() instead.
+    
+    @param jobs files to hash
+    @param count number of jobs
+  */
+void hashBatchUring( FileJob jobs[], size_t count )
+{
+    Uring ring;
+    size_t depth = count < URING_QUEUE_DEPTH ? count : URING_QUEUE_DEPTH;
+    UringFile *slots = (UringFile *) calloc( depth, sizeof( UringFile ) );
+    byte *buffers = (byte *) malloc( depth * URING_READ_BYTES );
+    
+    if ( !slots || !buffers || uringInit( &ring, depth ) != 0 ) {
+        for ( size_t i = 0; i < count; i++ )
+            jobs[ i ].error = hashFile( jobs[ i ].path, jobs[ i ].digest ) == 0 ? 0 : errno;
+        free( slots );
+        free( buffers );
+        return;
+    }
+    
+    size_t next = 0;
+    int active = 0;
+    for ( size_t s = 0; s < depth; s++ ) {
+        slots[ s ].buffer = buffers + s * URING_READ_BYTES;
+        next += startFile( &ring, slots, s, jobs + next, count - next );
+        active += slots[ s ].job != NULL;
+    }
+    
+    while ( active > 0 ) {
+        if ( uringWait( &ring ) != 0 )
+            break;
+        
+        unsigned long long tag;
+        int result;
+        
+        while ( uringReap( &ring, &tag, &result ) ) {
+            UringFile *slot = &slots[ tag ];
+            
+            if ( result == -EINTR || result == -EAGAIN ) {
+                uringRead( &ring, slot->fd, slot->buffer, URING_READ_BYTES, slot->offset, tag );
+                continue;
+            }
+            
+            if ( result > 0 ) {
+                STATS_ADD( COUNT_BYTES_READ, result );
+                STATS_START( timer );
+                updateContext( &slot->ctx, slot->buffer, result );
+                STATS_STOP( timer, STAGE_COMPRESS );
+                slot->offset += result;
+                uringRead( &ring, slot->fd, slot->buffer, URING_READ_BYTES, slot->offset, tag );
+                continue;
+            }
+            
+            // End of file, or an error.  A kernel too old for IORING_OP_READ
+            // says EINVAL; hash those files the ordinary way.
+            FileJob *job = slot->job;
+            if ( result == 0 ) {
+                STATS_START( timer );
+                finishContext( &slot->ctx, job->digest );
+                STATS_STOP( timer, STAGE_PAD );
+                job->error = 0;
+            } else if ( result == -EINVAL && slot->offset == 0 )
+                job->error = hashFile( job->path, job->digest ) == 0 ? 0 : errno;
+            else
+                job->error = -result;
+            
+            close( slot->fd );
+            next += startFile( &ring, slots, tag, jobs + next, count - next );
+            active -= slot->job == NULL;
+        }
+    }
+    
+    // Only reached early if the ring itself failed; finish up the slow way.
+    if ( active > 0 ) {
+        for ( size_t s = 0; s < depth; s++ ) {
+            if ( slots[ s ].job ) {
+                close( slots[ s ].fd );
+                slots[ s ].job->error = hashFile( slots[ s ].job->path, slots[ s ].job->digest ) == 0 ? 0 : errno;
+            }
+        }
+        for ( ; next < count; next++ )
+            jobs[ next ].error = hashFile( jobs[ next ].path, jobs[ next ].digest ) == 0 ? 0 : errno;
+    }
+    
+    uringFree( &ring );
+    free( slots );
+    free( buffers );
+}
+
+#else
+
+/**
+    This build has no io_uring support.
+    
+    @return false
+  */
+int uringAvailable( void )
+{
+    return 0;
+}
+
+/**
+    Without io_uring, hashes each file with hashFile().
+    
+    @param jobs files to hash
+    @param count number of jobs
+  */
+void hashBatchUring( FileJob jobs[], size_t count )
+{
+    for ( size_t i = 0; i < count; i++ )
+        jobs[ i ].error = hashFile( jobs[ i ].path, jobs[ i ].digest ) == 0 ? 0 : errno;
+}
+
+#endif
+
+/**
+    Hashes every file in the list like hashFiles(), using io_uring to keep
+    many reads in flight on each worker.  If io_uring isn't available, this
+    is just hashFiles() with the blocking reads.
+    
+    @param jobs list of files to hash
+    @param n number of jobs
+    @param threads number of worker threads
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+void hashFilesUring( FileJob jobs[], size_t n, int threads, JobDone done, void *arg )
+{
+    if ( uringAvailable() )
+        hashFileBatches( jobs, n, threads, hashBatchUring, done, arg );
+    else
+        hashFiles( jobs, n, threads, NULL, done, arg );
+}
@@ -0,0 +1,51 @@
+/** 
+    @filename uringHash.h
+    @author Will Greene (wgreene)
+    
+    Header file for uringHash.c
+*/
+#ifndef _URING_HASH_H_
+#define _URING_HASH_H_
+
+#include "hashPool.h"
+
+/** Most reads each worker keeps in flight at once, one per file. */
+#define URING_QUEUE_DEPTH 64
+
+/** Size of each read submitted to the ring. */
+#define URING_READ_BYTES 65536
+
+/**
+    Reports whether this kernel (and build) supports io_uring.  The answer is
+    worked out once, by trying to create a ring.
+    
+    @return true if hashFilesUring() will use io_uring
+  */
+int uringAvailable( void );
+
+/**
+    Hashes a batch of files through io_uring: every file in the batch gets
+    its own read in flight (up to URING_QUEUE_DEPTH at once), and each
+    completed buffer is hashed by this thread while the kernel works on the
+    rest.  This is a BatchHasher for hashFileBatches().  Files the ring can't
+    read are hashed with hashFile() instead.
+    
+    @param jobs files to hash
+    @param count number of jobs
+  */
+void hashBatchUring( FileJob jobs[], size_t count );
+
+/**
+    Hashes every file in the list like hashFiles(), using io_uring to keep
+    many reads in flight on each worker.  If io_uring isn't available, this
+    is just hashFiles() with the blocking reads.
+    
+    @param jobs list of files to hash
+    @param n number of jobs
+    @param threads number of worker threads
+    @param done function called for each finished job, in order
+    @param arg passed through to done
+  */
+void hashFilesUring( FileJob jobs[], size_t n, int threads, JobDone done, void *arg );
+
+#endif
@@ -0,0 +1,212 @@
+/** 
+    @filename verify.c
+    @author Will Greene (wgreene)
+    
+    Contains a checking mode, which verifies files against a manifest of
+    expected digests.
+*/
+#include <errno.h>
+#include <string.h>
+#include "verify.h"
+#include "byteBuffer.h"
+
+/** One batch of manifest entries being checked. */
+typedef struct {
+  /** The files, one job per entry. */
+  FileJob *jobs;
+  
+  /** Expected digest for each job. */
+  byte *expected;
+  
+  /** Where failures are reported. */
+  OutputBuffer *out;
+  
+  /** Running tally. */
+  VerifyCounts *counts;
+} VerifyBatch;
+
+/**
+    Returns the value of a hex digit.
+    
+    @param ch character to convert
+    @return 0 to 15, or -1 if ch isn't a hex digit
+  */
+static int hexValue( char ch )
+{
+    if ( ch >= '0' && ch <= '9' )
+        return ch - '0';
+    if ( ch >= 'a' && ch <= 'f' )
+        return ch - 'a' + 10;
+    if ( ch >= 'A' && ch <= 'F' )
+        return ch - 'A' + 10;
+    return -1;
+}
+
+/**
+    Parses a digest written as 40 hex digits, either case.
+    
+    @param text the digits; anything after the 40th is ignored
+    @param digest storage for the digest
+    @return 0 on success, -1 if text doesn't start with 40 hex digits
+  */
+int parseHexDigest( const char *text, byte digest[ DIGEST_BYTES ] )
+{
+    for ( int i = 0; i < DIGEST_BYTES; i++ ) {
+        int high = hexValue( text[ 2 * i ] );
+        int low = high < 0 ? -1 : hexValue( text[ 2 * i + 1 ] );
+        if ( low < 0 )
+            return -1;
+        digest[ i ] = high << 4 | low;
+    }
+    
+    return 0;
+}
+
+/**
+    Adds "<path>: <status>" and a newline to the output, and writes it out
+    right away.
+    
+    @param out OutputBuffer address
+    @param path file name
+    @param status what went wrong
+  */
+static void reportFailure( OutputBuffer *out, const char *path, const char *status )
+{
+    putBytes( out, path, strlen( path ) );
+    putBytes( out, ": ", 2 );
+    putBytes( out, status, strlen( status ) );
+    putBytes( out, "\n", 1 );
+    flushOutput( out );
+}
+
+/**
+    Checks one finished job against its expected digest.
+    
+    @param job the finished job
+    @param arg the VerifyBatch
+  */
+static void checkJob( FileJob *job, void *arg )
+{
+    VerifyBatch *batch = (VerifyBatch *) arg;
+    const byte *expected = batch->expected + ( job - batch->jobs ) * DIGEST_BYTES;
+    
+    if ( job->error == ENOENT ) {
+        batch->counts->missing++;
+        reportFailure( batch->out, job->path, "MISSING" );
+    } else if ( job->error ) {
+        char status[ 128 ];
+        snprintf( status, sizeof( status ), "UNREADABLE (%s)", strerror( job->error ) );
+        batch->counts->unreadable++;
+        reportFailure( batch->out, job->path, status );
+    } else if ( memcmp( job->digest, expected, DIGEST_BYTES ) != 0 ) {
+        batch->counts->failed++;
+        reportFailure( batch->out, job->path, "FAILED" );
+    } else
+        batch->counts->ok++;
+}
+
+/**
+    Checks every file listed in a manifest, made of lines of the form
+    "<digest>  <path>" as printed for several files, with the digest in hex.
+    Files are hashed in parallel, a batch of entries at a time, and compared
+    to the parsed digests byte for byte.  Each failure is written to out as
+    soon as it and all the entries before it are checked, in manifest order:
+    "<path>: FAILED", "<path>: MISSING" or "<path>: UNREADABLE (<reason>)".
+    Malformed lines are reported on stderr, in order with the failures.
+    
+    @param manifest name of the manifest file, or - for standard input
+    @param threads number of worker threads
+    @param hasher function used to hash each file, or NULL for hashFile()
+    @param out where failures are reported
+    @param counts set to the tally of the entries
+    @return 0 if the manifest was read, -1 with errno set if it couldn't be
+  */
+int verifyManifest( const char *manifest, int threads, FileHasher hasher, OutputBuffer *out,
+                    VerifyCounts *counts )
+{
+    memset( counts, 0, sizeof( *counts ) );
+    
+    // Only the manifest itself is held in memory; the paths point into it.
+    // A manifest that can't be read in full isn't checked at all.
+    ByteBuffer *buffer = readFile( strcmp( manifest, "-" ) == 0 ? "/dev/stdin" : manifest );
+    if ( !buffer )
+        return -1;
+    addByte( buffer, '\n' );
+    
+    FileJob *jobs = (FileJob *) malloc( VERIFY_BATCH_JOBS * sizeof( FileJob ) );
+    byte *expected = (byte *) malloc( VERIFY_BATCH_JOBS * DIGEST_BYTES );
+    if ( !jobs || !expected ) {
+        free( jobs );
+        free( expected );
+        freeBuffer( buffer );
+        errno = ENOMEM;
+        return -1;
+    }
+    
+    VerifyBatch batch = { jobs, expected, out, counts };
+    char *line = (char *) buffer->data;
+    char *end = line + buffer->len;
+    size_t lineNumber = 0;
+    
+    while ( line < end ) {
+        size_t n = 0;
+        
+        while ( n < VERIFY_BATCH_JOBS && line < end ) {
+            char *newline = (char *) memchr( line, '\n', end - line );
+            *newline = '\0';
+            if ( newline > line && newline[ -1 ] == '\r' )
+                newline[ -1 ] = '\0';
+            lineNumber++;
+            
+            // The digest, two spaces (or a space and a * for binary mode, as
+            // sha1sum writes), then the path.
+            size_t len = strlen( line );
+            if ( len > 0 ) {
+                if ( len > HEX_DIGEST_CHARS + 2 && line[ HEX_DIGEST_CHARS ] == ' ' &&
+                     ( line[ HEX_DIGEST_CHARS + 1 ] == ' ' || line[ HEX_DIGEST_CHARS + 1 ] == '*' ) &&
+                     parseHexDigest( line, expected + n * DIGEST_BYTES ) == 0 ) {
+                    jobs[ n ].path = line + HEX_DIGEST_CHARS + 2;
+                    n++;
+                } else {
+                    // Check the entries before this line first, so the
+                    // warning comes out in order with their results.
+                    hashFiles( jobs, n, threads, hasher, checkJob, &batch );
+                    n = 0;
+                    flushOutput( out );
+                    fprintf( stderr, "%s:%zu: improperly formatted line\n", manifest, lineNumber );
+                    counts->malformed++;
+                }
+            }
+            
+            line = newline + 1;
+        }
+        
+        hashFiles( jobs, n, threads, hasher, checkJob, &batch );
+    }
+    
+    free( jobs );
+    free( expected );
+    freeBuffer( buffer );
+    return 0;
+}
+
+/**
+    Sums up a check as an exit status: zero if every entry was fine,
+    otherwise the VERIFY_ bits for each kind of problem found.
+    
+    @param counts tally from verifyManifest()
+    @return exit status
+  */
+int verifyStatus( const VerifyCounts *counts )
+{
+    int status = 0;
+    
+    if ( counts->failed )
+        status |= VERIFY_FAILED;
+    if ( counts->missing || counts->unreadable )
+        status |= VERIFY_UNREADABLE;
+    if ( counts->malformed )
+        status |= VERIFY_MALFORMED;
+    
+    return status;
+}
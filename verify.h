@@ -0,0 +1,84 @@
+/** 
+    @filename verify.h
+    @author Will Greene (wgreene)
+    
+    Header file for verify.c
+*/
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+#include "hashPool.h"
+#include "outputBuffer.h"
+
+/** Most manifest entries checked at a time, so the job list for a huge
+    manifest stays small. */
+#define VERIFY_BATCH_JOBS 65536
+
+/** Exit status bit for files whose digest didn't match. */
+#define VERIFY_FAILED 1
+
+/** Exit status bit for files that are missing or unreadable. */
+#define VERIFY_UNREADABLE 2
+
+/** Exit status bit for malformed manifest lines. */
+#define VERIFY_MALFORMED 4
+
+/** Exit status bit for a manifest that couldn't be read at all. */
+#define VERIFY_NO_MANIFEST 8
+
+/** Tally of the entries in a manifest. */
+typedef struct {
+  /** Files whose digest matched. */
+  size_t ok;
+  
+  /** Files whose digest didn't match. */
+  size_t failed;
+  
+  /** Files that don't exist. */
+  size_t missing;
+  
+  /** Files that exist but couldn't be read. */
+  size_t unreadable;
+  
+  /** Lines that aren't a digest and a path. */
+  size_t malformed;
+} VerifyCounts;
+
+/**
+    Parses a digest written as 40 hex digits, either case.
+    
+    @param text the digits; anything after the 40th is ignored
+    @param digest storage for the digest
+    @return 0 on success, -1 if text doesn't start with 40 hex digits
+  */
+int parseHexDigest( const char *text, byte digest[ DIGEST_BYTES ] );
+
+/**
+    Checks every file listed in a manifest, made of lines of the form
+    "<digest>  <path>" as printed for several files, with the digest in hex.
+    Files are hashed in parallel, a batch of entries at a time, and compared
+    to the parsed digests byte for byte.  Each failure is written to out as
+    soon as it and all the entries before it are checked, in manifest order:
+    "<path>: FAILED", "<path>: MISSING" or "<path>: UNREADABLE (<reason>)".
+    Malformed lines are reported on stderr, in order with the failures.
+    
+    @param manifest name of the manifest file, or - for standard input
+    @param threads number of worker threads
+    @param hasher function used to hash each file, or NULL for hashFile()
+    @param out where failures are reported
+    @param counts set to the tally of the entries
+    @return 0 if the manifest was read, -1 with errno set if it couldn't be
+  */
+int verifyManifest( const char *manifest, int threads, FileHasher hasher, OutputBuffer *out,
+                    VerifyCounts *counts );
+
+/**
+    Sums up a check as an exit status: zero if every entry was fine,
+    otherwise the VERIFY_ bits for each kind of problem found.
+    
+    @param counts tally from verifyManifest()
+    @return exit status
+  */
+int verifyStatus( const VerifyCounts *counts );
+
+#endif